@@ -4,18 +4,35 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stdint.h>
 #include <signal.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <dirent.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <linux/sockios.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #include <lua.h>
 #include <lualib.h>
@@ -93,259 +110,3981 @@ fail:
 }
 
 /*
-** Multi-sendfile worker threads, shared data and helper functions
+** Create TCP socket listening on node (or all addresses if NULL) and service.
+** Returns socket on success. Otherwise, prints message into given buffer and returns -1.
 */
-struct ms_thread {
-    pthread_t thread;
-    int created;            /* Indicates that the thread should be joined/canceled for cleanup */
-    int successful;         /* 1 if no errors occurred, 0 otherwise. The error will be printed into errmsg. */
-    char errmsg[8192];
+static int listentcpsock(int af, const char* node, const char* service, char* msgbuf, size_t msglen, int reuseaddr)
+{
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family     = af;
+    hints.ai_socktype   = SOCK_STREAM;
+    hints.ai_flags      = AI_PASSIVE;
+    int err = getaddrinfo(node, service, &hints, &result);
+    if (err) {
+        snprintf(msgbuf, msglen, "getaddrinfo: %s", gai_strerror(err));
+        return -1;
+    }
+    const char* lasterr = "No results for getaddrinfo";
+    for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype|SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            lasterr = strerror(errno);
+            continue;
+        }
+        int one = 1;
+        if (reuseaddr)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0) {
+            freeaddrinfo(result);
+            return fd;
+        }
+        lasterr = strerror(errno);
+        close(fd);
+    }
+    snprintf(msgbuf, msglen, "No usable address: %s", lasterr);
+    freeaddrinfo(result);
+    return -1;
+}
+
+/*
+** Incremental HTTP/1.x response parser. Data can be fed in arbitrarily sized
+** pieces; rp_feed() stops after every complete response, so that the caller can
+** act on response boundaries. Optionally, a hash over each response is calculated
+** which ignores volatile headers like Date, so identical responses hash equally.
+** A second, independent check hash over the same bytes tells apart responses whose
+** hash collides.
+*/
+enum rp_state {
+    RP_STATUS,                          /* Reading status line */
+    RP_HEADER,                          /* Reading header lines */
+    RP_BODY,                            /* Reading body with known length */
+    RP_BODY_EOF,                        /* Reading body until connection is closed */
+    RP_CHUNK_SIZE,                      /* Reading chunk size line */
+    RP_CHUNK_DATA,                      /* Reading chunk data */
+    RP_CHUNK_END,                       /* Reading CRLF after chunk data */
+    RP_TRAILER,                         /* Reading trailer lines after last chunk */
+    RP_ERROR                            /* Framing error, message is in errmsg */
 };
 
-struct ms_conn {
-    int fd_in;                          /* Request file to send */
-    int fd_out;                         /* Response log */
-    int fd_sock;                        /* TCP socket for HTTP connection, created by sender */
-    const char* host;                   /* Host name */
-    const char* port;                   /* Host port */
-    int use_shutdown;                   /* shutdown(SHUT_WR) after send is complete */
-    int ignore_out;                     /* Do not use fd_out */
-    size_t in_len;                      /* Length of data to send */
-    char in_file[4096];                 /* Path of fd_in */
-    char out_file[4096];                /* Path of fd_out */
-    pthread_barrier_t* barrier;         /* Barrier to block all threads until all are ready, belonging to lcf_multi_sendfile */
-    pthread_mutex_t connectmx;          /* Mutex to block receiver until fd_sock is connected */
-    int connectmx_created;              /* Indicates that connectmx should be destroyed for cleanup */
-    struct ms_thread sender;            /* Sender status */
-    struct ms_thread receiver;          /* Receiver status */
-    char recvbuf[32 * 1024];            /* Receive buffer; threads have only minimal stack space */
-    size_t recv_total;
-    struct timespec connect_start;      /* Before connect() */
-    struct timespec connect_end;        /* After connect() */
-    struct timespec send_start;         /* Before first sendfile() */
-    struct timespec send_end;           /* After last sendfile() */
-    struct timespec receive_start;      /* Before first recv() */
-    struct timespec receive_end;        /* After last recv() */
-    struct ms_conn* prev;               /* Chain connection structures into simple linked list */
+#define RP_MORE     0                   /* All data consumed, response not complete yet */
+#define RP_DONE     1                   /* Response complete, results are in res_* fields */
+#define RP_FAIL     (-1)                /* Framing error or truncated response */
+
+#define RP_FNV_OFFSET   0xcbf29ce484222325ULL
+#define RP_FNV_PRIME    0x100000001b3ULL
+#define RP_CHECK_OFFSET 0x6a09e667f3bcc909ULL
+#define RP_CHECK_MUL    0x9e3779b97f4a7c15ULL
+
+struct rp_parser {
+    enum rp_state state;
+    int hashing;                        /* Calculate hash over responses */
+    int truncated;                      /* Stream ended in the middle of a response */
+    int status;                         /* Status code of current response */
+    int chunked;                        /* Transfer-Encoding: chunked */
+    int has_length;                     /* Content-Length was given */
+    int no_body;                        /* Current response answers a HEAD request, set by caller */
+    uint64_t remaining;                 /* Body or chunk bytes left */
+    uint64_t length;                    /* Bytes of current response so far, including headers */
+    uint64_t body_len;                  /* Body bytes of current response so far, without chunk framing */
+    uint64_t hash;                      /* Hash of current response so far */
+    uint64_t check;                     /* Check hash of current response so far */
+    int res_status;                     /* Status code of last complete response */
+    uint64_t res_length;                /* Total length of last complete response */
+    uint64_t res_body_len;              /* Body length of last complete response */
+    uint64_t res_hash;                  /* Hash of last complete response */
+    uint64_t res_check;                 /* Check hash of last complete response */
+    size_t line_len;
+    char line[8192];                    /* Current status, header, or chunk size line */
+    char errmsg[128];
 };
 
-static void* ms_sender_thread(struct ms_conn* conn)
+static uint64_t rp_hash(uint64_t h, const char* data, size_t len)
 {
-    /* Initialize and wait */
-    struct ms_thread* status = &conn->sender;
-    status->successful = 0;
-    int err = pthread_mutex_lock(&conn->connectmx);
-    if (err) {
-        snprintf(status->errmsg, sizeof status->errmsg,
-            "pthread_mutex_lock failed: %s", strerror(err));
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= RP_FNV_PRIME;
     }
-    pthread_barrier_wait(conn->barrier);
-    if (err) {
-        return NULL;
+    return h;
+}
+
+/* Check hash, a multiplicative hash unrelated to FNV-1a */
+static uint64_t rp_check(uint64_t h, const char* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; ++i) {
+        h = (h + p[i]) * RP_CHECK_MUL;
+        h ^= h >> 29;
     }
-    /* Connect TCP socket */
-    clock_gettime(CLOCK_MONOTONIC, &conn->connect_start);
-    char errmsg[256];
-    if ((conn->fd_sock = connecttcpsock(AF_UNSPEC, conn->host, conn->port, errmsg, sizeof errmsg, 0, 0, 0)) < 0) {
-        snprintf(status->errmsg, sizeof status->errmsg,
-            "Cannot open TCP connection to %s:%s: %s", conn->host, conn->port, errmsg);
-        return NULL;
+    return h;
+}
+
+/* Add data to both hashes of the current response */
+static void rp_digest(struct rp_parser* p, const char* data, size_t len)
+{
+    p->hash = rp_hash(p->hash, data, len);
+    p->check = rp_check(p->check, data, len);
+}
+
+static void rp_reset(struct rp_parser* p)
+{
+    p->state = RP_STATUS;
+    p->status = 0;
+    p->chunked = 0;
+    p->has_length = 0;
+    p->remaining = 0;
+    p->length = 0;
+    p->body_len = 0;
+    p->hash = RP_FNV_OFFSET;
+    p->check = RP_CHECK_OFFSET;
+}
+
+static void rp_init(struct rp_parser* p, int hashing)
+{
+    rp_reset(p);
+    p->hashing = hashing;
+    p->no_body = 0;
+    p->truncated = 0;
+    p->res_status = 0;
+    p->res_length = 0;
+    p->res_body_len = 0;
+    p->res_hash = 0;
+    p->res_check = 0;
+    p->line_len = 0;
+    p->errmsg[0] = '\0';
+}
+
+static int rp_fail(struct rp_parser* p, const char* msg)
+{
+    p->state = RP_ERROR;
+    snprintf(p->errmsg, sizeof p->errmsg, "%s", msg);
+    return RP_FAIL;
+}
+
+static int rp_complete(struct rp_parser* p)
+{
+    p->res_status = p->status;
+    p->res_length = p->length;
+    p->res_body_len = p->body_len;
+    p->res_hash = p->hash ? p->hash : 1;
+    p->res_check = p->check;
+    rp_reset(p);
+    return RP_DONE;
+}
+
+/* Case-insensitive comparison of header name */
+static int rp_isheader(const char* line, size_t namelen, const char* name)
+{
+    return strlen(name) == namelen && strncasecmp(line, name, namelen) == 0;
+}
+
+/* Headers that change between otherwise identical responses */
+static int rp_isvolatile(const char* line, size_t namelen)
+{
+    return rp_isheader(line, namelen, "date")
+        || rp_isheader(line, namelen, "expires")
+        || rp_isheader(line, namelen, "last-modified")
+        || rp_isheader(line, namelen, "age");
+}
+
+/* Called after headers are complete: decide how the body is delimited */
+static int rp_headers_done(struct rp_parser* p)
+{
+    if (p->status < 200) {
+        /* Interim response like 100 Continue; the final one follows */
+        p->state = RP_STATUS;
+        return RP_MORE;
     }
-    clock_gettime(CLOCK_MONOTONIC, &conn->connect_end);
-    /* Unblock receiver thread */
-    err = pthread_mutex_unlock(&conn->connectmx);
-    if (err) {
-        snprintf(status->errmsg, sizeof status->errmsg,
-            "pthread_mutex_unlock failed: %s", strerror(err));
-        return NULL;
+    if (p->status == 204 || p->status == 304 || p->no_body)
+        return rp_complete(p);
+    if (p->chunked) {
+        p->state = RP_CHUNK_SIZE;
+        return RP_MORE;
     }
-    /* Send all requests */
-    clock_gettime(CLOCK_MONOTONIC, &conn->send_start);
-    size_t remaining = conn->in_len;
-    while (remaining > 0) {
-        ssize_t sent = sendfile(conn->fd_sock, conn->fd_in, NULL, remaining);
-        if (sent < 0) {
-            snprintf(status->errmsg, sizeof status->errmsg,
-                "sendfile failed: %s", strerror(errno));
-            return NULL;
+    if (p->has_length) {
+        if (p->remaining == 0)
+            return rp_complete(p);
+        p->state = RP_BODY;
+        return RP_MORE;
+    }
+    p->state = RP_BODY_EOF;
+    return RP_MORE;
+}
+
+/* Process one line without CRLF */
+static int rp_line(struct rp_parser* p, char* line, size_t len)
+{
+    switch (p->state) {
+    case RP_STATUS:
+        if (len == 0)
+            return RP_MORE;
+        if (len < 12 || strncmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ')
+            return rp_fail(p, "Invalid status line");
+        p->status = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+        if (p->status < 100 || p->status > 999)
+            return rp_fail(p, "Invalid status code");
+        if (p->hashing) {
+            rp_digest(p, line, len);
+            rp_digest(p, "\n", 1);
         }
-        if ((size_t)sent >= remaining) {
-            if (conn->use_shutdown) {
-                shutdown(conn->fd_sock, SHUT_WR);
-            }
-            remaining = 0;
+        p->state = RP_HEADER;
+        return RP_MORE;
+    case RP_HEADER: {
+        if (len == 0)
+            return rp_headers_done(p);
+        char* colon = memchr(line, ':', len);
+        if (colon == NULL)
+            return rp_fail(p, "Invalid header line");
+        size_t namelen = colon - line;
+        char* value = colon + 1;
+        while (value < line + len && (*value == ' ' || *value == '\t'))
+            ++value;
+        if (rp_isheader(line, namelen, "content-length")) {
+            char* end;
+            errno = 0;
+            unsigned long long n = strtoull(value, &end, 10);
+            if (errno || end == value)
+                return rp_fail(p, "Invalid Content-Length");
+            p->has_length = 1;
+            p->remaining = n;
+        } else if (rp_isheader(line, namelen, "transfer-encoding")) {
+            /* Only the last transfer coding decides about framing */
+            size_t vlen = line + len - value;
+            while (vlen > 0 && (value[vlen - 1] == ' ' || value[vlen - 1] == '\t'))
+                --vlen;
+            p->chunked = vlen >= 7 && strncasecmp(value + vlen - 7, "chunked", 7) == 0;
+        }
+        if (p->hashing && ! rp_isvolatile(line, namelen)) {
+            rp_digest(p, line, len);
+            rp_digest(p, "\n", 1);
+        }
+        return RP_MORE;
+    }
+    case RP_CHUNK_SIZE: {
+        char* end;
+        errno = 0;
+        unsigned long long n = strtoull(line, &end, 16);
+        if (errno || end == line || (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+            return rp_fail(p, "Invalid chunk size");
+        if (n == 0) {
+            p->state = RP_TRAILER;
         } else {
-            remaining -= sent;
+            p->remaining = n;
+            p->state = RP_CHUNK_DATA;
         }
+        return RP_MORE;
+    }
+    case RP_CHUNK_END:
+        if (len != 0)
+            return rp_fail(p, "Missing CRLF after chunk data");
+        p->state = RP_CHUNK_SIZE;
+        return RP_MORE;
+    case RP_TRAILER:
+        if (len == 0)
+            return rp_complete(p);
+        return RP_MORE;
+    default:
+        return rp_fail(p, "Parser in invalid state");
     }
-    clock_gettime(CLOCK_MONOTONIC, &conn->send_end);
-    /* No problems occurred */
-    status->successful = 1;
-    return NULL;
 }
 
-static void* ms_receiver_thread(struct ms_conn* conn)
+/*
+** Feed data to parser. Stops after the first complete response. The number of
+** consumed bytes is stored in *used. Returns RP_DONE if a response is complete,
+** RP_MORE if all data was consumed without completing one, or RP_FAIL on errors.
+*/
+static int rp_feed(struct rp_parser* p, const char* data, size_t len, size_t* used)
 {
-    /* Initialize and wait */
-    struct ms_thread* status = &conn->receiver;
-    status->successful = 0;
-    conn->recv_total = 0;
-    pthread_barrier_wait(conn->barrier);
-    /* Wait until fd_sock is connected */
-    int err = pthread_mutex_lock(&conn->connectmx);
-    if (err) {
-        snprintf(status->errmsg, sizeof status->errmsg,
-            "pthread_mutex_lock failed: %s", strerror(err));
-        return NULL;
-    }
-    err = pthread_mutex_unlock(&conn->connectmx);
-    if (err) {
-        snprintf(status->errmsg, sizeof status->errmsg,
-            "pthread_mutex_unlock failed: %s", strerror(err));
-        return NULL;
-    }
-    /* Read until EOF */
-    clock_gettime(CLOCK_MONOTONIC, &conn->receive_start);
-    for (;;) {
-        /* Blocking read */
-        ssize_t rlen = recv(conn->fd_sock, conn->recvbuf, sizeof conn->recvbuf, MSG_WAITALL);
-        if (rlen == 0) {
-            /* Stream socket peer has performed an orderly shutdown */
-            clock_gettime(CLOCK_MONOTONIC, &conn->receive_end);
+    size_t pos = 0;
+    int result = RP_MORE;
+    while (pos < len && result == RP_MORE) {
+        switch (p->state) {
+        case RP_BODY:
+        case RP_CHUNK_DATA: {
+            size_t n = len - pos;
+            if (n > p->remaining)
+                n = (size_t)p->remaining;
+            if (p->hashing)
+                rp_digest(p, data + pos, n);
+            pos += n;
+            p->length += n;
+            p->body_len += n;
+            p->remaining -= n;
+            if (p->remaining == 0) {
+                if (p->state == RP_BODY)
+                    result = rp_complete(p);
+                else
+                    p->state = RP_CHUNK_END;
+            }
             break;
         }
-        if (rlen < 0) {
-            snprintf(status->errmsg, sizeof status->errmsg,
-                "recv failed: %s", strerror(errno));
-            return NULL;
+        case RP_BODY_EOF: {
+            size_t n = len - pos;
+            if (p->hashing)
+                rp_digest(p, data + pos, n);
+            pos += n;
+            p->length += n;
+            p->body_len += n;
+            break;
         }
-        conn->recv_total += rlen;
-        /* Write received responses to output file */
-        if (! conn->ignore_out) {
-            char* now = conn->recvbuf;
-            while (rlen > 0) {
-                ssize_t wlen = write(conn->fd_out, now, (size_t)rlen);
-                if (wlen < 0) {
-                    snprintf(status->errmsg, sizeof status->errmsg,
-                        "Cannot write to output file '%s': %s", conn->out_file, strerror(errno));
-                    return NULL;
-                }
-                rlen -= wlen;
-                now += wlen;
+        case RP_ERROR:
+            *used = pos;
+            return RP_FAIL;
+        default: {
+            /* Line-based states */
+            const char* nl = memchr(data + pos, '\n', len - pos);
+            size_t n = nl ? (size_t)(nl - (data + pos)) + 1 : len - pos;
+            if (p->line_len + n > sizeof p->line - 1) {
+                *used = pos;
+                return rp_fail(p, "Line too long");
             }
+            memcpy(p->line + p->line_len, data + pos, n);
+            p->line_len += n;
+            p->length += n;
+            pos += n;
+            if (nl != NULL) {
+                size_t linelen = p->line_len - 1;
+                if (linelen > 0 && p->line[linelen - 1] == '\r')
+                    --linelen;
+                p->line[linelen] = '\0';
+                p->line_len = 0;
+                result = rp_line(p, p->line, linelen);
+            }
+            break;
+        }
         }
     }
-    /* No problems occurred */
-    status->successful = 1;
-    return NULL;
+    *used = pos;
+    return result;
 }
 
-static void ms_destroy_conns(struct ms_conn* conn, int cancel_threads)
+/*
+** Signal end of stream. Returns RP_DONE if a response delimited by connection
+** close was completed, RP_MORE if the stream ended cleanly between responses,
+** or RP_FAIL if it ended within a response.
+*/
+static int rp_finish(struct rp_parser* p)
 {
-    while (conn != NULL) {
-        if (conn->fd_in >= 0)
-            close(conn->fd_in);
-        if (conn->fd_out >= 0)
-            close(conn->fd_out);
-        if (conn->fd_sock >= 0)
-            close(conn->fd_sock);
-        if (conn->sender.created && cancel_threads) {
-            // pthread_cancel(conn->sender.thread); /* Doesn't seem to work without special libc */
-        }
-        if (conn->receiver.created && cancel_threads)
-            // pthread_cancel(conn->receiver.thread);  /* Doesn't seem to work without special libc */
-        if (conn->connectmx_created)
-            pthread_mutex_destroy(&conn->connectmx);
-        struct ms_conn* prev = conn->prev;
-        free(conn);
-        conn = prev;
+    if (p->state == RP_ERROR)
+        return RP_FAIL;
+    if (p->state == RP_BODY_EOF)
+        return rp_complete(p);
+    if (p->state == RP_STATUS && p->line_len == 0)
+        return RP_MORE;
+    p->truncated = 1;
+    return rp_fail(p, "Stream ended within a response");
+}
+
+/*
+** Request templates. A template is compiled once into a list of operations, which
+** are expanded for every request directly into a connection's send buffer.
+** Placeholders:
+**   {{seq}}            Request number within the connection, starting at 1
+**   {{gseq}}           Request number across all connections, starting at 1
+**   {{conn}}           Connection ID, starting at 1
+**   {{rand:min:max}}   Random integer of [min..max]
+**   {{rstr:len}}       Random string of len characters [a-z0-9]
+**   {{pick:a|b|c}}     One of the given alternatives, chosen randomly
+** Random values come from a per-connection generator seeded with seed and the
+** connection ID, so runs with the same seed send identical requests.
+*/
+enum tpl_optype {
+    TPL_LITERAL,
+    TPL_SEQ,
+    TPL_GSEQ,
+    TPL_CONN,
+    TPL_RAND,
+    TPL_RSTR,
+    TPL_PICK
+};
+
+struct tpl_op {
+    enum tpl_optype type;
+    const char* str;                    /* Literal text, or alternatives separated by '\0' */
+    size_t len;                         /* Literal length, or number of alternatives */
+    uint64_t a, b;                      /* Range of TPL_RAND, length of TPL_RSTR */
+    const char** picks;                 /* Alternatives of TPL_PICK */
+    size_t* pick_lens;
+};
+
+struct tpl {
+    struct tpl_op* ops;
+    size_t nops;
+    size_t max_len;                     /* Upper bound for the length of one expansion */
+    char* text;                         /* Copy of template source, referenced by ops */
+};
+
+/* Variables of one connection */
+struct tpl_vars {
+    uint64_t rng;                       /* splitmix64 state */
+    uint64_t seq;
+    uint64_t gseq;
+    uint32_t conn;
+};
+
+static uint64_t tpl_random(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void tpl_vars_init(struct tpl_vars* v, uint64_t seed, uint32_t conn, uint64_t gseq_base)
+{
+    v->rng = seed ^ ((uint64_t)conn * 0xd1b54a32d192ed03ULL);
+    v->seq = 0;
+    v->gseq = gseq_base;
+    v->conn = conn;
+    tpl_random(&v->rng);
+}
+
+static void tpl_free(struct tpl* t)
+{
+    if (t == NULL)
+        return;
+    for (size_t i = 0; i < t->nops; ++i) {
+        free(t->ops[i].picks);
+        free(t->ops[i].pick_lens);
+    }
+    free(t->ops);
+    free(t->text);
+    free(t);
+}
+
+static int tpl_parse_u64(const char* s, const char* end, uint64_t* out)
+{
+    if (s == end)
+        return -1;
+    uint64_t n = 0;
+    for (; s < end; ++s) {
+        if (*s < '0' || *s > '9' || n > (UINT64_MAX - 9) / 10)
+            return -1;
+        n = n * 10 + (uint64_t)(*s - '0');
     }
+    *out = n;
+    return 0;
 }
 
 /*
-** Try to create all required file descriptors, sockets, and threads.
-** Returns pointer to linked list of structs on success. On error,
-** NULL is returned and an error message is printed into msgbuf.
+** Compile template source. Returns the template on success. Otherwise, prints
+** message into msgbuf and returns NULL.
 */
-static struct ms_conn* ms_create_conns(char* msgbuf, size_t msglen, const char* in_file, const char* out_file_fmt,
-                                const char* host, const char* port, size_t num_conns, pthread_barrier_t* barrier,
-                                int use_shutdown, int ignore_out)
+static struct tpl* tpl_compile(const char* src, size_t srclen, char* msgbuf, size_t msglen)
 {
-    struct ms_conn* last = NULL;
-    size_t in_len = 0;
-    for (size_t i = 0; i < num_conns; ++i) {
-        /* Setup shared data structure and add to linked list */
-        struct ms_conn* conn = malloc(sizeof (struct ms_conn));
-        conn->fd_in = conn->fd_out = conn->fd_sock = -1;
-        conn->host = host;
-        conn->port = port;
-        conn->use_shutdown = use_shutdown;
-        conn->ignore_out = ignore_out;
-        conn->barrier = barrier;
-        conn->in_len = in_len;
-        conn->sender.created = 0;
-        conn->receiver.created = 0;
-        conn->connectmx_created = 0;
-        conn->prev = last;
-        last = conn;
-        /* Open input file with requests to send */
-        snprintf(conn->in_file, sizeof conn->in_file, in_file);
-        if ((conn->fd_in = open(in_file, O_RDONLY)) < 0) {
-            snprintf(msgbuf, msglen, "Cannot open input file '%s': %s", in_file, strerror(errno));
-            goto failed;
+    struct tpl* t = calloc(1, sizeof *t);
+    if (t == NULL || (t->text = malloc(srclen + 1)) == NULL
+            || (t->ops = calloc(srclen + 1, sizeof *t->ops)) == NULL) {
+        snprintf(msgbuf, msglen, "Out of memory");
+        tpl_free(t);
+        return NULL;
+    }
+    memcpy(t->text, src, srclen);
+    t->text[srclen] = '\0';
+    char* s = t->text;
+    char* end = t->text + srclen;
+    while (s < end) {
+        struct tpl_op* op = &t->ops[t->nops];
+        char* open = strstr(s, "{{");
+        if (open == NULL || open > s) {
+            /* Literal text up to next placeholder */
+            op->type = TPL_LITERAL;
+            op->str = s;
+            op->len = open ? (size_t)(open - s) : (size_t)(end - s);
+            t->max_len += op->len;
+            s += op->len;
+            ++t->nops;
+            continue;
         }
-        if (i == 0) {
-            /* Stat first file descriptor */
-            struct stat st;
-            if (fstat(conn->fd_in, &st) < 0) {
-                snprintf(msgbuf, msglen, "Cannot stat input file '%s': %s", in_file, strerror(errno));
-                goto failed;
-            }
-            in_len = st.st_size;
-            conn->in_len = in_len;
+        char* name = open + 2;
+        char* close = strstr(name, "}}");
+        if (close == NULL) {
+            snprintf(msgbuf, msglen, "Template error: Missing '}}' after offset %zu", (size_t)(open - t->text));
+            tpl_free(t);
+            return NULL;
         }
-        /* Open output file to record responses */
-        if (! ignore_out) {
-            snprintf(conn->out_file, sizeof conn->out_file, out_file_fmt, (int)(i + 1));
-            if ((conn->fd_out = open(conn->out_file, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
-                snprintf(msgbuf, msglen, "Cannot open output file '%s': %s",
-                    conn->out_file, strerror(errno));
-                goto failed;
+        *close = '\0';
+        char* arg = strchr(name, ':');
+        if (arg != NULL)
+            *arg++ = '\0';
+        if (strcmp(name, "seq") == 0 || strcmp(name, "gseq") == 0 || strcmp(name, "conn") == 0) {
+            op->type = name[0] == 's' ? TPL_SEQ : (name[0] == 'g' ? TPL_GSEQ : TPL_CONN);
+            t->max_len += 20;
+        } else if (strcmp(name, "rand") == 0) {
+            char* sep = arg ? strchr(arg, ':') : NULL;
+            op->type = TPL_RAND;
+            if (sep == NULL || tpl_parse_u64(arg, sep, &op->a) < 0
+                    || tpl_parse_u64(sep + 1, close, &op->b) < 0 || op->a > op->b) {
+                snprintf(msgbuf, msglen, "Template error: Expected {{rand:min:max}} with 0 <= min <= max");
+                tpl_free(t);
+                return NULL;
             }
+            t->max_len += 20;
+        } else if (strcmp(name, "rstr") == 0) {
+            op->type = TPL_RSTR;
+            if (arg == NULL || tpl_parse_u64(arg, close, &op->a) < 0 || op->a == 0 || op->a > 4096) {
+                snprintf(msgbuf, msglen, "Template error: Expected {{rstr:len}} with 0 < len <= 4096");
+                tpl_free(t);
+                return NULL;
+            }
+            t->max_len += op->a;
+        } else if (strcmp(name, "pick") == 0 && arg != NULL) {
+            op->type = TPL_PICK;
+            op->len = 1;
+            for (char* c = arg; *c; ++c)
+                op->len += *c == '|';
+            op->picks = calloc(op->len, sizeof *op->picks);
+            op->pick_lens = calloc(op->len, sizeof *op->pick_lens);
+            if (op->picks == NULL || op->pick_lens == NULL) {
+                ++t->nops;
+                snprintf(msgbuf, msglen, "Out of memory");
+                tpl_free(t);
+                return NULL;
+            }
+            size_t maxpick = 0;
+            for (size_t i = 0; i < op->len; ++i) {
+                char* bar = strchr(arg, '|');
+                if (bar != NULL)
+                    *bar = '\0';
+                op->picks[i] = arg;
+                op->pick_lens[i] = strlen(arg);
+                if (op->pick_lens[i] > maxpick)
+                    maxpick = op->pick_lens[i];
+                arg = bar + 1;
+            }
+            t->max_len += maxpick;
+        } else {
+            snprintf(msgbuf, msglen, "Template error: Unknown placeholder '{{%s}}'", name);
+            tpl_free(t);
+            return NULL;
         }
-        /* Create mutex for blocking receiver thread */
-        int err = pthread_mutex_init(&conn->connectmx, NULL);
-        if (err) {
+        ++t->nops;
+        s = close + 2;
+    }
+    return t;
+}
+
+static char* tpl_put_u64(char* out, uint64_t n)
+{
+    char digits[20];
+    size_t len = 0;
+    do {
+        digits[len++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+    while (len > 0)
+        *out++ = digits[--len];
+    return out;
+}
+
+/*
+** Expand template for the next request of a connection into out, which must
+** have room for at least t->max_len bytes. Returns the number of bytes written.
+*/
+static size_t tpl_expand(const struct tpl* t, struct tpl_vars* v, char* out)
+{
+    static const char charset[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    char* start = out;
+    ++v->seq;
+    ++v->gseq;
+    for (size_t i = 0; i < t->nops; ++i) {
+        const struct tpl_op* op = &t->ops[i];
+        switch (op->type) {
+        case TPL_LITERAL:
+            memcpy(out, op->str, op->len);
+            out += op->len;
+            break;
+        case TPL_SEQ:
+            out = tpl_put_u64(out, v->seq);
+            break;
+        case TPL_GSEQ:
+            out = tpl_put_u64(out, v->gseq);
+            break;
+        case TPL_CONN:
+            out = tpl_put_u64(out, v->conn);
+            break;
+        case TPL_RAND: {
+            uint64_t range = op->b - op->a + 1;
+            uint64_t r = tpl_random(&v->rng);
+            out = tpl_put_u64(out, op->a + (range ? r % range : r));
+            break;
+        }
+        case TPL_RSTR:
+            for (uint64_t k = 0; k < op->a; ++k)
+                *out++ = charset[tpl_random(&v->rng) % (sizeof charset - 1)];
+            break;
+        case TPL_PICK: {
+            size_t k = tpl_random(&v->rng) % op->len;
+            memcpy(out, op->picks[k], op->pick_lens[k]);
+            out += op->pick_lens[k];
+            break;
+        }
+        }
+    }
+    return (size_t)(out - start);
+}
+
+/*
+** Weighted mix of request templates. For every request, one template is picked
+** using a random generator that serves only this purpose, so that the receiver
+** can replay the same sequence of picks to attribute responses to templates.
+** A single template is a mix with one entry, which needs no random numbers.
+*/
+struct tpl_mix {
+    struct tpl** tpls;
+    uint64_t* cum_weights;              /* Cumulative weights of tpls */
+    char* head;                         /* Template is a HEAD request, so responses have no body */
+    char* upload;                       /* Template is a POST, PUT or PATCH request, which gets a body */
+    size_t n;
+    size_t max_len;                     /* Largest max_len of all templates */
+};
+
+static void tpl_mix_free(struct tpl_mix* m)
+{
+    if (m == NULL)
+        return;
+    for (size_t i = 0; i < m->n; ++i)
+        tpl_free(m->tpls[i]);
+    free(m->tpls);
+    free(m->cum_weights);
+    free(m->head);
+    free(m->upload);
+    free(m);
+}
+
+static struct tpl_mix* tpl_mix_new(size_t n)
+{
+    struct tpl_mix* m = calloc(1, sizeof *m);
+    if (m == NULL)
+        return NULL;
+    m->tpls = calloc(n, sizeof *m->tpls);
+    m->cum_weights = calloc(n, sizeof *m->cum_weights);
+    m->head = calloc(n, 1);
+    m->upload = calloc(n, 1);
+    if (m->tpls == NULL || m->cum_weights == NULL || m->head == NULL || m->upload == NULL) {
+        tpl_mix_free(m);
+        return NULL;
+    }
+    return m;
+}
+
+/* Compile template and append it with the given weight. Returns 0 or -1 with message in msgbuf. */
+static int tpl_mix_add(struct tpl_mix* m, uint64_t weight, const char* src, size_t srclen, char* msgbuf, size_t msglen)
+{
+    struct tpl* t = tpl_compile(src, srclen, msgbuf, msglen);
+    if (t == NULL)
+        return -1;
+    m->tpls[m->n] = t;
+    m->cum_weights[m->n] = (m->n ? m->cum_weights[m->n - 1] : 0) + weight;
+    m->head[m->n] = srclen >= 5 && memcmp(src, "HEAD ", 5) == 0;
+    m->upload[m->n] = (srclen >= 5 && memcmp(src, "POST ", 5) == 0) || (srclen >= 4 && memcmp(src, "PUT ", 4) == 0)
+        || (srclen >= 6 && memcmp(src, "PATCH ", 6) == 0);
+    if (t->max_len > m->max_len)
+        m->max_len = t->max_len;
+    ++m->n;
+    return 0;
+}
+
+static size_t tpl_mix_pick(const struct tpl_mix* m, uint64_t* rng)
+{
+    if (m->n == 1)
+        return 0;
+    uint64_t r = tpl_random(rng) % m->cum_weights[m->n - 1];
+    size_t lo = 0, hi = m->n - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (r < m->cum_weights[mid])
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/*
+** Shared response log. Instead of one output file per connection, all receiver
+** threads can append their data to a single file through one writer. Every chunk
+** of received data is preceded by a small frame header (native byte order), so
+** the log can later be split into per-connection streams again.
+*/
+#define MS_LOG_MAGIC "SBLOG01\n"
+
+struct ms_log_frame {
+    uint32_t conn_id;                   /* Connection number, starting at 1 */
+    uint32_t len;                       /* Number of data bytes following the header */
+    uint64_t time_ns;                   /* CLOCK_MONOTONIC timestamp after recv() returned */
+};
+
+struct ms_writer {
+    int fd;                             /* Log file, opened in append mode */
+    pthread_mutex_t mx;                 /* Serializes frames of different threads and processes */
+    char path[4096];                    /* Path of fd */
+};
+
+/*
+** Create log file and write the file header. With pshared, the writer must be
+** placed in shared memory and can be used by several processes.
+** Returns 0 on success, otherwise prints message into msgbuf and returns -1.
+*/
+static int ms_writer_open(struct ms_writer* w, const char* path, int pshared, char* msgbuf, size_t msglen)
+{
+    snprintf(w->path, sizeof w->path, "%s", path);
+    if ((w->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0666)) < 0) {
+        snprintf(msgbuf, msglen, "Cannot open log file '%s': %s", path, strerror(errno));
+        return -1;
+    }
+    if (write(w->fd, MS_LOG_MAGIC, sizeof MS_LOG_MAGIC - 1) != sizeof MS_LOG_MAGIC - 1) {
+        snprintf(msgbuf, msglen, "Cannot write to log file '%s': %s", path, strerror(errno));
+        close(w->fd);
+        return -1;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    if (pshared)
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    int err = pthread_mutex_init(&w->mx, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (err) {
+        snprintf(msgbuf, msglen, "pthread_mutex_init failed: %s", strerror(err));
+        close(w->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void ms_writer_close(struct ms_writer* w)
+{
+    pthread_mutex_destroy(&w->mx);
+    close(w->fd);
+}
+
+/*
+** Append one frame with the given data. Frames are written under the writer
+** lock, so that frames of different connections never interleave.
+** Returns 0 on success or an errno value.
+*/
+static int ms_writer_put(struct ms_writer* w, uint32_t conn_id, const struct timespec* ts,
+                         const char* data, size_t len)
+{
+    struct ms_log_frame frame;
+    frame.conn_id = conn_id;
+    frame.len = (uint32_t)len;
+    frame.time_ns = (uint64_t)ts->tv_sec * 1000000000u + (uint64_t)ts->tv_nsec;
+    struct iovec iov[2] = {
+        { .iov_base = &frame,       .iov_len = sizeof frame },
+        { .iov_base = (void*)data,  .iov_len = len },
+    };
+    struct iovec* now = iov;
+    int iovcnt = 2;
+    int result = 0;
+    pthread_mutex_lock(&w->mx);
+    while (iovcnt > 0) {
+        ssize_t wlen = writev(w->fd, now, iovcnt);
+        if (wlen < 0) {
+            if (errno == EINTR)
+                continue;
+            result = errno;
+            break;
+        }
+        /* Skip over completely written buffers, adjust partially written one */
+        while (iovcnt > 0 && (size_t)wlen >= now->iov_len) {
+            wlen -= now->iov_len;
+            ++now;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            now->iov_base = (char*)now->iov_base + wlen;
+            now->iov_len -= wlen;
+        }
+    }
+    pthread_mutex_unlock(&w->mx);
+    return result;
+}
+
+/*
+** Deduplicating response store. Responses are identified by their parser hash
+** (which ignores volatile headers), and only the first occurrence of each one is
+** written into the store directory as <hash>.http. Every connection records its
+** responses as runs of (hash, count), which are written into index.txt.
+** Responses with the same hash, but a different check hash get the next free hash,
+** so that a collision of the 64-bit hash does not merge distinct responses.
+** The receiver buffers each whole response until it is complete, so every
+** connection holds a buffer as large as its largest response.
+*/
+struct ms_run {
+    uint64_t hash;
+    uint64_t count;
+};
+
+/* Entry of the set of known responses */
+struct ms_store_entry {
+    uint64_t hash;                      /* 0 marks empty slots */
+    uint64_t check;
+};
+
+struct ms_store {
+    pthread_mutex_t mx;                 /* Protects hashes/cap/count */
+    struct ms_store_entry* hashes;      /* Open addressing hash set */
+    size_t cap;
+    size_t count;                       /* Number of unique responses */
+    char dir[4096];
+};
+
+static int ms_store_open(struct ms_store* st, const char* dir, char* msgbuf, size_t msglen)
+{
+    snprintf(st->dir, sizeof st->dir, "%s", dir);
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+        snprintf(msgbuf, msglen, "Cannot create store directory '%s': %s", dir, strerror(errno));
+        return -1;
+    }
+    st->cap = 1024;
+    st->count = 0;
+    if ((st->hashes = calloc(st->cap, sizeof *st->hashes)) == NULL) {
+        snprintf(msgbuf, msglen, "Out of memory");
+        return -1;
+    }
+    int err = pthread_mutex_init(&st->mx, NULL);
+    if (err) {
+        snprintf(msgbuf, msglen, "pthread_mutex_init failed: %s", strerror(err));
+        free(st->hashes);
+        return -1;
+    }
+    return 0;
+}
+
+static void ms_store_close(struct ms_store* st)
+{
+    pthread_mutex_destroy(&st->mx);
+    free(st->hashes);
+}
+
+/*
+** Insert response into set. On a collision with a different response, *hash is changed
+** to the next free one. Returns 1 if it was new, 0 if known, -1 if out of memory.
+*/
+static int ms_store_insert(struct ms_store* st, uint64_t* hash, uint64_t check)
+{
+    if ((st->count + 1) * 2 > st->cap) {
+        size_t ncap = st->cap * 2;
+        struct ms_store_entry* nh = calloc(ncap, sizeof *nh);
+        if (nh == NULL)
+            return -1;
+        for (size_t i = 0; i < st->cap; ++i) {
+            if (st->hashes[i].hash == 0)
+                continue;
+            size_t j = st->hashes[i].hash & (ncap - 1);
+            while (nh[j].hash != 0)
+                j = (j + 1) & (ncap - 1);
+            nh[j] = st->hashes[i];
+        }
+        free(st->hashes);
+        st->hashes = nh;
+        st->cap = ncap;
+    }
+    size_t i = *hash & (st->cap - 1);
+    while (st->hashes[i].hash != 0) {
+        if (st->hashes[i].hash == *hash) {
+            if (st->hashes[i].check == check)
+                return 0;
+            /* Collision: try the next hash, keeping 0 for empty slots */
+            if ((*hash += 2) == 0)
+                *hash = 2;
+            i = *hash & (st->cap - 1);
+            continue;
+        }
+        i = (i + 1) & (st->cap - 1);
+    }
+    st->hashes[i].hash = *hash;
+    st->hashes[i].check = check;
+    ++st->count;
+    return 1;
+}
+
+/*
+** Store response data under the given hash unless it is already known. The hash is
+** updated if it collides with a different response, see ms_store_insert.
+** Returns 0 on success, otherwise prints message into msgbuf and returns -1.
+*/
+static int ms_store_put(struct ms_store* st, uint64_t* phash, uint64_t check, const char* data, size_t len,
+                        char* msgbuf, size_t msglen)
+{
+    pthread_mutex_lock(&st->mx);
+    int isnew = ms_store_insert(st, phash, check);
+    pthread_mutex_unlock(&st->mx);
+    if (isnew < 0) {
+        snprintf(msgbuf, msglen, "Out of memory");
+        return -1;
+    }
+    if (isnew == 0)
+        return 0;
+    /* First occurrence: write object file outside of the lock */
+    uint64_t hash = *phash;
+    char path[4200];
+    snprintf(path, sizeof path, "%s/%016llx.http", st->dir, (unsigned long long)hash);
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0) {
+        snprintf(msgbuf, msglen, "Cannot open store file '%s': %s", path, strerror(errno));
+        return -1;
+    }
+    while (len > 0) {
+        ssize_t wlen = write(fd, data, len);
+        if (wlen < 0) {
+            snprintf(msgbuf, msglen, "Cannot write to store file '%s': %s", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        len -= wlen;
+        data += wlen;
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+** Multi-sendfile worker threads, shared data and helper functions
+*/
+struct ms_thread {
+    pthread_t thread;
+    int created;            /* Indicates that the thread should be joined/canceled for cleanup */
+    int successful;         /* 1 if no errors occurred, 0 otherwise. The error will be printed into errmsg. */
+    char errmsg[8192];
+    uint64_t cpu_ns;        /* CPU time of the thread, recorded when it exits */
+    long vcsw, ivcsw;       /* Voluntary and involuntary context switches of the thread */
+};
+
+/* Statistics of one entry of a request mix */
+struct ms_endpoint {
+    size_t requests;                    /* Requests sent, counted by sender */
+    size_t responses;                   /* Responses received, counted by receiver */
+    uint64_t bytes;                     /* Bytes of these responses */
+    size_t status_classes[5];           /* Responses by status class 1xx..5xx */
+};
+
+/* Request body, sent with sendfile() after each generated POST/PUT/PATCH request head */
+struct ms_body {
+    int fd;
+    size_t len;
+    const char* path;
+};
+
+/* Room for Content-Length/Transfer-Encoding and Connection headers after a template */
+#define MS_HEAD_EXTRA 128
+
+/* Requests sent more than this behind their replay schedule are counted as late */
+#define MS_REPLAY_LATE_NS 1000000
+
+/* Longest sleep until a replayed request is due, so that an interrupt is noticed */
+#define MS_REPLAY_SLICE_NS 100000000
+
+/*
+** Shared replay of a recorded request log. All requests are stored in the input
+** file; every connection sends slices of it at the times given by its schedule.
+** A schedule is a packed sequence of native uint64_t quadruples: send time in ns
+** relative to start, offset and length of the request within the input file, and
+** flags (MS_REPLAY_HEAD if the response has no body).
+*/
+#define MS_REPLAY_HEAD  1
+#define MS_REPLAY_ENTRY (4 * sizeof (uint64_t))
+
+struct ms_replay {
+    const struct timespec* start;       /* Time zero of all schedules, set right before threads start */
+    const char** schedules;             /* Schedule per connection */
+    size_t* counts;                     /* Number of requests per schedule */
+};
+
+/* Results of one connection, copied into the shared region after its threads are joined */
+#define MS_RESULT_NONE  0               /* No result, e.g. because the worker process died */
+#define MS_RESULT_OK    1
+#define MS_RESULT_ERROR 2
+
+/*
+** struct tcp_info of glibc ends with tcpi_total_retrans. These are the fields added by
+** later kernels up to Linux 5.4; getsockopt() reports, how many of them are filled.
+*/
+struct ms_tcp_info {
+    struct tcp_info base;
+    uint64_t pacing_rate, max_pacing_rate;
+    uint64_t bytes_acked, bytes_received;
+    uint32_t segs_out, segs_in;
+    uint32_t notsent_bytes, min_rtt;
+    uint32_t data_segs_in, data_segs_out;
+    uint64_t delivery_rate;
+    uint64_t busy_time, rwnd_limited, sndbuf_limited;
+    uint32_t delivered, delivered_ce;
+    uint64_t bytes_sent, bytes_retrans;
+    uint32_t dsack_dups, reord_seen;
+    uint32_t rcv_ooopack;
+    uint32_t snd_wnd;
+};
+
+/* Indicates that a sample of info_len bytes contains field of struct ms_tcp_info */
+#define MS_TCP_HAS(len, field) ((len) >= offsetof(struct ms_tcp_info, field) + sizeof ((struct ms_tcp_info*)0)->field)
+
+/* TCP_INFO of a client socket, sampled periodically and once more when its receiver ends */
+struct ms_tcp_stats {
+    uint32_t samples;                   /* Number of samples including the last one */
+    uint64_t rtt_sum_us;                /* Sum of the smoothed RTT of all samples */
+    uint32_t rtt_max_us, cwnd_max;
+    uint32_t info_len;                  /* Bytes of struct ms_tcp_info in the last sample, or 0 */
+    struct ms_tcp_info last;            /* Last sample, when the receiver ended */
+};
+
+/* Number of time slots of the socket queue samples of every connection */
+#define MS_QUEUE_SLOTS 256
+
+/* Queue depths of a connection socket, the largest sampled within a time slot */
+struct ms_queue_sample {
+    uint32_t unsent;                    /* Request bytes not sent yet (SIOCOUTQNSD) */
+    uint32_t unacked;                   /* Request bytes sent, but not acknowledged by the server */
+    uint32_t inq;                       /* Response bytes not read yet by the receiver (SIOCINQ) */
+};
+
+/* Number of time buckets of the throughput counters of every connection */
+#define MS_BUCKET_SLOTS 1024
+
+/* Bytes and complete responses of a connection within a time bucket */
+struct ms_bucket {
+    uint64_t bytes;
+    uint64_t responses;
+};
+
+/*
+** Throughput counters of one thread of a connection by time bucket, see ms_bucket_add.
+** Each thread only writes its own, so no atomics are needed.
+*/
+struct ms_buckets {
+    struct ms_bucket* slots;            /* In shared region, or NULL */
+    uint64_t step_ns;                   /* Length of a bucket, doubled whenever slots is full */
+    uint64_t first;                     /* Bucket of slots[0], counted from the start */
+    uint32_t n;                         /* Number of buckets used, the rest is zero */
+};
+
+/* Number of gaps between responses kept for every connection, the longest ones */
+#define MS_GAP_SLOTS 256
+
+/* Time without complete responses on a connection, in ns since the start */
+struct ms_gap {
+    uint64_t start_ns, end_ns;
+};
+
+/*
+** Progress of a connection for the live reporter, see ms_reporter_tick. The threads of
+** the connection update it with relaxed atomic stores, so reading it needs no lock.
+*/
+struct ms_live {
+    uint64_t sent, received, responses;
+    int connected;                      /* Set by the sender after connect() */
+    int done;                           /* Set when the receiver ends */
+    int failed;                         /* Set when either thread fails */
+};
+
+/* Kernel transmit timestamps of request data, see ms_tx_drain */
+struct ms_tx_times {
+    uint32_t sent_key, acked_key;       /* Offset of the last byte of the latest timestamped send() */
+    struct timespec sent, acked;        /* Passed to the device and acknowledged (CLOCK_REALTIME), or zero */
+};
+
+struct ms_result {
+    int state;                          /* MS_RESULT_* */
+    char errmsg[256];                   /* Start of error message of sender or receiver thread */
+    uint32_t target;                    /* Target number, starting at 1 */
+    size_t in_idx;                      /* Index of input file within target */
+    size_t send_total, recv_total;
+    struct timespec connect_start, connect_end, send_start, send_end, receive_start, receive_end;
+    struct timespec first_byte, first_response, last_byte;
+    size_t responses;
+    char parse_error[128];              /* Framing error, or empty */
+    size_t nruns;
+    struct ms_endpoint* endpoints;      /* Statistics per mix entry, also in shared region, or NULL */
+    uint64_t lag_max, lag_total;
+    size_t late;
+    size_t body_count;
+    uint64_t body_sent, body_framing, body_ns;
+    uint64_t sender_cpu_ns, receiver_cpu_ns;
+    long vcsw, ivcsw;                   /* Context switches of both threads */
+    uint16_t local_port;
+    struct ms_tcp_stats tcp;
+    struct ms_queue_sample* queues;     /* Queue depths by time slot, also in shared region, or NULL */
+    uint64_t queue_step_ns;             /* Length of a time slot, doubled whenever queues is full */
+    uint64_t queue_first;               /* Time slot of queues[0], counted from the start */
+    uint32_t nqueues;
+    struct timespec rx_first, rx_last;  /* Kernel timestamps of the first and last data received, or zero */
+    struct timespec rx_last_return;     /* Return of the recvmsg() which received rx_last */
+    struct timespec rx_first_response;
+    struct timespec tx_sent, tx_acked;  /* Kernel timestamps of the last request byte, or zero */
+    struct ms_buckets sent, received;   /* Throughput counters of sender and receiver */
+    struct ms_live live;                /* Progress during the run */
+    struct ms_gap* gaps;                /* Longest gaps between responses, in shared region, or NULL */
+    uint32_t ngaps;
+    uint64_t gaps_total;                /* Number of gaps, including those not kept */
+};
+
+/*
+** Memory shared by lcf_multi_sendfile with its worker processes, mapped before they
+** are forked. It is followed by the endpoint statistics of the connections.
+*/
+struct ms_shared {
+    pthread_barrier_t barrier;          /* Blocks all threads of all processes until all are ready */
+    struct timespec start;              /* Time zero of replay schedules */
+    sem_t ready;                        /* Posted by every worker process after its setup */
+    int failed;                         /* Set by the first worker process whose setup failed */
+    volatile int abort;                 /* Set before releasing the barrier to make threads exit at once */
+    volatile int interrupted;           /* Set by ms_interrupt on SIGINT during the run */
+    uint64_t conn_interval_ns;          /* Sample all connections at this interval, or 0 */
+    int tcp_info;                       /* Sample TCP_INFO */
+    uint32_t queue_cap;                 /* Sample socket queues into this many time slots, or 0 */
+    int timestamps;                     /* Use kernel timestamps of SO_TIMESTAMPING */
+    int64_t realtime_offset_ns;         /* CLOCK_REALTIME minus CLOCK_MONOTONIC, for kernel timestamps */
+    uint64_t bucket_ns;                 /* Count throughput in time buckets of this length, or 0 */
+    size_t send_chunk;                  /* Limit sendfile() calls to this, to count bytes while sending, or 0 */
+    uint64_t gap_ns;                    /* Record gaps between responses of at least this length, or 0 */
+    uint64_t workers_cpu_ns;            /* CPU time of all worker processes after their setup */
+    long workers_vcsw, workers_ivcsw;   /* Their context switches after setup */
+    long workers_maxrss_kb;             /* Largest peak resident set size of them */
+    char errmsg[8192];                  /* Error message of that worker process */
+    struct ms_writer writer;            /* Shared response log */
+    struct ms_result results[];         /* Per connection, indexed by ID - 1 */
+};
+
+struct ms_conn {
+    uint32_t id;                        /* Connection number, starting at 1 */
+    struct ms_result* result;           /* Results in shared region */
+    int fd_in;                          /* Request file to send */
+    int fd_out;                         /* Response log */
+    int fd_sock;                        /* TCP socket for HTTP connection, created by sender, atomic */
+    const char* host;                   /* Host name */
+    const char* port;                   /* Host port */
+    uint16_t local_port;                /* Local port of fd_sock, set after connect() */
+    int use_shutdown;                   /* shutdown(SHUT_WR) after send is complete */
+    int ignore_out;                     /* Do not use fd_out */
+    struct ms_writer* writer;           /* Shared response log used instead of fd_out, or NULL */
+    struct ms_store* store;             /* Deduplicating response store used instead of fd_out, or NULL */
+    size_t in_len;                      /* Length of data to send */
+    size_t send_total;                  /* Number of bytes sent */
+    const struct tpl_mix* mix;          /* Generate requests from templates instead of sending fd_in, or NULL */
+    struct tpl_vars vars;               /* Template variables of this connection */
+    uint64_t send_pick_rng;             /* Template choice of sender */
+    uint64_t recv_pick_rng;             /* Template choice replayed by receiver */
+    size_t recv_pick;                   /* Template of the request the next response answers */
+    struct ms_endpoint* endpoints;      /* Statistics per template, only if mix has several entries */
+    size_t nreq;                        /* Number of requests to generate from mix */
+    char* sendbuf;                      /* Buffer for generated requests */
+    size_t sendbuf_len;
+    const struct ms_body* bodies;       /* Bodies for upload requests of mix, used round-robin, or NULL */
+    size_t nbodies;
+    size_t body_next;                   /* Index of next body to send */
+    size_t chunk_size;                  /* Send bodies with chunked encoding in chunks of this size, or 0 */
+    size_t body_count;                  /* Number of bodies sent */
+    uint64_t body_sent;                 /* Body payload bytes sent */
+    uint64_t body_framing;              /* Chunk size lines and line breaks sent around them */
+    uint64_t body_ns;                   /* Time spent sending bodies */
+    const struct ms_replay* replay;     /* Send in_file slices by schedule instead of whole file, or NULL */
+    const char* schedule;               /* Replay schedule of this connection */
+    size_t nsched;                      /* Number of requests in schedule */
+    size_t recv_sched;                  /* Schedule entry of the request the next response answers */
+    uint64_t lag_max, lag_total;        /* Largest and summed delay behind replay schedule in ns */
+    size_t late;                        /* Requests sent later than MS_REPLAY_LATE_NS */
+    char in_file[4096];                 /* Path of fd_in */
+    char out_file[4096];                /* Path of fd_out */
+    struct ms_shared* shared;           /* Barrier to block all threads until all are ready, and abort flag */
+    pthread_mutex_t connectmx;          /* Mutex to block receiver until fd_sock is connected */
+    int connectmx_created;              /* Indicates that connectmx should be destroyed for cleanup */
+    struct ms_thread sender;            /* Sender status */
+    struct ms_thread receiver;          /* Receiver status */
+    char recvbuf[32 * 1024];            /* Receive buffer; threads have only minimal stack space */
+    size_t recv_total;
+    struct rp_parser parser;            /* Splits received data into responses */
+    size_t responses;                   /* Number of complete responses received */
+    char* resp_buf;                     /* Raw data of current response, only used with store */
+    size_t resp_len, resp_cap;
+    struct ms_run* runs;                /* Received responses as runs of identical ones, only used with store */
+    size_t nruns, runs_cap;
+    struct timespec connect_start;      /* Before connect() */
+    struct timespec connect_end;        /* After connect() */
+    struct timespec send_start;         /* Before first sendfile() */
+    struct timespec send_end;           /* After last sendfile() */
+    struct timespec receive_start;      /* Before first recv() */
+    struct timespec receive_end;        /* After last recv() */
+    struct timespec first_byte;         /* After the recv() which returned the first data */
+    struct timespec first_response;     /* After the recv() which completed the first response */
+    struct timespec last_byte;          /* After the recv() which returned the last data */
+    struct timespec last_response;      /* After the latest recv() which completed a response */
+    struct timespec rx_first_response;  /* Kernel timestamp of the data which completed the first response */
+    struct ms_tcp_stats tcp;            /* Sampled by the thread of ms_conn_tick and finally by the receiver */
+    int recv_done;                      /* Set by the receiver when it ends, to stop sampling, atomic */
+    volatile int interrupted;           /* Set by ms_interrupt if the receiver had not ended yet */
+    struct timespec rx_first, rx_last;  /* Kernel timestamps of the first and last data received */
+    struct timespec rx_last_return;     /* When the recvmsg() with rx_last returned */
+    struct ms_tx_times sender_tx;       /* Transmit timestamps collected by the sender */
+    struct ms_tx_times receiver_tx;     /* ... and by the receiver */
+    struct ms_conn* prev;               /* Chain connection structures into simple linked list */
+    int placed;                         /* Memory is on pages of its own, see ms_conn_alloc */
+};
+
+/*
+** Collect the pending transmit timestamps of a socket with SO_TIMESTAMPING from its error
+** queue. With SOF_TIMESTAMPING_OPT_ID, each send() is identified by the offset of its last
+** byte since timestamping was enabled, so the latest one is that of the last request byte
+** sent so far. Both threads of a connection drain the queue, so that it does not overflow.
+*/
+static void ms_tx_drain(int fd, struct ms_tx_times* t)
+{
+    for (;;) {
+        union {
+            char buf[CMSG_SPACE(sizeof (struct scm_timestamping))
+                     + CMSG_SPACE(sizeof (struct sock_extended_err) + sizeof (struct sockaddr_in6))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof control.buf;
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return;
+        struct scm_timestamping ts;
+        struct sock_extended_err ee;
+        int have_ts = 0, have_ee = 0;
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+                memcpy(&ts, CMSG_DATA(c), sizeof ts);
+                have_ts = 1;
+            } else if ((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR)
+                       || (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR)) {
+                memcpy(&ee, CMSG_DATA(c), sizeof ee);
+                have_ee = 1;
+            }
+        }
+        if (! have_ts || ! have_ee || ee.ee_errno != ENOMSG || ee.ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+            continue;
+        if (ee.ee_info == SCM_TSTAMP_SND && (t->sent.tv_sec == 0 || ee.ee_data >= t->sent_key)) {
+            t->sent_key = ee.ee_data;
+            t->sent = ts.ts[0];
+        } else if (ee.ee_info == SCM_TSTAMP_ACK && (t->acked.tv_sec == 0 || ee.ee_data >= t->acked_key)) {
+            t->acked_key = ee.ee_data;
+            t->acked = ts.ts[0];
+        }
+    }
+}
+
+/*
+** Add bytes and responses to the bucket of the current time in b. When all MS_BUCKET_SLOTS
+** are used, pairs of buckets are summed and the bucket length doubles, so the counters
+** always cover the whole connection.
+*/
+static void ms_bucket_add(struct ms_buckets* b, const struct ms_shared* shared, uint64_t bytes, uint64_t responses)
+{
+    struct ms_bucket* s = b->slots;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsed = (int64_t)(now.tv_sec - shared->start.tv_sec) * 1000000000 + (now.tv_nsec - shared->start.tv_nsec);
+    if (b->step_ns == 0)
+        b->step_ns = shared->bucket_ns;
+    uint64_t slot = (elapsed > 0 ? (uint64_t)elapsed : 0) / b->step_ns;
+    if (b->n == 0)
+        b->first = slot;
+    while (slot - b->first >= MS_BUCKET_SLOTS) {
+        uint64_t first = b->first / 2;
+        uint32_t n = 0;
+        for (uint32_t k = 0; k < b->n; ++k) {
+            uint32_t j = (uint32_t)((b->first + k) / 2 - first);
+            if (j < n) {
+                s[j].bytes += s[k].bytes;
+                s[j].responses += s[k].responses;
+            } else {
+                s[j] = s[k];
+                n = j + 1;
+            }
+        }
+        memset(s + n, 0, (b->n - n) * sizeof *s);
+        b->n = n;
+        b->first = first;
+        b->step_ns *= 2;
+        slot /= 2;
+    }
+    uint32_t idx = (uint32_t)(slot - b->first);
+    s[idx].bytes += bytes;
+    s[idx].responses += responses;
+    if (idx >= b->n)
+        b->n = idx + 1;
+}
+
+/* Count bytes sent by the sender and collect transmit timestamps */
+static void ms_conn_sent(struct ms_conn* conn, size_t sent)
+{
+    conn->send_total += sent;
+    __atomic_store_n(&conn->result->live.sent, conn->send_total, __ATOMIC_RELAXED);
+    if (conn->shared->bucket_ns)
+        ms_bucket_add(&conn->result->sent, conn->shared, sent, 0);
+    if (conn->shared->timestamps)
+        ms_tx_drain(conn->fd_sock, &conn->sender_tx);
+}
+
+/* Send whole buffer. Returns 0 or -1 with sender errmsg set. */
+static int ms_send_buf(struct ms_conn* conn, const char* data, size_t len, int flags)
+{
+    while (len > 0) {
+        ssize_t sent = send(conn->fd_sock, data, len, flags);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            snprintf(conn->sender.errmsg, sizeof conn->sender.errmsg,
+                "send failed: %s", strerror(errno));
+            return -1;
+        }
+        ms_conn_sent(conn, (size_t)sent);
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/* Send the whole input file. Returns 0 or -1 with sender errmsg set. */
+static int ms_send_file(struct ms_conn* conn)
+{
+    size_t remaining = conn->in_len, chunk = conn->shared->send_chunk;
+    while (remaining > 0) {
+        ssize_t sent = sendfile(conn->fd_sock, conn->fd_in, NULL, chunk && chunk < remaining ? chunk : remaining);
+        if (sent < 0) {
+            snprintf(conn->sender.errmsg, sizeof conn->sender.errmsg,
+                "sendfile failed: %s", strerror(errno));
+            return -1;
+        }
+        ms_conn_sent(conn, (size_t)sent);
+        remaining -= (size_t)sent >= remaining ? remaining : (size_t)sent;
+    }
+    return 0;
+}
+
+/* Send len bytes of file fd starting at offset. Returns 0 or -1 with sender errmsg set. */
+static int ms_send_range(struct ms_conn* conn, int fd, const char* path, off_t offset, size_t len)
+{
+    while (len > 0) {
+        ssize_t sent = sendfile(conn->fd_sock, fd, &offset, len);
+        if (sent < 0) {
+            snprintf(conn->sender.errmsg, sizeof conn->sender.errmsg,
+                "sendfile failed: %s", strerror(errno));
+            return -1;
+        }
+        if (sent == 0) {
+            snprintf(conn->sender.errmsg, sizeof conn->sender.errmsg,
+                "File '%s' ended unexpectedly at offset %llu", path, (unsigned long long)offset);
+            return -1;
+        }
+        ms_conn_sent(conn, (size_t)sent);
+        len -= sent;
+    }
+    return 0;
+}
+
+/*
+** Send the first fill bytes of sendbuf, which end with a request head, followed by
+** the body. With chunk_size, the body is split into chunks; the line break after a
+** chunk is sent together with the size of the next one.
+** Returns 0 or -1 with sender errmsg set.
+*/
+static int ms_send_body(struct ms_conn* conn, const struct ms_body* body, size_t fill)
+{
+    if (ms_send_buf(conn, conn->sendbuf, fill, MSG_MORE) < 0)
+        return -1;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (conn->chunk_size == 0) {
+        if (ms_send_range(conn, body->fd, body->path, 0, body->len) < 0)
+            return -1;
+    } else {
+        char line[32];
+        size_t offset = 0;
+        while (offset < body->len) {
+            size_t n = body->len - offset < conn->chunk_size ? body->len - offset : conn->chunk_size;
+            int len = snprintf(line, sizeof line, offset ? "\r\n%zx\r\n" : "%zx\r\n", n);
+            if (ms_send_buf(conn, line, len, MSG_MORE) < 0)
+                return -1;
+            conn->body_framing += len;
+            if (ms_send_range(conn, body->fd, body->path, (off_t)offset, n) < 0)
+                return -1;
+            offset += n;
+        }
+        int len = snprintf(line, sizeof line, offset ? "\r\n0\r\n\r\n" : "0\r\n\r\n");
+        if (ms_send_buf(conn, line, len, 0) < 0)
+            return -1;
+        conn->body_framing += len;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    conn->body_ns += (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+    conn->body_sent += body->len;
+    ++conn->body_count;
+    return 0;
+}
+
+/*
+** Expand request templates into the send buffer until it is full, then send it.
+** The last request asks the server to close the connection. Upload requests
+** get the next body, which flushes the send buffer.
+** Returns 0 or -1 with sender errmsg set.
+*/
+static int ms_send_template(struct ms_conn* conn)
+{
+    static const char keepalive[] = "Connection: keep-alive\r\n\r\n";
+    static const char close[] = "Connection: close\r\n\r\n";
+    size_t fill = 0;
+    for (size_t i = 1; i <= conn->nreq; ++i) {
+        if (fill + conn->mix->max_len + MS_HEAD_EXTRA > conn->sendbuf_len) {
+            if (ms_send_buf(conn, conn->sendbuf, fill, 0) < 0)
+                return -1;
+            fill = 0;
+        }
+        size_t k = tpl_mix_pick(conn->mix, &conn->send_pick_rng);
+        if (conn->endpoints != NULL)
+            ++conn->endpoints[k].requests;
+        fill += tpl_expand(conn->mix->tpls[k], &conn->vars, conn->sendbuf + fill);
+        const struct ms_body* body = NULL;
+        if (conn->bodies != NULL && conn->mix->upload[k]) {
+            body = &conn->bodies[conn->body_next++ % conn->nbodies];
+            if (conn->chunk_size)
+                fill += sprintf(conn->sendbuf + fill, "Transfer-Encoding: chunked\r\n");
+            else
+                fill += sprintf(conn->sendbuf + fill, "Content-Length: %zu\r\n", body->len);
+        }
+        if (i < conn->nreq) {
+            memcpy(conn->sendbuf + fill, keepalive, sizeof keepalive - 1);
+            fill += sizeof keepalive - 1;
+        } else {
+            memcpy(conn->sendbuf + fill, close, sizeof close - 1);
+            fill += sizeof close - 1;
+        }
+        if (body != NULL) {
+            if (ms_send_body(conn, body, fill) < 0)
+                return -1;
+            fill = 0;
+        }
+    }
+    return ms_send_buf(conn, conn->sendbuf, fill, 0);
+}
+
+/*
+** Send the requests of the replay schedule when they are due and record the lag
+** behind the schedule. Requests which are overdue are sent immediately. The waits
+** end early when the run is interrupted.
+** Returns 0 or -1 with sender errmsg set.
+*/
+static int ms_send_replay(struct ms_conn* conn)
+{
+    for (size_t i = 0; i < conn->nsched; ++i) {
+        uint64_t entry[4];
+        memcpy(entry, conn->schedule + i * MS_REPLAY_ENTRY, sizeof entry);
+        struct timespec due = *conn->replay->start;
+        due.tv_sec += entry[0] / 1000000000;
+        due.tv_nsec += entry[0] % 1000000000;
+        if (due.tv_nsec >= 1000000000) {
+            due.tv_nsec -= 1000000000;
+            ++due.tv_sec;
+        }
+        struct timespec now;
+        for (;;) {
+            if (conn->shared->interrupted) {
+                snprintf(conn->sender.errmsg, sizeof conn->sender.errmsg, "Interrupted");
+                return -1;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t wait = (int64_t)(due.tv_sec - now.tv_sec) * 1000000000 + (due.tv_nsec - now.tv_nsec);
+            if (wait <= 0)
+                break;
+            struct timespec slice = { 0, wait < MS_REPLAY_SLICE_NS ? (long)wait : MS_REPLAY_SLICE_NS };
+            nanosleep(&slice, NULL);
+        }
+        int64_t lag = (int64_t)(now.tv_sec - due.tv_sec) * 1000000000 + (now.tv_nsec - due.tv_nsec);
+        if (lag > 0) {
+            if ((uint64_t)lag > conn->lag_max)
+                conn->lag_max = lag;
+            conn->lag_total += lag;
+            if (lag > MS_REPLAY_LATE_NS)
+                ++conn->late;
+        }
+        if (ms_send_range(conn, conn->fd_in, conn->in_file, (off_t)entry[1], entry[2]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Connect the socket of the sender and set it up. Returns 0 or -1 with sender errmsg set. */
+static int ms_sender_connect(struct ms_conn* conn)
+{
+    struct ms_thread* status = &conn->sender;
+    /* Connect TCP socket */
+    clock_gettime(CLOCK_MONOTONIC, &conn->connect_start);
+    char errmsg[256];
+    int fd = connecttcpsock(AF_UNSPEC, conn->host, conn->port, errmsg, sizeof errmsg, 0, 0, 0);
+    if (fd < 0) {
+        snprintf(status->errmsg, sizeof status->errmsg,
+            "Cannot open TCP connection to %s:%s: %s", conn->host, conn->port, errmsg);
+        return -1;
+    }
+    /* Published for the connection sampler and ms_interrupt, which read it concurrently */
+    __atomic_store_n(&conn->fd_sock, fd, __ATOMIC_RELEASE);
+    clock_gettime(CLOCK_MONOTONIC, &conn->connect_end);
+    /* The socket did not exist yet to be shut down by ms_interrupt */
+    if (conn->shared->interrupted) {
+        snprintf(status->errmsg, sizeof status->errmsg, "Interrupted");
+        return -1;
+    }
+    __atomic_store_n(&conn->result->live.connected, 1, __ATOMIC_RELAXED);
+    /* Kernel timestamps of received data and of request data passed to the device and
+       acknowledged; OPT_ID numbers these by byte offset since now, so it must follow connect() */
+    if (conn->shared->timestamps) {
+        int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE
+            | SOF_TIMESTAMPING_TX_ACK | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (setsockopt(conn->fd_sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof flags) < 0) {
+            snprintf(status->errmsg, sizeof status->errmsg,
+                "Cannot enable SO_TIMESTAMPING: %s", strerror(errno));
+            return -1;
+        }
+    }
+    /* Local port identifies the connection on the server, see ms_sampler_observe */
+    struct sockaddr_storage local;
+    socklen_t local_len = sizeof local;
+    if (getsockname(conn->fd_sock, (struct sockaddr*)&local, &local_len) == 0) {
+        conn->local_port = ntohs(local.ss_family == AF_INET6 ? ((struct sockaddr_in6*)&local)->sin6_port
+                                                             : ((struct sockaddr_in*)&local)->sin_port);
+    }
+    return 0;
+}
+
+/*
+** Connect and send all requests. The receiver waits for connectmx until the socket is
+** connected. It is unlocked on every path, and on errors the socket is shut down, so
+** that the receiver always ends and can be joined.
+*/
+static void ms_sender_run(struct ms_conn* conn)
+{
+    /* Initialize and wait */
+    struct ms_thread* status = &conn->sender;
+    status->successful = 0;
+    int err = pthread_mutex_lock(&conn->connectmx);
+    if (err) {
+        snprintf(status->errmsg, sizeof status->errmsg,
+            "pthread_mutex_lock failed: %s", strerror(err));
+    }
+    pthread_barrier_wait(&conn->shared->barrier);
+    if (err)
+        return;
+    int ret = conn->shared->abort ? -1 : ms_sender_connect(conn);
+    if (ret < 0 && conn->fd_sock >= 0)
+        shutdown(conn->fd_sock, SHUT_RDWR);
+    /* Unblock receiver thread */
+    err = pthread_mutex_unlock(&conn->connectmx);
+    if (err) {
+        snprintf(status->errmsg, sizeof status->errmsg,
+            "pthread_mutex_unlock failed: %s", strerror(err));
+        return;
+    }
+    if (ret < 0)
+        return;
+    /* Send all requests */
+    clock_gettime(CLOCK_MONOTONIC, &conn->send_start);
+    if (conn->mix != NULL)
+        ret = ms_send_template(conn);
+    else if (conn->replay != NULL)
+        ret = ms_send_replay(conn);
+    else
+        ret = ms_send_file(conn);
+    if (ret < 0) {
+        /* The receiver would wait for the responses otherwise */
+        shutdown(conn->fd_sock, SHUT_RDWR);
+        return;
+    }
+    if (conn->use_shutdown) {
+        shutdown(conn->fd_sock, SHUT_WR);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &conn->send_end);
+    /* No problems occurred */
+    status->successful = 1;
+}
+
+/* Put current response into store and extend run list. Returns 0 or -1 with receiver errmsg set. */
+static int ms_conn_store(struct ms_conn* conn, uint64_t hash, uint64_t check)
+{
+    struct ms_thread* status = &conn->receiver;
+    if (ms_store_put(conn->store, &hash, check, conn->resp_buf, conn->resp_len, status->errmsg, sizeof status->errmsg) < 0)
+        return -1;
+    conn->resp_len = 0;
+    if (conn->nruns > 0 && conn->runs[conn->nruns - 1].hash == hash) {
+        ++conn->runs[conn->nruns - 1].count;
+        return 0;
+    }
+    if (conn->nruns == conn->runs_cap) {
+        size_t ncap = conn->runs_cap ? conn->runs_cap * 2 : 16;
+        struct ms_run* nruns = realloc(conn->runs, ncap * sizeof *nruns);
+        if (nruns == NULL) {
+            snprintf(status->errmsg, sizeof status->errmsg, "Out of memory");
+            return -1;
+        }
+        conn->runs = nruns;
+        conn->runs_cap = ncap;
+    }
+    conn->runs[conn->nruns].hash = hash;
+    conn->runs[conn->nruns].count = 1;
+    ++conn->nruns;
+    return 0;
+}
+
+/* Prepare parser for the response to the next request of a mix or replay */
+static void ms_conn_next_pick(struct ms_conn* conn)
+{
+    if (conn->mix != NULL) {
+        conn->recv_pick = tpl_mix_pick(conn->mix, &conn->recv_pick_rng);
+        conn->parser.no_body = conn->mix->head[conn->recv_pick];
+    } else if (conn->replay != NULL && conn->recv_sched < conn->nsched) {
+        uint64_t flags;
+        memcpy(&flags, conn->schedule + conn->recv_sched * MS_REPLAY_ENTRY + 3 * sizeof flags, sizeof flags);
+        conn->parser.no_body = (flags & MS_REPLAY_HEAD) != 0;
+        ++conn->recv_sched;
+    }
+}
+
+/* Count complete response for the mix entry whose request it answers */
+static void ms_conn_count_endpoint(struct ms_conn* conn)
+{
+    if (conn->endpoints != NULL) {
+        struct ms_endpoint* ep = &conn->endpoints[conn->recv_pick];
+        ++ep->responses;
+        ep->bytes += conn->parser.res_length;
+        int cls = conn->parser.res_status / 100;
+        if (cls >= 1 && cls <= 5)
+            ++ep->status_classes[cls - 1];
+    }
+    ms_conn_next_pick(conn);
+}
+
+/*
+** Split received data into responses and count them. With a store, the raw data
+** of the current response is collected until it is complete. After a framing
+** error, the rest of the stream is collected as one blob.
+** Returns 0 or -1 with receiver errmsg set.
+*/
+static int ms_conn_parse(struct ms_conn* conn, const char* data, size_t len)
+{
+    struct ms_thread* status = &conn->receiver;
+    while (len > 0) {
+        size_t used = len;
+        int result = RP_MORE;
+        if (conn->parser.state != RP_ERROR)
+            result = rp_feed(&conn->parser, data, len, &used);
+        if (conn->store != NULL) {
+            if (conn->resp_len + used > conn->resp_cap) {
+                size_t ncap = conn->resp_cap ? conn->resp_cap : 4096;
+                while (ncap < conn->resp_len + used)
+                    ncap *= 2;
+                char* nbuf = realloc(conn->resp_buf, ncap);
+                if (nbuf == NULL) {
+                    snprintf(status->errmsg, sizeof status->errmsg, "Out of memory");
+                    return -1;
+                }
+                conn->resp_buf = nbuf;
+                conn->resp_cap = ncap;
+            }
+            memcpy(conn->resp_buf + conn->resp_len, data, used);
+            conn->resp_len += used;
+        }
+        if (result == RP_DONE) {
+            ++conn->responses;
+            ms_conn_count_endpoint(conn);
+            if (conn->store != NULL && ms_conn_store(conn, conn->parser.res_hash, conn->parser.res_check) < 0)
+                return -1;
+        }
+        data += used;
+        len -= used;
+    }
+    return 0;
+}
+
+/* End of stream: complete last response, store incomplete leftovers. Returns 0 or -1. */
+static int ms_conn_parse_end(struct ms_conn* conn)
+{
+    if (rp_finish(&conn->parser) == RP_DONE) {
+        ++conn->responses;
+        ms_conn_count_endpoint(conn);
+        if (conn->store != NULL)
+            return ms_conn_store(conn, conn->parser.res_hash, conn->parser.res_check);
+        return 0;
+    }
+    if (conn->store != NULL && conn->resp_len > 0)
+        return ms_conn_store(conn, rp_hash(RP_FNV_OFFSET, conn->resp_buf, conn->resp_len) | 1,
+                             rp_check(RP_CHECK_OFFSET, conn->resp_buf, conn->resp_len));
+    return 0;
+}
+
+/*
+** Receive into recvbuf like recv() with MSG_WAITALL, except until the first response is
+** complete: then it returns as soon as any data arrived, so that the times of the first
+** byte and the first response are not delayed until the buffer is full. The same applies
+** to the whole connection with throughput buckets or gaps, which need the arrival times. With kernel
+** timestamps, the timestamps of the first and the latest data are recorded. MSG_WAITALL is not
+** used then either, as the last call would return only at the end of the connection, so the
+** wake-up delay would include the wait for it.
+*/
+static ssize_t ms_conn_recv(struct ms_conn* conn)
+{
+    const struct ms_shared* shared = conn->shared;
+    int flags = conn->responses > 0 && ! shared->bucket_ns && ! shared->gap_ns && ! shared->timestamps ? MSG_WAITALL : 0;
+    if (! shared->timestamps)
+        return recv(conn->fd_sock, conn->recvbuf, sizeof conn->recvbuf, flags);
+    struct iovec iov = { conn->recvbuf, sizeof conn->recvbuf };
+    union {
+        char buf[CMSG_SPACE(sizeof (struct scm_timestamping))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+    int first = conn->rx_first.tv_sec == 0;
+    ssize_t rlen = recvmsg(conn->fd_sock, &msg, flags);
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); rlen > 0 && c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof ts);
+            if (first)
+                conn->rx_first = ts.ts[0];
+            conn->rx_last = ts.ts[0];
+            clock_gettime(CLOCK_MONOTONIC, &conn->rx_last_return);
+        }
+    }
+    ms_tx_drain(conn->fd_sock, &conn->receiver_tx);
+    return rlen;
+}
+
+/*
+** Record a gap between two responses of a connection. When all MS_GAP_SLOTS are used, it
+** replaces the shortest one if it is longer.
+*/
+static void ms_gap_add(struct ms_conn* conn, const struct timespec* from, const struct timespec* to)
+{
+    const struct timespec* start = &conn->shared->start;
+    struct ms_result* r = conn->result;
+    struct ms_gap gap = {
+        (uint64_t)((int64_t)(from->tv_sec - start->tv_sec) * 1000000000 + (from->tv_nsec - start->tv_nsec)),
+        (uint64_t)((int64_t)(to->tv_sec - start->tv_sec) * 1000000000 + (to->tv_nsec - start->tv_nsec))
+    };
+    ++r->gaps_total;
+    if (r->ngaps < MS_GAP_SLOTS) {
+        r->gaps[r->ngaps++] = gap;
+        return;
+    }
+    uint32_t shortest = 0;
+    for (uint32_t k = 1; k < r->ngaps; ++k) {
+        if (r->gaps[k].end_ns - r->gaps[k].start_ns < r->gaps[shortest].end_ns - r->gaps[shortest].start_ns)
+            shortest = k;
+    }
+    if (gap.end_ns - gap.start_ns > r->gaps[shortest].end_ns - r->gaps[shortest].start_ns)
+        r->gaps[shortest] = gap;
+}
+
+static void ms_receiver_run(struct ms_conn* conn)
+{
+    /* Initialize and wait */
+    struct ms_thread* status = &conn->receiver;
+    status->successful = 0;
+    conn->recv_total = 0;
+    pthread_barrier_wait(&conn->shared->barrier);
+    if (conn->shared->abort)
+        return;
+    /* Wait until fd_sock is connected */
+    int err = pthread_mutex_lock(&conn->connectmx);
+    if (err) {
+        snprintf(status->errmsg, sizeof status->errmsg,
+            "pthread_mutex_lock failed: %s", strerror(err));
+        return;
+    }
+    err = pthread_mutex_unlock(&conn->connectmx);
+    if (err) {
+        snprintf(status->errmsg, sizeof status->errmsg,
+            "pthread_mutex_unlock failed: %s", strerror(err));
+        return;
+    }
+    /* The sender failed before it was connected */
+    if (conn->fd_sock < 0) {
+        snprintf(status->errmsg, sizeof status->errmsg, "Not connected");
+        return;
+    }
+    /* Read until EOF */
+    clock_gettime(CLOCK_MONOTONIC, &conn->receive_start);
+    for (;;) {
+        /* Blocking read */
+        ssize_t rlen = ms_conn_recv(conn);
+        if (rlen == 0) {
+            /* Stream socket peer has performed an orderly shutdown */
+            clock_gettime(CLOCK_MONOTONIC, &conn->receive_end);
+            size_t before = conn->responses;
+            if (ms_conn_parse_end(conn) < 0)
+                return;
+            if (conn->shared->bucket_ns && conn->responses > before)
+                ms_bucket_add(&conn->result->received, conn->shared, 0, conn->responses - before);
+            break;
+        }
+        if (rlen < 0) {
+            snprintf(status->errmsg, sizeof status->errmsg,
+                "recv failed: %s", strerror(errno));
+            return;
+        }
+        /* Times of the first and the last data and of the first complete response */
+        struct timespec arrived;
+        clock_gettime(CLOCK_MONOTONIC, &arrived);
+        if (conn->recv_total == 0)
+            conn->first_byte = arrived;
+        conn->last_byte = arrived;
+        conn->recv_total += rlen;
+        size_t before = conn->responses;
+        if (ms_conn_parse(conn, conn->recvbuf, (size_t)rlen) < 0)
+            return;
+        if (conn->shared->bucket_ns)
+            ms_bucket_add(&conn->result->received, conn->shared, (uint64_t)rlen, conn->responses - before);
+        __atomic_store_n(&conn->result->live.received, conn->recv_total, __ATOMIC_RELAXED);
+        __atomic_store_n(&conn->result->live.responses, conn->responses, __ATOMIC_RELAXED);
+        if (conn->responses > 0 && conn->first_response.tv_sec == 0 && conn->first_response.tv_nsec == 0) {
+            conn->first_response = arrived;
+            conn->rx_first_response = conn->rx_last;
+        }
+        /* Gaps between responses, e.g. while the server paused */
+        if (conn->responses > before) {
+            if (conn->shared->gap_ns && before > 0
+                && (uint64_t)((int64_t)(arrived.tv_sec - conn->last_response.tv_sec) * 1000000000
+                              + (arrived.tv_nsec - conn->last_response.tv_nsec)) >= conn->shared->gap_ns)
+                ms_gap_add(conn, &conn->last_response, &arrived);
+            conn->last_response = arrived;
+        }
+        if (conn->store != NULL)
+            continue;
+        /* Append received data to shared log */
+        if (conn->writer != NULL) {
+            err = ms_writer_put(conn->writer, conn->id, &arrived, conn->recvbuf, (size_t)rlen);
+            if (err) {
+                snprintf(status->errmsg, sizeof status->errmsg,
+                    "Cannot write to log file '%s': %s", conn->writer->path, strerror(err));
+                return;
+            }
+            continue;
+        }
+        /* Write received responses to output file */
+        if (! conn->ignore_out) {
+            char* now = conn->recvbuf;
+            while (rlen > 0) {
+                ssize_t wlen = write(conn->fd_out, now, (size_t)rlen);
+                if (wlen < 0) {
+                    snprintf(status->errmsg, sizeof status->errmsg,
+                        "Cannot write to output file '%s': %s", conn->out_file, strerror(errno));
+                    return;
+                }
+                rlen -= wlen;
+                now += wlen;
+            }
+        }
+    }
+    /* No problems occurred */
+    status->successful = 1;
+}
+
+/* User plus system CPU time of a resource usage in ns */
+static uint64_t ms_rusage_cpu_ns(const struct rusage* ru)
+{
+    return (uint64_t)(ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000000
+        + (uint64_t)(ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000;
+}
+
+/* Record CPU time and context switches of the calling thread, right before it exits */
+static void ms_thread_usage(struct ms_thread* status)
+{
+    struct timespec cpu;
+    struct rusage ru;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu) == 0)
+        status->cpu_ns = (uint64_t)cpu.tv_sec * 1000000000 + (uint64_t)cpu.tv_nsec;
+    if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+        status->vcsw = ru.ru_nvcsw;
+        status->ivcsw = ru.ru_nivcsw;
+    }
+}
+
+/* Get TCP_INFO of a socket. Returns the number of bytes filled in, or 0 on errors. */
+static uint32_t ms_tcp_sample(int fd, struct ms_tcp_info* info)
+{
+    socklen_t optlen = sizeof *info;
+    memset(info, 0, sizeof *info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, info, &optlen) < 0)
+        return 0;
+    return (uint32_t)optlen;
+}
+
+static void ms_tcp_add(struct ms_tcp_stats* tcp, const struct ms_tcp_info* info)
+{
+    tcp->samples++;
+    tcp->rtt_sum_us += info->base.tcpi_rtt;
+    if (info->base.tcpi_rtt > tcp->rtt_max_us)
+        tcp->rtt_max_us = info->base.tcpi_rtt;
+    if (info->base.tcpi_snd_cwnd > tcp->cwnd_max)
+        tcp->cwnd_max = info->base.tcpi_snd_cwnd;
+}
+
+/*
+** Add queue depths sampled at t_ns after the start to the time series of r with cap
+** slots. When the series is full, pairs of slots are merged and the slot length doubles,
+** so it always covers the whole connection. Slots missed by a late tick repeat the
+** previous sample.
+*/
+static void ms_queue_add(struct ms_result* r, uint32_t cap, uint64_t t_ns, const struct ms_queue_sample* q)
+{
+    struct ms_queue_sample* s = r->queues;
+    uint64_t slot = t_ns / r->queue_step_ns;
+    if (r->nqueues == 0)
+        r->queue_first = slot;
+    while (slot - r->queue_first >= cap) {
+        uint64_t first = r->queue_first / 2;
+        uint32_t n = 0;
+        for (uint32_t k = 0; k < r->nqueues; ++k) {
+            uint32_t j = (uint32_t)((r->queue_first + k) / 2 - first);
+            if (j < n) {
+                s[j].unsent = s[k].unsent > s[j].unsent ? s[k].unsent : s[j].unsent;
+                s[j].unacked = s[k].unacked > s[j].unacked ? s[k].unacked : s[j].unacked;
+                s[j].inq = s[k].inq > s[j].inq ? s[k].inq : s[j].inq;
+            } else {
+                s[j] = s[k];
+                n = j + 1;
+            }
+        }
+        r->nqueues = n;
+        r->queue_first = first;
+        r->queue_step_ns *= 2;
+        slot /= 2;
+    }
+    uint32_t idx = (uint32_t)(slot - r->queue_first);
+    if (idx < r->nqueues) {
+        s[idx].unsent = q->unsent > s[idx].unsent ? q->unsent : s[idx].unsent;
+        s[idx].unacked = q->unacked > s[idx].unacked ? q->unacked : s[idx].unacked;
+        s[idx].inq = q->inq > s[idx].inq ? q->inq : s[idx].inq;
+        return;
+    }
+    for (; r->nqueues < idx; ++r->nqueues)
+        s[r->nqueues] = s[r->nqueues - 1];
+    s[r->nqueues++] = *q;
+}
+
+/* Sample the send and receive queues of the socket fd of a connection */
+static void ms_queue_sample(struct ms_conn* conn, int fd, uint64_t t_ns)
+{
+    struct ms_result* r = conn->result;
+    int outq, unsent, inq;
+    if (ioctl(fd, SIOCOUTQ, &outq) < 0 || ioctl(fd, SIOCOUTQNSD, &unsent) < 0 || ioctl(fd, SIOCINQ, &inq) < 0)
+        return;
+    struct ms_queue_sample q = {
+        (uint32_t)unsent, outq > unsent ? (uint32_t)(outq - unsent) : 0, (uint32_t)inq
+    };
+    if (r->queue_step_ns == 0)
+        r->queue_step_ns = conn->shared->conn_interval_ns;
+    ms_queue_add(r, conn->shared->queue_cap, t_ns, &q);
+}
+
+/*
+** Tick of the connection sampler thread: sample TCP_INFO and the socket queues of all
+** connections, which are connected and still receiving. The last TCP_INFO sample of a
+** connection is taken by its receiver and added after the sampler has stopped.
+*/
+static int ms_conn_tick(struct ms_conn* conns)
+{
+    struct ms_shared* shared = conns->shared;
+    struct ms_tcp_info info;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsed = (int64_t)(now.tv_sec - shared->start.tv_sec) * 1000000000 + (now.tv_nsec - shared->start.tv_nsec);
+    for (struct ms_conn* c = conns; c != NULL; c = c->prev) {
+        int fd = __atomic_load_n(&c->fd_sock, __ATOMIC_ACQUIRE);
+        if (fd < 0 || __atomic_load_n(&c->recv_done, __ATOMIC_ACQUIRE))
+            continue;
+        if (shared->tcp_info && ms_tcp_sample(fd, &info) > 0)
+            ms_tcp_add(&c->tcp, &info);
+        if (shared->queue_cap)
+            ms_queue_sample(c, fd, elapsed > 0 ? (uint64_t)elapsed : 0);
+    }
+    return 0;
+}
+
+static void* ms_sender_thread(struct ms_conn* conn)
+{
+    ms_sender_run(conn);
+    if (! conn->sender.successful)
+        __atomic_store_n(&conn->result->live.failed, 1, __ATOMIC_RELAXED);
+    ms_thread_usage(&conn->sender);
+    return NULL;
+}
+
+static void* ms_receiver_thread(struct ms_conn* conn)
+{
+    ms_receiver_run(conn);
+    __atomic_store_n(&conn->recv_done, 1, __ATOMIC_RELEASE);
+    if (! conn->receiver.successful)
+        __atomic_store_n(&conn->result->live.failed, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&conn->result->live.done, 1, __ATOMIC_RELAXED);
+    if (conn->shared->tcp_info && conn->fd_sock >= 0)
+        conn->tcp.info_len = ms_tcp_sample(conn->fd_sock, &conn->tcp.last);
+    ms_thread_usage(&conn->receiver);
+    return NULL;
+}
+
+/*
+** Allocate zeroed memory of a connection. With placed, it gets pages of its own, which
+** the calling thread touches right away. Pages are placed on the NUMA node of the CPU
+** which touches them first, and heap memory could share a page with other connections.
+*/
+static void* ms_conn_alloc(size_t len, int placed)
+{
+    if (! placed)
+        return calloc(1, len);
+    void* p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    memset(p, 0, len);
+    return p;
+}
+
+static void ms_conn_free(void* p, size_t len, int placed)
+{
+    if (! placed)
+        free(p);
+    else if (p != NULL)
+        munmap(p, len);
+}
+
+static void ms_destroy_conns(struct ms_conn* conn, int cancel_threads)
+{
+    while (conn != NULL) {
+        if (conn->fd_in >= 0)
+            close(conn->fd_in);
+        if (conn->fd_out >= 0)
+            close(conn->fd_out);
+        if (conn->fd_sock >= 0)
+            close(conn->fd_sock);
+        if (conn->sender.created && cancel_threads) {
+            // pthread_cancel(conn->sender.thread); /* Doesn't seem to work without special libc */
+        }
+        if (conn->receiver.created && cancel_threads)
+            // pthread_cancel(conn->receiver.thread);  /* Doesn't seem to work without special libc */
+        if (conn->connectmx_created)
+            pthread_mutex_destroy(&conn->connectmx);
+        struct ms_conn* prev = conn->prev;
+        free(conn->resp_buf);
+        free(conn->runs);
+        ms_conn_free(conn->sendbuf, conn->sendbuf_len, conn->placed);
+        ms_conn_free(conn, sizeof *conn, conn->placed);
+        conn = prev;
+    }
+}
+
+/* CPU sets for the threads of connections, assigned round-robin by connection ID */
+struct ms_placement {
+    cpu_set_t* sets;
+    size_t nsets;
+};
+
+/* Parse CPU list like "0-3,8" into set. Returns 0, or -1 if it is malformed or empty. */
+static int ms_parse_cpulist(const char* s, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+    while (*s != '\0') {
+        char* end;
+        unsigned long lo = strtoul(s, &end, 10), hi = lo;
+        if (end == s)
+            return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtoul(s, &end, 10);
+            if (end == s || hi < lo)
+                return -1;
+        }
+        if (hi >= CPU_SETSIZE)
+            return -1;
+        for (unsigned long c = lo; c <= hi; ++c)
+            CPU_SET(c, set);
+        s = end;
+        if (*s == ',')
+            ++s;
+        else if (*s != '\0')
+            return -1;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+/* Connections to one target host and their request settings, see lcf_multi_sendfile */
+struct ms_target {
+    const char* host;
+    const char* port;
+    size_t num_conns;
+    const char** in_files;              /* Input files, assigned round-robin to connections */
+    size_t nin_files;
+    struct tpl_mix* mix;                /* Request templates, or NULL */
+    size_t nreq;                        /* Number of requests to generate from mix */
+    uint64_t seed;
+    struct ms_body* bodies;             /* Opened request bodies, or NULL */
+    size_t nbodies;
+    size_t chunk_size;
+    struct ms_replay replay;
+    int use_replay;
+    struct ms_endpoint* endpoints;      /* Statistics per connection and mix entry in shared region, or NULL */
+};
+
+static void ms_target_free(struct ms_target* t)
+{
+    free(t->in_files);
+    tpl_mix_free(t->mix);
+    for (size_t k = 0; k < t->nbodies; ++k)
+        close(t->bodies[k].fd);
+    free(t->bodies);
+    free(t->replay.schedules);
+    free(t->replay.counts);
+}
+
+/*
+** Read optional integer field key of table opts into out, using def if it is nil.
+** Returns 0, or -1 with an error message in msgbuf if it is not an integer >= min.
+*/
+static int ms_opt_integer(lua_State* L, int opts, const char* key, lua_Integer def, lua_Integer min,
+                          lua_Integer* out, char* msgbuf, size_t msglen)
+{
+    lua_getfield(L, opts, key);
+    int ok = lua_isnil(L, -1) || lua_isinteger(L, -1);
+    *out = lua_isnil(L, -1) ? def : lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (! ok || *out < min) {
+        snprintf(msgbuf, msglen, "%s must be an integer of at least %lld", key, (long long)min);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+** Collect input file names from the string or sequence of strings at index idx.
+** Returns 0, or -1 with an error message in msgbuf.
+*/
+static int ms_target_in_files(lua_State* L, int idx, struct ms_target* t, char* msgbuf, size_t msglen)
+{
+    if (lua_type(L, idx) == LUA_TSTRING) {
+        t->nin_files = 1;
+    } else if (lua_istable(L, idx) && lua_rawlen(L, idx) > 0) {
+        t->nin_files = lua_rawlen(L, idx);
+    } else {
+        snprintf(msgbuf, msglen, "Input file must be a string or a non-empty sequence of strings");
+        return -1;
+    }
+    if ((t->in_files = malloc(t->nin_files * sizeof *t->in_files)) == NULL) {
+        snprintf(msgbuf, msglen, "Out of memory");
+        return -1;
+    }
+    for (size_t k = 0; k < t->nin_files; ++k) {
+        if (lua_type(L, idx) == LUA_TSTRING) {
+            t->in_files[k] = lua_tostring(L, idx);
+            continue;
+        }
+        lua_rawgeti(L, idx, k + 1);
+        t->in_files[k] = lua_type(L, -1) == LUA_TSTRING ? lua_tostring(L, -1) : NULL;
+        lua_pop(L, 1);
+        if (t->in_files[k] == NULL) {
+            snprintf(msgbuf, msglen, "Input file #%zu must be a string", k + 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+** Load the request settings of a target from the table at index opts, or the
+** defaults if opts is 0: template, mix, nreq, seed, bodies, chunk_size and replay.
+** Strings stay referenced by the table while running. Bodies are opened and
+** templates are compiled. Returns 0, or -1 with an error message in msgbuf.
+*/
+static int ms_target_load(lua_State* L, int opts, struct ms_target* t, char* msgbuf, size_t msglen)
+{
+    t->nreq = 1;
+    t->seed = 1;
+    if (opts == 0)
+        return 0;
+    int top = lua_gettop(L);
+    lua_Integer n;
+    if (ms_opt_integer(L, opts, "nreq", 1, 1, &n, msgbuf, msglen) < 0)
+        goto failed;
+    t->nreq = (size_t)n;
+    if (ms_opt_integer(L, opts, "seed", 1, LUA_MININTEGER, &n, msgbuf, msglen) < 0)
+        goto failed;
+    t->seed = (uint64_t)n;
+    if (ms_opt_integer(L, opts, "chunk_size", 0, 0, &n, msgbuf, msglen) < 0)
+        goto failed;
+    t->chunk_size = (size_t)n;
+    /* Compile request templates; a single template is a mix with one entry */
+    lua_getfield(L, opts, "template");
+    lua_getfield(L, opts, "mix");
+    if (! lua_isnil(L, -2) && lua_type(L, -2) != LUA_TSTRING) {
+        snprintf(msgbuf, msglen, "template must be a string");
+        goto failed;
+    }
+    if (! lua_isnil(L, -1)) {
+        if (! lua_istable(L, -1) || lua_rawlen(L, -1) == 0) {
+            snprintf(msgbuf, msglen, "mix must be a non-empty sequence");
+            goto failed;
+        }
+        size_t count = lua_rawlen(L, -1);
+        if ((t->mix = tpl_mix_new(count)) == NULL) {
+            snprintf(msgbuf, msglen, "Out of memory");
+            goto failed;
+        }
+        for (size_t k = 1; k <= count; ++k) {
+            lua_rawgeti(L, -1, k);
+            if (! lua_istable(L, -1)) {
+                snprintf(msgbuf, msglen, "mix entry #%zu must be a table", k);
+                goto failed;
+            }
+            lua_getfield(L, -1, "weight");
+            lua_getfield(L, -2, "template");
+            if (! lua_isinteger(L, -2) || lua_tointeger(L, -2) <= 0 || lua_type(L, -1) != LUA_TSTRING) {
+                snprintf(msgbuf, msglen, "mix entry #%zu needs positive integer weight and template string", k);
+                goto failed;
+            }
+            size_t srclen;
+            const char* src = lua_tolstring(L, -1, &srclen);
+            int err = tpl_mix_add(t->mix, (uint64_t)lua_tointeger(L, -2), src, srclen, msgbuf, msglen);
+            lua_pop(L, 3);
+            if (err < 0)
+                goto failed;
+        }
+    } else if (! lua_isnil(L, -2)) {
+        size_t srclen;
+        const char* src = lua_tolstring(L, -2, &srclen);
+        if ((t->mix = tpl_mix_new(1)) == NULL) {
+            snprintf(msgbuf, msglen, "Out of memory");
+            goto failed;
+        }
+        if (tpl_mix_add(t->mix, 1, src, srclen, msgbuf, msglen) < 0)
+            goto failed;
+    }
+    lua_pop(L, 2);
+    /* Open request bodies */
+    lua_getfield(L, opts, "bodies");
+    if (! lua_isnil(L, -1)) {
+        if (! lua_istable(L, -1)) {
+            snprintf(msgbuf, msglen, "bodies must be a sequence of file names");
+            goto failed;
+        }
+        size_t count = lua_rawlen(L, -1);
+        if (count > 0 && t->mix == NULL) {
+            snprintf(msgbuf, msglen, "bodies need a template or mix");
+            goto failed;
+        }
+        if (count > 0 && (t->bodies = calloc(count, sizeof *t->bodies)) == NULL) {
+            snprintf(msgbuf, msglen, "Out of memory");
+            goto failed;
+        }
+        for (size_t k = 1; k <= count; ++k) {
+            lua_rawgeti(L, -1, k);
+            const char* path = lua_type(L, -1) == LUA_TSTRING ? lua_tostring(L, -1) : NULL;
+            lua_pop(L, 1);
+            if (path == NULL) {
+                snprintf(msgbuf, msglen, "body #%zu must be a file name", k);
+                goto failed;
+            }
+            struct stat st;
+            int fd = open(path, O_RDONLY);
+            if (fd < 0 || fstat(fd, &st) < 0) {
+                snprintf(msgbuf, msglen, "Cannot open body file '%s': %s", path, strerror(errno));
+                if (fd >= 0)
+                    close(fd);
+                goto failed;
+            }
+            t->bodies[t->nbodies].fd = fd;
+            t->bodies[t->nbodies].len = st.st_size;
+            t->bodies[t->nbodies].path = path;
+            ++t->nbodies;
+        }
+    }
+    lua_pop(L, 1);
+    /* Collect replay schedules */
+    lua_getfield(L, opts, "replay");
+    if (! lua_isnil(L, -1)) {
+        if (! lua_istable(L, -1) || lua_rawlen(L, -1) != t->num_conns) {
+            snprintf(msgbuf, msglen, "replay needs one schedule per connection");
+            goto failed;
+        }
+        if (t->mix != NULL) {
+            snprintf(msgbuf, msglen, "replay cannot be combined with templates");
+            goto failed;
+        }
+        t->replay.schedules = malloc(t->num_conns * sizeof *t->replay.schedules);
+        t->replay.counts = malloc(t->num_conns * sizeof *t->replay.counts);
+        if (t->replay.schedules == NULL || t->replay.counts == NULL) {
+            snprintf(msgbuf, msglen, "Out of memory");
+            goto failed;
+        }
+        for (size_t k = 1; k <= t->num_conns; ++k) {
+            lua_rawgeti(L, -1, k);
+            size_t len = 0;
+            const char* schedule = lua_type(L, -1) == LUA_TSTRING ? lua_tolstring(L, -1, &len) : NULL;
+            lua_pop(L, 1);
+            if (schedule == NULL || len % MS_REPLAY_ENTRY != 0) {
+                snprintf(msgbuf, msglen, "replay schedule #%zu must be a string of packed uint64_t quadruples", k);
+                goto failed;
+            }
+            t->replay.schedules[k - 1] = schedule;
+            t->replay.counts[k - 1] = len / MS_REPLAY_ENTRY;
+        }
+        t->use_replay = 1;
+    }
+    lua_settop(L, top);
+    return 0;
+failed:
+    lua_settop(L, top);
+    return -1;
+}
+
+/*
+** Try to create all required file descriptors, sockets, and threads.
+** Returns pointer to linked list of structs on success. On error,
+** NULL is returned and an error message is printed into msgbuf.
+*/
+static struct ms_conn* ms_create_conns(char* msgbuf, size_t msglen,
+                                const struct ms_target* t, uint32_t target, uint32_t first_id,
+                                size_t from, size_t to, const char* out_file_fmt, struct ms_shared* shared,
+                                const struct ms_placement* placement,
+                                int use_shutdown, int ignore_out, struct ms_writer* writer, struct ms_store* store)
+{
+    struct ms_conn* last = NULL;
+    const struct tpl_mix* mix = t->mix;
+    const struct ms_replay* replay = t->use_replay ? &t->replay : NULL;
+    for (size_t i = from; i < to; ++i) {
+        /* Run on the CPUs of the connection while allocating its memory, so that its
+           pages are first touched and thus placed on their NUMA node */
+        const cpu_set_t* cpus = NULL;
+        if (placement->nsets > 0) {
+            cpus = &placement->sets[(first_id + i - 1) % placement->nsets];
+            pthread_setaffinity_np(pthread_self(), sizeof *cpus, cpus);
+        }
+        /* Setup shared data structure and add to linked list */
+        struct ms_conn* conn = ms_conn_alloc(sizeof (struct ms_conn), cpus != NULL);
+        if (conn == NULL) {
+            snprintf(msgbuf, msglen, "Out of memory");
+            goto failed;
+        }
+        conn->placed = cpus != NULL;
+        conn->id = first_id + (uint32_t)i;
+        conn->result = &shared->results[conn->id - 1];
+        conn->result->target = target;
+        conn->result->in_idx = i % t->nin_files;
+        conn->fd_in = conn->fd_out = conn->fd_sock = -1;
+        conn->host = t->host;
+        conn->port = t->port;
+        conn->use_shutdown = use_shutdown;
+        conn->ignore_out = ignore_out;
+        conn->writer = writer;
+        conn->store = store;
+        conn->responses = 0;
+        conn->resp_buf = NULL;
+        conn->resp_len = conn->resp_cap = 0;
+        conn->runs = NULL;
+        conn->nruns = conn->runs_cap = 0;
+        rp_init(&conn->parser, store != NULL);
+        conn->shared = shared;
+        conn->in_len = 0;
+        conn->send_total = 0;
+        conn->mix = mix;
+        conn->endpoints = NULL;
+        conn->nreq = t->nreq;
+        conn->sendbuf = NULL;
+        conn->sendbuf_len = 0;
+        conn->bodies = t->bodies;
+        conn->nbodies = t->nbodies;
+        conn->body_next = t->nbodies ? i % t->nbodies : 0;
+        conn->chunk_size = t->chunk_size;
+        conn->body_count = 0;
+        conn->body_sent = conn->body_framing = conn->body_ns = 0;
+        conn->replay = replay;
+        conn->schedule = replay != NULL ? replay->schedules[i] : NULL;
+        conn->nsched = replay != NULL ? replay->counts[i] : 0;
+        conn->recv_sched = 0;
+        if (replay != NULL)
+            ms_conn_next_pick(conn);
+        conn->lag_max = conn->lag_total = 0;
+        conn->late = 0;
+        conn->sender.created = 0;
+        conn->receiver.created = 0;
+        conn->connectmx_created = 0;
+        conn->prev = last;
+        last = conn;
+        /* Allocate buffer for generating requests from template */
+        if (mix != NULL) {
+            tpl_vars_init(&conn->vars, t->seed, conn->id, (uint64_t)i * t->nreq);
+            conn->send_pick_rng = conn->recv_pick_rng = ~t->seed ^ ((uint64_t)conn->id * 0x9e3779b97f4a7c15ULL);
+            ms_conn_next_pick(conn);
+            conn->sendbuf_len = mix->max_len + MS_HEAD_EXTRA > 64 * 1024 ? mix->max_len + MS_HEAD_EXTRA : 64 * 1024;
+            if ((conn->sendbuf = ms_conn_alloc(conn->sendbuf_len, conn->placed)) == NULL) {
+                snprintf(msgbuf, msglen, "Out of memory");
+                goto failed;
+            }
+            if (mix->n > 1)
+                conn->result->endpoints = conn->endpoints = t->endpoints + i * mix->n;
+        }
+        /* Open input file with requests to send, assigned round-robin */
+        const char* in_file = t->in_files[i % t->nin_files];
+        snprintf(conn->in_file, sizeof conn->in_file, "%s", in_file);
+        if (mix == NULL && (conn->fd_in = open(in_file, O_RDONLY)) < 0) {
+            snprintf(msgbuf, msglen, "Cannot open input file '%s': %s", in_file, strerror(errno));
+            goto failed;
+        }
+        if (mix == NULL) {
+            struct stat st;
+            if (fstat(conn->fd_in, &st) < 0) {
+                snprintf(msgbuf, msglen, "Cannot stat input file '%s': %s", in_file, strerror(errno));
+                goto failed;
+            }
+            conn->in_len = st.st_size;
+        }
+        /* Open output file to record responses */
+        if (! ignore_out && writer == NULL && store == NULL) {
+            snprintf(conn->out_file, sizeof conn->out_file, out_file_fmt, (int)conn->id);
+            if ((conn->fd_out = open(conn->out_file, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
+                snprintf(msgbuf, msglen, "Cannot open output file '%s': %s",
+                    conn->out_file, strerror(errno));
+                goto failed;
+            }
+        }
+        /* Create mutex for blocking receiver thread */
+        int err = pthread_mutex_init(&conn->connectmx, NULL);
+        if (err) {
             snprintf(msgbuf, msglen, "pthread_mutex_init failed: %s", strerror(err));
             goto failed;
         }
-        conn->connectmx_created = 1;
-        /* Start worker threads with a small stack, since there might be many of them
-           and they do not need much space anyways, as they mostly block on IO. Most
-           stack space is probably needed by getaddrinfo. */
-        pthread_attr_t attr;
-        pthread_attr_init(&attr);
-        pthread_attr_setstacksize(&attr, 32 * 1024);
-        err = pthread_create(&conn->sender.thread, &attr, (void*(*)(void*))ms_sender_thread, (void*)conn);
-        if (err != 0) {
-            snprintf(msgbuf, msglen, "Failed to start sender thread #%zu: %s", i, strerror(err));
-            pthread_attr_destroy(&attr);
-            goto failed;
+        conn->connectmx_created = 1;
+        /* Start worker threads with a small stack, since there might be many of them
+           and they do not need much space anyways, as they mostly block on IO. Most
+           stack space is probably needed by getaddrinfo. */
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, 32 * 1024);
+        if (cpus != NULL)
+            pthread_attr_setaffinity_np(&attr, sizeof *cpus, cpus);
+        err = pthread_create(&conn->sender.thread, &attr, (void*(*)(void*))ms_sender_thread, (void*)conn);
+        if (err != 0) {
+            snprintf(msgbuf, msglen, "Failed to start sender thread #%zu: %s", i, strerror(err));
+            pthread_attr_destroy(&attr);
+            goto failed;
+        }
+        conn->sender.created = 1;
+        err = pthread_create(&conn->receiver.thread, &attr, (void*(*)(void*))ms_receiver_thread, (void*)conn);
+        if (err != 0) {
+            snprintf(msgbuf, msglen, "Failed to start receiver thread #%zu: %s", i, strerror(err));
+            pthread_attr_destroy(&attr);
+            goto failed;
+        }
+        conn->receiver.created = 1;
+        pthread_attr_destroy(&attr);
+    }
+    return last;
+failed:
+    ms_destroy_conns(last, 1);
+    return NULL;
+}
+
+/*
+** Create connections first..last-1, counted across all targets, and chain them into
+** one list. Returns 0 with the newest connection in *out (NULL for an empty range),
+** or -1 with a message in msgbuf after destroying the connections created so far.
+*/
+static int ms_create_range(struct ms_conn** out, char* msgbuf, size_t msglen,
+                           const struct ms_target* targets, size_t ntargets, size_t first, size_t last,
+                           const char* out_file_fmt, struct ms_shared* shared, const struct ms_placement* placement,
+                           int use_shutdown, int ignore_out, struct ms_writer* writer, struct ms_store* store)
+{
+    /* The calling thread moves between CPUs of connections, restore its affinity afterwards */
+    cpu_set_t saved;
+    int restore = placement->nsets > 0 && pthread_getaffinity_np(pthread_self(), sizeof saved, &saved) == 0;
+    int result = 0;
+    struct ms_conn* conns = NULL;
+    size_t offset = 0;
+    for (size_t k = 0; k < ntargets; offset += targets[k++].num_conns) {
+        size_t from = first > offset ? first - offset : 0;
+        size_t to = last > offset ? last - offset : 0;
+        if (to > targets[k].num_conns)
+            to = targets[k].num_conns;
+        if (from >= to)
+            continue;
+        struct ms_conn* tconns = ms_create_conns(
+            msgbuf, msglen,
+            &targets[k], (uint32_t)(k + 1), (uint32_t)(offset + 1), from, to, out_file_fmt,
+            shared, placement, use_shutdown, ignore_out, writer, store
+        );
+        if (tconns == NULL) {
+            ms_destroy_conns(conns, 1);
+            conns = NULL;
+            result = -1;
+            break;
+        }
+        /* Append list of previous targets to the oldest connection of this one */
+        struct ms_conn* oldest = tconns;
+        while (oldest->prev != NULL)
+            oldest = oldest->prev;
+        oldest->prev = conns;
+        conns = tconns;
+    }
+    if (restore)
+        pthread_setaffinity_np(pthread_self(), sizeof saved, &saved);
+    *out = conns;
+    return result;
+}
+
+/*
+** Thread which calls tick at a fixed interval from its start until it is stopped, and once
+** more after stopping. Used for sampling during a run.
+*/
+struct ms_ticker {
+    pthread_t thread;
+    int created;
+    pthread_mutex_t mx;
+    pthread_cond_t cond;                /* Signalled to stop, uses CLOCK_MONOTONIC */
+    int stop;
+    uint64_t interval_ns;
+    int (*tick)(void* arg);             /* Returns 0, or -1 to end the thread early */
+    void* arg;
+};
+
+static void* ms_ticker_thread(struct ms_ticker* t)
+{
+    struct timespec due;
+    clock_gettime(CLOCK_MONOTONIC, &due);
+    pthread_mutex_lock(&t->mx);
+    for (;;) {
+        int stop = t->stop;
+        pthread_mutex_unlock(&t->mx);
+        if (t->tick(t->arg) < 0 || stop)
+            return NULL;
+        uint64_t next = (uint64_t)due.tv_nsec + t->interval_ns;
+        due.tv_sec += (time_t)(next / 1000000000);
+        due.tv_nsec = (long)(next % 1000000000);
+        pthread_mutex_lock(&t->mx);
+        while (! t->stop && pthread_cond_timedwait(&t->cond, &t->mx, &due) != ETIMEDOUT)
+            ;
+    }
+}
+
+/* Start calling tick(arg) every interval_ns. Returns 0 or an error number. */
+static int ms_ticker_start(struct ms_ticker* t, uint64_t interval_ns, int (*tick)(void*), void* arg)
+{
+    memset(t, 0, sizeof *t);
+    t->interval_ns = interval_ns;
+    t->tick = tick;
+    t->arg = arg;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&t->mx, NULL);
+    pthread_cond_init(&t->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    int err = pthread_create(&t->thread, NULL, (void*(*)(void*))ms_ticker_thread, (void*)t);
+    if (err) {
+        pthread_cond_destroy(&t->cond);
+        pthread_mutex_destroy(&t->mx);
+        return err;
+    }
+    t->created = 1;
+    return 0;
+}
+
+/* Let the thread tick once more and end it */
+static void ms_ticker_stop(struct ms_ticker* t)
+{
+    if (! t->created)
+        return;
+    pthread_mutex_lock(&t->mx);
+    t->stop = 1;
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->mx);
+    pthread_join(t->thread, NULL);
+    pthread_cond_destroy(&t->cond);
+    pthread_mutex_destroy(&t->mx);
+    t->created = 0;
+}
+
+/*
+** Join the threads of all connections, stop the connection sampler (if not NULL) and
+** copy their results into the shared region. With index, the response runs of every
+** connection are written into the store index.
+*/
+static void ms_join_conns(struct ms_conn* conns, FILE* index, struct ms_ticker* sampler)
+{
+    for (struct ms_conn* c = conns; c != NULL; c = c->prev) {
+        /* Join sender thread, which makes the receiver end if it failed, see ms_sender_run */
+        pthread_join(c->sender.thread, NULL);
+        /* Join receiver thread, which still writes into the shared results */
+        pthread_join(c->receiver.thread, NULL);
+    }
+    if (sampler != NULL)
+        ms_ticker_stop(sampler);
+    for (struct ms_conn* c = conns; c != NULL; c = c->prev) {
+        struct ms_result* r = c->result;
+        if (c->interrupted) {
+            r->state = MS_RESULT_ERROR;
+            snprintf(r->errmsg, sizeof r->errmsg, "Interrupted");
+            continue;
+        }
+        if (! c->sender.successful) {
+            r->state = MS_RESULT_ERROR;
+            snprintf(r->errmsg, sizeof r->errmsg, "%.255s", c->sender.errmsg);
+            continue;
+        }
+        for (size_t k = 0; index != NULL && k < c->nruns; ++k) {
+            fprintf(index, "%u %016llx %llu\n", (unsigned)c->id,
+                (unsigned long long)c->runs[k].hash, (unsigned long long)c->runs[k].count);
+        }
+        if (! c->receiver.successful) {
+            r->state = MS_RESULT_ERROR;
+            snprintf(r->errmsg, sizeof r->errmsg, "%.255s", c->receiver.errmsg);
+            continue;
+        }
+        r->state = MS_RESULT_OK;
+        r->send_total = c->send_total;
+        r->recv_total = c->recv_total;
+        r->connect_start = c->connect_start;
+        r->connect_end = c->connect_end;
+        r->send_start = c->send_start;
+        r->send_end = c->send_end;
+        r->receive_start = c->receive_start;
+        r->receive_end = c->receive_end;
+        r->first_byte = c->first_byte;
+        r->first_response = c->first_response;
+        r->last_byte = c->last_byte;
+        r->responses = c->responses;
+        if (c->parser.state == RP_ERROR)
+            snprintf(r->parse_error, sizeof r->parse_error, "%s", c->parser.errmsg);
+        r->nruns = c->nruns;
+        r->lag_max = c->lag_max;
+        r->lag_total = c->lag_total;
+        r->late = c->late;
+        r->body_count = c->body_count;
+        r->body_sent = c->body_sent;
+        r->body_framing = c->body_framing;
+        r->body_ns = c->body_ns;
+        r->sender_cpu_ns = c->sender.cpu_ns;
+        r->receiver_cpu_ns = c->receiver.cpu_ns;
+        r->vcsw = c->sender.vcsw + c->receiver.vcsw;
+        r->ivcsw = c->sender.ivcsw + c->receiver.ivcsw;
+        r->local_port = c->local_port;
+        if (c->tcp.info_len > 0)
+            ms_tcp_add(&c->tcp, &c->tcp.last);
+        r->tcp = c->tcp;
+        r->rx_first = c->rx_first;
+        r->rx_last = c->rx_last;
+        r->rx_last_return = c->rx_last_return;
+        r->rx_first_response = c->rx_first_response;
+        /* Whichever thread saw the timestamps of the last request byte */
+        uint32_t last_key = (uint32_t)(c->send_total - 1);
+        const struct ms_tx_times* tx[2] = { &c->sender_tx, &c->receiver_tx };
+        for (int k = 0; k < 2 && c->send_total > 0; ++k) {
+            if (tx[k]->sent.tv_sec != 0 && tx[k]->sent_key == last_key)
+                r->tx_sent = tx[k]->sent;
+            if (tx[k]->acked.tv_sec != 0 && tx[k]->acked_key == last_key)
+                r->tx_acked = tx[k]->acked;
+        }
+    }
+}
+
+/* What ms_interrupt acts on in this process, set before it is installed */
+static struct ms_shared* ms_int_shared;
+static struct ms_conn* ms_int_conns;
+static const pid_t* ms_int_pids;
+static size_t ms_int_npids;
+
+/*
+** SIGINT handler during a run: mark the connections of this process, which are still
+** receiving, as interrupted and shut their sockets down, so that their threads end at
+** once, and pass the signal on to the worker processes. Only async-signal-safe calls.
+*/
+static void ms_interrupt(int sig)
+{
+    ms_int_shared->interrupted = 1;
+    for (struct ms_conn* c = ms_int_conns; c != NULL; c = c->prev) {
+        if (__atomic_load_n(&c->recv_done, __ATOMIC_ACQUIRE))
+            continue;
+        c->interrupted = 1;
+        int fd = __atomic_load_n(&c->fd_sock, __ATOMIC_ACQUIRE);
+        if (fd >= 0)
+            shutdown(fd, SHUT_RDWR);
+    }
+    for (size_t p = 0; p < ms_int_npids; ++p) {
+        if (ms_int_pids[p] > 0)
+            kill(ms_int_pids[p], sig);
+    }
+}
+
+/* Install ms_interrupt for the connections conns or the worker processes pids, old gets the previous action */
+static void ms_interrupt_install(struct ms_shared* shared, struct ms_conn* conns, const pid_t* pids, size_t npids,
+                                 struct sigaction* old)
+{
+    ms_int_shared = shared;
+    ms_int_conns = conns;
+    ms_int_pids = pids;
+    ms_int_npids = npids;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = ms_interrupt;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, old);
+}
+
+/*
+** Live progress of a run, printed to stderr every second by a thread of the main process.
+** It only reads the relaxed atomic counters of struct ms_live of every connection.
+*/
+struct ms_reporter {
+    struct ms_ticker ticker;
+    struct ms_shared* shared;
+    size_t nconns;
+    uint64_t expected;                  /* Responses expected in total, or 0 if unknown */
+    int tty;                            /* Redraw one line instead of printing a line per tick */
+    int printed;                        /* Number of lines printed */
+    struct timespec last;               /* Time of the previous tick */
+    uint64_t sent, received, responses; /* Totals at the previous tick */
+};
+
+static int ms_reporter_tick(struct ms_reporter* rep)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t sent = 0, received = 0, responses = 0;
+    size_t active = 0, finished = 0, failed = 0;
+    for (size_t i = 0; i < rep->nconns; ++i) {
+        struct ms_live* live = &rep->shared->results[i].live;
+        sent += __atomic_load_n(&live->sent, __ATOMIC_RELAXED);
+        received += __atomic_load_n(&live->received, __ATOMIC_RELAXED);
+        responses += __atomic_load_n(&live->responses, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&live->failed, __ATOMIC_RELAXED))
+            ++failed;
+        else if (__atomic_load_n(&live->done, __ATOMIC_RELAXED))
+            ++finished;
+        else if (__atomic_load_n(&live->connected, __ATOMIC_RELAXED))
+            ++active;
+    }
+    double dt = (double)(now.tv_sec - rep->last.tv_sec) + (now.tv_nsec - rep->last.tv_nsec) / 1.0e9;
+    /* The first tick only takes the totals, and rates over a short last one would be noisy */
+    if (rep->last.tv_sec != 0 && dt >= 0.1) {
+        double elapsed = (double)(now.tv_sec - rep->shared->start.tv_sec)
+            + (now.tv_nsec - rep->shared->start.tv_nsec) / 1.0e9;
+        double rps = (double)(responses - rep->responses) / dt;
+        char eta[64] = "";
+        if (rep->expected > responses && rps > 0)
+            snprintf(eta, sizeof eta, ", ETA %.0f s", (double)(rep->expected - responses) / rps);
+        fprintf(stderr, "%s%6.0f s: %10.0f req/s, %9.2f MB/s received, %9.2f MB/s sent, "
+            "%zu active, %zu finished, %zu failed%s%s", rep->tty ? "\r\033[K" : "", elapsed, rps,
+            (double)(received - rep->received) / dt / 1.0e6, (double)(sent - rep->sent) / dt / 1.0e6,
+            active, finished, failed, eta, rep->tty ? "" : "\n");
+        fflush(stderr);
+        ++rep->printed;
+    }
+    rep->last = now;
+    rep->sent = sent;
+    rep->received = received;
+    rep->responses = responses;
+    return 0;
+}
+
+/* Start reporting the progress of the nconns connections of shared every second. Returns 0 or an error number. */
+static int ms_reporter_start(struct ms_reporter* rep, struct ms_shared* shared, size_t nconns, uint64_t expected)
+{
+    memset(rep, 0, sizeof *rep);
+    rep->shared = shared;
+    rep->nconns = nconns;
+    rep->expected = expected;
+    rep->tty = isatty(STDERR_FILENO);
+    return ms_ticker_start(&rep->ticker, 1000000000, (int(*)(void*))ms_reporter_tick, rep);
+}
+
+/* Stop reporting and remove the redrawn line */
+static void ms_reporter_stop(struct ms_reporter* rep)
+{
+    ms_ticker_stop(&rep->ticker);
+    if (rep->tty && rep->printed > 0) {
+        fputs("\r\033[K", stderr);
+        fflush(stderr);
+    }
+    rep->printed = 0;
+}
+
+/*
+** Worker process of lcf_multi_sendfile: set up connections first..last-1, report
+** readiness, then run them and copy their results into the shared region. Never returns.
+*/
+static void ms_worker(struct ms_shared* shared, const struct ms_target* targets, size_t ntargets,
+                      size_t first, size_t last, const char* out_file_fmt, const struct ms_placement* placement,
+                      int use_shutdown, int ignore_out, struct ms_writer* writer)
+{
+    char errmsg[8192];
+    struct ms_conn* conns;
+    if (ms_create_range(&conns, errmsg, sizeof errmsg, targets, ntargets, first, last,
+                        out_file_fmt, shared, placement, use_shutdown, ignore_out, writer, NULL) < 0) {
+        if (__sync_bool_compare_and_swap(&shared->failed, 0, 1))
+            snprintf(shared->errmsg, sizeof shared->errmsg, "%s", errmsg);
+        sem_post(&shared->ready);
+        _exit(1);
+    }
+    ms_interrupt_install(shared, conns, NULL, 0, NULL);
+    /* Resource usage counts from here like in a single process, without the setup */
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    sem_post(&shared->ready);
+    struct ms_ticker conn_sampler;
+    memset(&conn_sampler, 0, sizeof conn_sampler);
+    if (shared->conn_interval_ns)
+        ms_ticker_start(&conn_sampler, shared->conn_interval_ns, (int(*)(void*))ms_conn_tick, conns);
+    ms_join_conns(conns, NULL, &conn_sampler);
+    ms_destroy_conns(conns, 0);
+    getrusage(RUSAGE_SELF, &after);
+    __atomic_add_fetch(&shared->workers_cpu_ns, ms_rusage_cpu_ns(&after) - ms_rusage_cpu_ns(&before), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shared->workers_vcsw, after.ru_nvcsw - before.ru_nvcsw, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shared->workers_ivcsw, after.ru_nivcsw - before.ru_nivcsw, __ATOMIC_RELAXED);
+    long maxrss = __atomic_load_n(&shared->workers_maxrss_kb, __ATOMIC_RELAXED);
+    while (after.ru_maxrss > maxrss && ! __atomic_compare_exchange_n(&shared->workers_maxrss_kb, &maxrss,
+                                                                      after.ru_maxrss, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    _exit(0);
+}
+
+/*
+** Wait until all worker processes have set up their connections. Reaped workers
+** get a pid of 0. Returns 0, or -1 with a message in msgbuf if a worker failed.
+*/
+static int ms_wait_workers(struct ms_shared* shared, pid_t* pids, size_t nworkers, char* msgbuf, size_t msglen)
+{
+    size_t ready = 0;
+    while (ready < nworkers) {
+        struct timespec timeout;
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_nsec += 100000000;
+        if (timeout.tv_nsec >= 1000000000) {
+            timeout.tv_nsec -= 1000000000;
+            ++timeout.tv_sec;
+        }
+        if (sem_timedwait(&shared->ready, &timeout) == 0) {
+            ++ready;
+            continue;
         }
-        conn->sender.created = 1;
-        err = pthread_create(&conn->receiver.thread, &attr, (void*(*)(void*))ms_receiver_thread, (void*)conn);
-        if (err != 0) {
-            snprintf(msgbuf, msglen, "Failed to start receiver thread #%zu: %s", i, strerror(err));
-            pthread_attr_destroy(&attr);
-            goto failed;
+        if (errno != ETIMEDOUT && errno != EINTR) {
+            snprintf(msgbuf, msglen, "sem_timedwait failed: %s", strerror(errno));
+            return -1;
+        }
+        /* A worker which exits without reporting readiness would block forever */
+        for (size_t p = 0; p < nworkers; ++p) {
+            int status;
+            if (pids[p] > 0 && waitpid(pids[p], &status, WNOHANG) == pids[p]) {
+                snprintf(msgbuf, msglen, "Worker process %d exited during setup", (int)pids[p]);
+                pids[p] = 0;
+                return -1;
+            }
+        }
+    }
+    if (shared->failed) {
+        snprintf(msgbuf, msglen, "%s", shared->errmsg);
+        return -1;
+    }
+    return 0;
+}
+
+/* Resources of the server processes at one point in time, summed over all processes */
+struct ms_server_sample {
+    struct timespec time;               /* CLOCK_MONOTONIC, like the connection timestamps */
+    uint32_t processes;                 /* Processes which still existed */
+    uint64_t cpu_ns;                    /* User plus system CPU time */
+    uint64_t rss_kb;                    /* Resident set size */
+    uint64_t threads;
+    uint64_t vcsw, ivcsw;               /* Voluntary and involuntary context switches of all threads */
+    uint64_t run_ns, wait_ns;           /* Time running and runnable but waiting for a CPU (schedstat) */
+    int64_t fds;                        /* Open file descriptors, or -1 if not readable */
+    int64_t read_bytes, write_bytes;    /* Storage I/O from /proc/PID/io, or -1 if not readable */
+};
+
+/* Cumulative counters of one server thread */
+struct ms_task_stat {
+    pid_t pid, tid;
+    uint64_t run_ns, wait_ns;
+    uint64_t vcsw, ivcsw;
+    uint64_t run0_ns, wait0_ns;         /* Values when the run started, or 0 if it started later */
+    int started;                        /* Thread started during the run */
+    char comm[16];                      /* Thread name, only read with threads */
+};
+
+/*
+** Server thread seen in socket I/O on a client connection, or server process which has
+** the socket of a client connection open
+*/
+struct ms_serve {
+    int io;                             /* 1 for a thread in I/O, 0 for an open socket of process tid */
+    pid_t tid;
+    uint64_t inode;                     /* Socket inode */
+    uint32_t port;                      /* Remote port of the socket, which is the local port of the client */
+    uint32_t samples;                   /* Number of samples, after merging */
+    size_t first, last;                 /* Indexes of first and last sample, after merging */
+};
+
+/*
+** Sampling of the server processes by lcf_multi_sendfile from the start of the run until
+** all connections have finished.
+** Counters of threads are only available while they exist, so the last values of threads
+** which have ended are kept in gone to avoid that sums decrease.
+*/
+struct ms_sampler {
+    struct ms_ticker ticker;
+    const pid_t* pids;
+    size_t npids;
+    uint64_t* pid_cpu_ns;               /* Last CPU time of each process, kept after it exits */
+    uint64_t tick_ns;                   /* Length of a clock tick of /proc/PID/stat */
+    uint64_t page_kb;
+    struct ms_server_sample* samples;
+    size_t nsamples, cap;
+    struct ms_task_stat* tasks;         /* Threads of the last sample, sorted by tid */
+    size_t ntasks, tasks_cap;
+    struct ms_task_stat* cur;           /* Threads of the current sample */
+    size_t ncur, cur_cap;
+    struct ms_task_stat gone;           /* Sums of the last values of ended threads */
+    int threads;                        /* Also keep threads and which connections they served */
+    struct ms_task_stat* ended;         /* Ended threads, only with threads */
+    size_t nended, ended_cap;
+    struct ms_serve* serves;            /* Observations of threads in socket I/O, only with threads */
+    size_t nserves, serves_cap;
+    char errmsg[256];                   /* Reason why sampling stopped early, or empty */
+};
+
+/* Read small file into zero-terminated buf. Returns length or -1. */
+static ssize_t ms_read_proc(const char* path, char* buf, size_t len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    size_t have = 0;
+    while (have < len - 1) {
+        ssize_t rlen = read(fd, buf + have, len - 1 - have);
+        if (rlen <= 0)
+            break;
+        have += (size_t)rlen;
+    }
+    close(fd);
+    buf[have] = '\0';
+    return (ssize_t)have;
+}
+
+/* Value of a "key: value" line of a /proc status-like file, or 0 */
+static uint64_t ms_proc_field(const char* text, const char* key)
+{
+    size_t keylen = strlen(key);
+    const char* p = text;
+    while (p != NULL) {
+        if (strncmp(p, key, keylen) == 0 && p[keylen] == ':')
+            return strtoull(p + keylen + 1, NULL, 10);
+        p = strchr(p, '\n');
+        if (p != NULL)
+            ++p;
+    }
+    return 0;
+}
+
+/* Whether the first argument of a system call is a file descriptor which may be a socket */
+static int ms_socket_syscall(long nr)
+{
+    switch (nr) {
+    case SYS_read: case SYS_write: case SYS_readv: case SYS_writev: case SYS_sendfile:
+    case SYS_recvfrom: case SYS_sendto: case SYS_recvmsg: case SYS_sendmsg:
+#ifdef SYS_recv
+    case SYS_recv: case SYS_send:
+#endif
+        return 1;
+    }
+    return 0;
+}
+
+/*
+** Note that thread tid of process pid is in a system call on fd (io), or that the process has
+** fd open (tid is pid), if fd is a socket. Returns 0, or -1 with errmsg set.
+*/
+static int ms_sampler_observe(struct ms_sampler* s, pid_t pid, pid_t tid, const char* fd, int io)
+{
+    char path[300], link[64];
+    snprintf(path, sizeof path, "/proc/%d/fd/%s", (int)pid, fd);
+    ssize_t len = readlink(path, link, sizeof link - 1);
+    if (len <= 0)
+        return 0;
+    link[len] = '\0';
+    unsigned long long inode;
+    if (sscanf(link, "socket:[%llu]", &inode) != 1)
+        return 0;
+    if (s->nserves == s->serves_cap) {
+        size_t cap = s->serves_cap ? s->serves_cap * 2 : 256;
+        struct ms_serve* serves = realloc(s->serves, cap * sizeof *serves);
+        if (serves == NULL) {
+            snprintf(s->errmsg, sizeof s->errmsg, "Out of memory after %zu thread observations", s->nserves);
+            return -1;
+        }
+        s->serves = serves;
+        s->serves_cap = cap;
+    }
+    struct ms_serve* serve = &s->serves[s->nserves++];
+    serve->io = io;
+    serve->tid = tid;
+    serve->inode = inode;
+    serve->port = 0;
+    serve->samples = 1;
+    serve->first = serve->last = s->nsamples;
+    return 0;
+}
+
+static int ms_serve_compare_inode(const void* a, const void* b)
+{
+    uint64_t ia = ((const struct ms_serve*)a)->inode, ib = ((const struct ms_serve*)b)->inode;
+    return (ia > ib) - (ia < ib);
+}
+
+/*
+** Find the remote ports of the sockets observed since first in the TCP tables of the server's
+** network namespace, and drop observations of other sockets.
+*/
+static void ms_sampler_resolve(struct ms_sampler* s, size_t first)
+{
+    struct ms_serve* obs = s->serves + first;
+    size_t nobs = s->nserves - first;
+    if (nobs == 0)
+        return;
+    qsort(obs, nobs, sizeof *obs, ms_serve_compare_inode);
+    static const char* const tables[] = { "tcp", "tcp6" };
+    for (size_t t = 0; t < sizeof tables / sizeof *tables; ++t) {
+        char path[64], line[512];
+        snprintf(path, sizeof path, "/proc/%d/net/%s", (int)s->pids[0], tables[t]);
+        FILE* f = fopen(path, "r");
+        if (f == NULL)
+            continue;
+        while (fgets(line, sizeof line, f) != NULL) {
+            unsigned port;
+            unsigned long long inode;
+            if (sscanf(line, " %*d: %*[0-9A-Fa-f]:%*x %*[0-9A-Fa-f]:%x %*x %*x:%*x %*x:%*x %*x %*u %*d %llu",
+                       &port, &inode) != 2 || port == 0)
+                continue;
+            struct ms_serve key;
+            key.inode = inode;
+            struct ms_serve* found = bsearch(&key, obs, nobs, sizeof *obs, ms_serve_compare_inode);
+            if (found == NULL)
+                continue;
+            while (found > obs && found[-1].inode == inode)
+                --found;
+            for (; found < obs + nobs && found->inode == inode; ++found)
+                found->port = port;
+        }
+        fclose(f);
+    }
+    size_t kept = first;
+    for (size_t k = first; k < s->nserves; ++k) {
+        if (s->serves[k].port != 0)
+            s->serves[kept++] = s->serves[k];
+    }
+    s->nserves = kept;
+}
+
+/*
+** Add the state of one server process to sample and its threads to s->cur.
+** Returns 0, or -1 if it does not exist anymore or memory ran out (with errmsg set).
+*/
+static int ms_sample_process(struct ms_sampler* s, pid_t pid, struct ms_server_sample* sample)
+{
+    char path[64], buf[4096];
+    /* Fields after the command name, which may contain spaces and parentheses */
+    snprintf(path, sizeof path, "/proc/%d/stat", (int)pid);
+    if (ms_read_proc(path, buf, sizeof buf) < 0)
+        return -1;
+    const char* p = strrchr(buf, ')');
+    unsigned long long utime, stime, threads, rss;
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %llu %*d %*u %*u %llu",
+                            &utime, &stime, &threads, &rss) != 4)
+        return -1;
+    sample->cpu_ns += (utime + stime) * s->tick_ns;
+    sample->threads += threads;
+    sample->rss_kb += rss * s->page_kb;
+    /* Scheduler statistics and context switches per thread */
+    snprintf(path, sizeof path, "/proc/%d/task", (int)pid);
+    DIR* dir = opendir(path);
+    if (dir != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.')
+                continue;
+            if (s->ncur == s->cur_cap) {
+                size_t cap = s->cur_cap ? s->cur_cap * 2 : 64;
+                struct ms_task_stat* cur = realloc(s->cur, cap * sizeof *cur);
+                if (cur == NULL) {
+                    snprintf(s->errmsg, sizeof s->errmsg, "Out of memory for %zu server threads", s->ncur);
+                    closedir(dir);
+                    return -1;
+                }
+                s->cur = cur;
+                s->cur_cap = cap;
+            }
+            struct ms_task_stat* task = &s->cur[s->ncur];
+            memset(task, 0, sizeof *task);
+            task->pid = pid;
+            task->tid = (pid_t)atoi(entry->d_name);
+            char task_path[300];
+            unsigned long long run_ns, wait_ns;
+            snprintf(task_path, sizeof task_path, "/proc/%d/task/%s/schedstat", (int)pid, entry->d_name);
+            if (ms_read_proc(task_path, buf, sizeof buf) > 0 && sscanf(buf, "%llu %llu", &run_ns, &wait_ns) == 2) {
+                task->run_ns = run_ns;
+                task->wait_ns = wait_ns;
+            }
+            snprintf(task_path, sizeof task_path, "/proc/%d/task/%s/status", (int)pid, entry->d_name);
+            if (ms_read_proc(task_path, buf, sizeof buf) > 0) {
+                task->vcsw = ms_proc_field(buf, "voluntary_ctxt_switches");
+                task->ivcsw = ms_proc_field(buf, "nonvoluntary_ctxt_switches");
+            }
+            /* Socket the thread is reading or writing right now */
+            snprintf(task_path, sizeof task_path, "/proc/%d/task/%s/syscall", (int)pid, entry->d_name);
+            long nr;
+            unsigned long long fd;
+            char fd_name[32];
+            if (s->threads && ms_read_proc(task_path, buf, sizeof buf) > 0
+                    && sscanf(buf, "%ld %llx", &nr, &fd) == 2 && ms_socket_syscall(nr)) {
+                snprintf(fd_name, sizeof fd_name, "%llu", fd);
+                if (ms_sampler_observe(s, pid, task->tid, fd_name, 1) < 0) {
+                    closedir(dir);
+                    return -1;
+                }
+            }
+            ++s->ncur;
+        }
+        closedir(dir);
+    }
+    /* Open file descriptors and storage I/O, which need permission to trace the process */
+    snprintf(path, sizeof path, "/proc/%d/fd", (int)pid);
+    dir = opendir(path);
+    if (dir == NULL) {
+        sample->fds = -1;
+    } else {
+        struct dirent* entry;
+        int64_t fds = 0;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.')
+                continue;
+            ++fds;
+            if (s->threads && ms_sampler_observe(s, pid, pid, entry->d_name, 0) < 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+        if (sample->fds >= 0)
+            sample->fds += fds;
+    }
+    snprintf(path, sizeof path, "/proc/%d/io", (int)pid);
+    if (ms_read_proc(path, buf, sizeof buf) <= 0) {
+        sample->read_bytes = sample->write_bytes = -1;
+    } else if (sample->read_bytes >= 0) {
+        sample->read_bytes += (int64_t)ms_proc_field(buf, "read_bytes");
+        sample->write_bytes += (int64_t)ms_proc_field(buf, "write_bytes");
+    }
+    return 0;
+}
+
+static int ms_task_compare(const void* a, const void* b)
+{
+    pid_t ta = ((const struct ms_task_stat*)a)->tid, tb = ((const struct ms_task_stat*)b)->tid;
+    return (ta > tb) - (ta < tb);
+}
+
+/* Append a sample of all server processes. Returns 0, or -1 with errmsg set. */
+static int ms_sampler_take(struct ms_sampler* s)
+{
+    if (s->nsamples == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 256;
+        struct ms_server_sample* samples = realloc(s->samples, cap * sizeof *samples);
+        if (samples == NULL) {
+            snprintf(s->errmsg, sizeof s->errmsg, "Out of memory after %zu samples", s->nsamples);
+            return -1;
+        }
+        s->samples = samples;
+        s->cap = cap;
+    }
+    struct ms_server_sample* sample = &s->samples[s->nsamples];
+    memset(sample, 0, sizeof *sample);
+    clock_gettime(CLOCK_MONOTONIC, &sample->time);
+    s->ncur = 0;
+    size_t first_serve = s->nserves;
+    for (size_t k = 0; k < s->npids; ++k) {
+        uint64_t cpu_ns = sample->cpu_ns;
+        if (ms_sample_process(s, s->pids[k], sample) == 0) {
+            ++sample->processes;
+            s->pid_cpu_ns[k] = sample->cpu_ns - cpu_ns;
+        } else if (s->errmsg[0] != '\0') {
+            return -1;
+        } else {
+            /* An exited process keeps counting with its CPU time until then */
+            sample->cpu_ns = cpu_ns + s->pid_cpu_ns[k];
+        }
+    }
+    ms_sampler_resolve(s, first_serve);
+    /* Threads of the last sample which are missing now have ended, new ones have started */
+    qsort(s->cur, s->ncur, sizeof *s->cur, ms_task_compare);
+    size_t i = 0, j = 0;
+    while (i < s->ntasks || j < s->ncur) {
+        if (j == s->ncur || (i < s->ntasks && s->tasks[i].tid < s->cur[j].tid)) {
+            const struct ms_task_stat* old = &s->tasks[i++];
+            s->gone.run_ns += old->run_ns;
+            s->gone.wait_ns += old->wait_ns;
+            s->gone.vcsw += old->vcsw;
+            s->gone.ivcsw += old->ivcsw;
+            if (! s->threads)
+                continue;
+            if (s->nended == s->ended_cap) {
+                size_t cap = s->ended_cap ? s->ended_cap * 2 : 64;
+                struct ms_task_stat* ended = realloc(s->ended, cap * sizeof *ended);
+                if (ended == NULL) {
+                    snprintf(s->errmsg, sizeof s->errmsg, "Out of memory for %zu ended server threads", s->nended);
+                    return -1;
+                }
+                s->ended = ended;
+                s->ended_cap = cap;
+            }
+            s->ended[s->nended++] = *old;
+        } else if (i == s->ntasks || s->cur[j].tid < s->tasks[i].tid) {
+            struct ms_task_stat* task = &s->cur[j++];
+            if (s->nsamples == 0) {
+                task->run0_ns = task->run_ns;
+                task->wait0_ns = task->wait_ns;
+            } else {
+                task->started = 1;
+            }
+            if (s->threads) {
+                char path[64];
+                snprintf(path, sizeof path, "/proc/%d/task/%d/comm", (int)task->pid, (int)task->tid);
+                if (ms_read_proc(path, task->comm, sizeof task->comm) > 0)
+                    task->comm[strcspn(task->comm, "\n")] = '\0';
+            }
+        } else {
+            struct ms_task_stat* task = &s->cur[j++];
+            const struct ms_task_stat* old = &s->tasks[i++];
+            task->run0_ns = old->run0_ns;
+            task->wait0_ns = old->wait0_ns;
+            task->started = old->started;
+            memcpy(task->comm, old->comm, sizeof task->comm);
+        }
+    }
+    sample->run_ns = s->gone.run_ns;
+    sample->wait_ns = s->gone.wait_ns;
+    sample->vcsw = s->gone.vcsw;
+    sample->ivcsw = s->gone.ivcsw;
+    for (size_t k = 0; k < s->ncur; ++k) {
+        sample->run_ns += s->cur[k].run_ns;
+        sample->wait_ns += s->cur[k].wait_ns;
+        sample->vcsw += s->cur[k].vcsw;
+        sample->ivcsw += s->cur[k].ivcsw;
+    }
+    /* Swap buffers, the current threads become the last ones */
+    struct ms_task_stat* tasks = s->tasks;
+    size_t tasks_cap = s->tasks_cap;
+    s->tasks = s->cur;
+    s->ntasks = s->ncur;
+    s->tasks_cap = s->cur_cap;
+    s->cur = tasks;
+    s->cur_cap = tasks_cap;
+    ++s->nsamples;
+    return 0;
+}
+
+/* Start sampling pids every interval_ms. If that fails, the run goes on without samples. */
+static void ms_sampler_start(struct ms_sampler* s, const pid_t* pids, size_t npids, lua_Integer interval_ms,
+                             int threads)
+{
+    memset(s, 0, sizeof *s);
+    s->pids = pids;
+    s->npids = npids;
+    s->threads = threads;
+    s->tick_ns = 1000000000 / (uint64_t)sysconf(_SC_CLK_TCK);
+    s->page_kb = (uint64_t)sysconf(_SC_PAGESIZE) / 1024;
+    if ((s->pid_cpu_ns = calloc(npids, sizeof *s->pid_cpu_ns)) == NULL) {
+        snprintf(s->errmsg, sizeof s->errmsg, "Out of memory");
+        return;
+    }
+    int err = ms_ticker_start(&s->ticker, (uint64_t)interval_ms * 1000000, (int(*)(void*))ms_sampler_take, s);
+    if (err)
+        snprintf(s->errmsg, sizeof s->errmsg, "Cannot create sampler thread: %s", strerror(err));
+}
+
+static int ms_serve_compare_tid(const void* a, const void* b)
+{
+    const struct ms_serve* sa = a;
+    const struct ms_serve* sb = b;
+    if (sa->io != sb->io)
+        return sa->io - sb->io;
+    if (sa->tid != sb->tid)
+        return (sa->tid > sb->tid) - (sa->tid < sb->tid);
+    return (sa->port > sb->port) - (sa->port < sb->port);
+}
+
+/* Merge observations into one per thread or process and port */
+static void ms_sampler_merge(struct ms_sampler* s)
+{
+    /* A failed sample may have left some without sample */
+    if (s->nsamples == 0)
+        s->nserves = 0;
+    qsort(s->serves, s->nserves, sizeof *s->serves, ms_serve_compare_tid);
+    size_t nmerged = 0;
+    for (size_t k = 0; k < s->nserves; ++k) {
+        struct ms_serve* prev = nmerged > 0 ? &s->serves[nmerged - 1] : NULL;
+        if (prev != NULL && prev->io == s->serves[k].io && prev->tid == s->serves[k].tid
+                && prev->port == s->serves[k].port) {
+            ++prev->samples;
+            prev->first = s->serves[k].first < prev->first ? s->serves[k].first : prev->first;
+            prev->last = s->serves[k].last > prev->last ? s->serves[k].last : prev->last;
+        } else {
+            s->serves[nmerged++] = s->serves[k];
+        }
+    }
+    s->nserves = nmerged;
+}
+
+/* Push a table with the number of samples of a merged observation and the times of the first and last */
+static void ms_push_span(lua_State* L, const struct ms_sampler* s, const struct ms_serve* serve)
+{
+    const struct timespec* first = &s->samples[serve->first < s->nsamples ? serve->first : s->nsamples - 1].time;
+    const struct timespec* last = &s->samples[serve->last < s->nsamples ? serve->last : s->nsamples - 1].time;
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, serve->samples);
+    lua_setfield(L, -2, "samples");
+    lua_pushnumber(L, (first->tv_sec * 1.0e9 + first->tv_nsec));
+    lua_setfield(L, -2, "first_ns");
+    lua_pushnumber(L, (last->tv_sec * 1.0e9 + last->tv_nsec));
+    lua_setfield(L, -2, "last_ns");
+}
+
+/* Push the threads of the server with the connections they served, see lcf_multi_sendfile */
+static void ms_push_threads(lua_State* L, const struct ms_sampler* s)
+{
+    lua_createtable(L, (int)(s->nended + s->ntasks), 0);
+    for (size_t k = 0; k < s->nended + s->ntasks; ++k) {
+        const struct ms_task_stat* task = k < s->nended ? &s->ended[k] : &s->tasks[k - s->nended];
+        lua_createtable(L, 0, 6);
+        lua_pushinteger(L, task->pid);
+        lua_setfield(L, -2, "pid");
+        lua_pushinteger(L, task->tid);
+        lua_setfield(L, -2, "tid");
+        lua_pushstring(L, task->comm);
+        lua_setfield(L, -2, "name");
+        lua_pushinteger(L, (lua_Integer)(task->run_ns - task->run0_ns));
+        lua_setfield(L, -2, "run_ns");
+        lua_pushinteger(L, (lua_Integer)(task->wait_ns - task->wait0_ns));
+        lua_setfield(L, -2, "wait_ns");
+        lua_pushboolean(L, task->started);
+        lua_setfield(L, -2, "started");
+        lua_newtable(L);
+        struct ms_serve key;
+        key.io = 1;
+        key.tid = task->tid;
+        key.port = 0;
+        size_t lo = 0, hi = s->nserves;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (ms_serve_compare_tid(&s->serves[mid], &key) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (; lo < s->nserves && s->serves[lo].io == 1 && s->serves[lo].tid == task->tid; ++lo) {
+            ms_push_span(L, s, &s->serves[lo]);
+            lua_rawseti(L, -2, s->serves[lo].port);
+        }
+        lua_setfield(L, -2, "ports");
+        lua_rawseti(L, -2, k + 1);
+    }
+}
+
+/*
+** Push the client connection sockets the server processes had open, by port, see lcf_multi_sendfile.
+** A socket open in several processes, e.g. while a forking server hands it over, is attributed to
+** the process which had it open longest.
+*/
+static void ms_push_sockets(lua_State* L, const struct ms_sampler* s)
+{
+    lua_newtable(L);
+    for (size_t k = 0; k < s->nserves && s->serves[k].io == 0; ++k) {
+        const struct ms_serve* serve = &s->serves[k];
+        if (lua_rawgeti(L, -1, serve->port) == LUA_TTABLE) {
+            lua_getfield(L, -1, "samples");
+            lua_Integer samples = lua_tointeger(L, -1);
+            lua_pop(L, 2);
+            if ((lua_Integer)serve->samples <= samples)
+                continue;
+        } else {
+            lua_pop(L, 1);
+        }
+        ms_push_span(L, s, serve);
+        lua_pushinteger(L, serve->tid);
+        lua_setfield(L, -2, "pid");
+        lua_rawseti(L, -2, serve->port);
+    }
+}
+
+/* Push the samples onto the stack and free them, see lcf_multi_sendfile */
+static void ms_push_server(lua_State* L, struct ms_sampler* s)
+{
+    lua_createtable(L, 0, 3);
+    lua_createtable(L, (int)s->npids, 0);
+    for (size_t k = 0; k < s->npids; ++k) {
+        lua_pushinteger(L, s->pids[k]);
+        lua_rawseti(L, -2, k + 1);
+    }
+    lua_setfield(L, -2, "pids");
+    lua_createtable(L, (int)s->nsamples, 0);
+    for (size_t i = 0; i < s->nsamples; ++i) {
+        const struct ms_server_sample* sample = &s->samples[i];
+        lua_createtable(L, 0, 12);
+        lua_pushnumber(L, (sample->time.tv_sec * 1.0e9 + sample->time.tv_nsec));
+        lua_setfield(L, -2, "time_ns");
+        lua_pushinteger(L, sample->processes);
+        lua_setfield(L, -2, "processes");
+        lua_pushinteger(L, (lua_Integer)sample->cpu_ns);
+        lua_setfield(L, -2, "cpu_ns");
+        lua_pushinteger(L, (lua_Integer)sample->rss_kb);
+        lua_setfield(L, -2, "rss_kb");
+        lua_pushinteger(L, (lua_Integer)sample->threads);
+        lua_setfield(L, -2, "threads");
+        lua_pushinteger(L, (lua_Integer)sample->vcsw);
+        lua_setfield(L, -2, "vcsw");
+        lua_pushinteger(L, (lua_Integer)sample->ivcsw);
+        lua_setfield(L, -2, "ivcsw");
+        lua_pushinteger(L, (lua_Integer)sample->run_ns);
+        lua_setfield(L, -2, "run_ns");
+        lua_pushinteger(L, (lua_Integer)sample->wait_ns);
+        lua_setfield(L, -2, "wait_ns");
+        if (sample->fds >= 0) {
+            lua_pushinteger(L, sample->fds);
+            lua_setfield(L, -2, "fds");
+        }
+        if (sample->read_bytes >= 0) {
+            lua_pushinteger(L, sample->read_bytes);
+            lua_setfield(L, -2, "read_bytes");
+            lua_pushinteger(L, sample->write_bytes);
+            lua_setfield(L, -2, "write_bytes");
+        }
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "samples");
+    if (s->threads) {
+        ms_sampler_merge(s);
+        ms_push_threads(L, s);
+        lua_setfield(L, -2, "threads");
+        ms_push_sockets(L, s);
+        lua_setfield(L, -2, "sockets");
+    }
+    if (s->errmsg[0] != '\0') {
+        lua_pushstring(L, s->errmsg);
+        lua_setfield(L, -2, "error");
+    }
+    free(s->samples);
+    free(s->pid_cpu_ns);
+    free(s->tasks);
+    free(s->cur);
+    free(s->ended);
+    free(s->serves);
+    s->pid_cpu_ns = NULL;
+    s->samples = NULL;
+    s->tasks = s->cur = s->ended = NULL;
+    s->serves = NULL;
+}
+
+/*
+** Accept queues of the listening sockets of a server on this host, sampled with sock_diag
+** from the start of the run until all connections have finished, together with the
+** counters ListenOverflows and ListenDrops of /proc/net/netstat. These count for all
+** listening sockets in the network namespace.
+*/
+struct ms_listen_sample {
+    struct timespec time;
+    uint32_t queue;                     /* Connections waiting for accept(), summed over the sockets */
+    uint32_t sockets;                   /* Number of listening sockets found on the ports */
+    uint64_t overflows, drops;
+};
+
+struct ms_listen {
+    struct ms_ticker ticker;
+    const uint16_t* ports;
+    size_t nports;
+    int fd;                             /* NETLINK_SOCK_DIAG socket, or -1 */
+    uint32_t backlog;                   /* Largest backlog of the listening sockets */
+    struct ms_listen_sample* samples;
+    size_t nsamples, cap;
+    char errmsg[256];                   /* Set if sampling failed */
+};
+
+/* Read ListenOverflows and ListenDrops of /proc/net/netstat. Returns 0, or -1 if not available. */
+static int ms_listen_counters(uint64_t* overflows, uint64_t* drops)
+{
+    char buf[16384];
+    if (ms_read_proc("/proc/net/netstat", buf, sizeof buf) <= 0)
+        return -1;
+    /* A line with the names of the TcpExt counters is followed by one with their values */
+    char* names = strstr(buf, "TcpExt:");
+    char* nl = names != NULL ? strchr(names, '\n') : NULL;
+    if (nl == NULL || strncmp(nl + 1, "TcpExt:", 7) != 0)
+        return -1;
+    *nl = '\0';
+    char* values = nl + 1;
+    if ((nl = strchr(values, '\n')) != NULL)
+        *nl = '\0';
+    char *name_pos, *value_pos;
+    char* name = strtok_r(names + 7, " ", &name_pos);
+    char* value = strtok_r(values + 7, " ", &value_pos);
+    int found = 0;
+    while (name != NULL && value != NULL) {
+        if (strcmp(name, "ListenOverflows") == 0) {
+            *overflows = strtoull(value, NULL, 10);
+            found |= 1;
+        } else if (strcmp(name, "ListenDrops") == 0) {
+            *drops = strtoull(value, NULL, 10);
+            found |= 2;
+        }
+        name = strtok_r(NULL, " ", &name_pos);
+        value = strtok_r(NULL, " ", &value_pos);
+    }
+    return found == 3 ? 0 : -1;
+}
+
+/*
+** Add the accept queues of the listening TCP sockets of family on the ports of l to sample.
+** Returns 0, or -1 on errors.
+*/
+static int ms_listen_dump(struct ms_listen* l, int family, struct ms_listen_sample* sample)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct inet_diag_req_v2 req;
+    } msg;
+    memset(&msg, 0, sizeof msg);
+    msg.nlh.nlmsg_len = sizeof msg;
+    msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    msg.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    msg.req.sdiag_family = (uint8_t)family;
+    msg.req.sdiag_protocol = IPPROTO_TCP;
+    msg.req.idiag_states = 1 << TCP_LISTEN;
+    if (send(l->fd, &msg, sizeof msg, 0) < 0)
+        return -1;
+    long buf[4096];
+    for (;;) {
+        ssize_t len = recv(l->fd, buf, sizeof buf, 0);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return -1;
+        for (struct nlmsghdr* h = (struct nlmsghdr*)buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+            if (h->nlmsg_type == NLMSG_DONE)
+                return 0;
+            if (h->nlmsg_type == NLMSG_ERROR)
+                return -1;
+            const struct inet_diag_msg* d = NLMSG_DATA(h);
+            uint16_t port = ntohs(d->id.idiag_sport);
+            for (size_t k = 0; k < l->nports; ++k) {
+                if (l->ports[k] == port) {
+                    sample->queue += d->idiag_rqueue;
+                    sample->sockets++;
+                    if (d->idiag_wqueue > l->backlog)
+                        l->backlog = d->idiag_wqueue;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/* Take one sample. Returns 0, or -1 if sampling should stop. */
+static int ms_listen_take(struct ms_listen* l)
+{
+    if (l->nsamples == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 256;
+        struct ms_listen_sample* samples = realloc(l->samples, cap * sizeof *samples);
+        if (samples == NULL) {
+            snprintf(l->errmsg, sizeof l->errmsg, "Out of memory");
+            return -1;
+        }
+        l->samples = samples;
+        l->cap = cap;
+    }
+    struct ms_listen_sample* sample = &l->samples[l->nsamples];
+    memset(sample, 0, sizeof *sample);
+    clock_gettime(CLOCK_MONOTONIC, &sample->time);
+    if (l->fd >= 0 && (ms_listen_dump(l, AF_INET, sample) < 0 || ms_listen_dump(l, AF_INET6, sample) < 0)) {
+        snprintf(l->errmsg, sizeof l->errmsg, "sock_diag failed: %s", strerror(errno));
+        return -1;
+    }
+    if (ms_listen_counters(&sample->overflows, &sample->drops) < 0) {
+        snprintf(l->errmsg, sizeof l->errmsg, "Cannot read ListenOverflows and ListenDrops of /proc/net/netstat");
+        return -1;
+    }
+    l->nsamples++;
+    return 0;
+}
+
+/* Start sampling the listening sockets on ports. Failures are recorded in errmsg. */
+static void ms_listen_start(struct ms_listen* l, const uint16_t* ports, size_t nports, lua_Integer interval_ms)
+{
+    memset(l, 0, sizeof *l);
+    l->ports = ports;
+    l->nports = nports;
+    l->fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (l->fd < 0)
+        snprintf(l->errmsg, sizeof l->errmsg, "Cannot create sock_diag socket: %s", strerror(errno));
+    int err = ms_ticker_start(&l->ticker, (uint64_t)interval_ms * 1000000, (int(*)(void*))ms_listen_take, l);
+    if (err)
+        snprintf(l->errmsg, sizeof l->errmsg, "Cannot create sampler thread: %s", strerror(err));
+}
+
+/* Take the last sample and release everything but the samples */
+static void ms_listen_stop(struct ms_listen* l)
+{
+    ms_ticker_stop(&l->ticker);
+    if (l->fd >= 0)
+        close(l->fd);
+    l->fd = -1;
+}
+
+/* Push the listening sockets and their samples onto the stack, see lcf_multi_sendfile */
+static void ms_push_listen(lua_State* L, const struct ms_listen* l)
+{
+    lua_createtable(L, 0, 4);
+    lua_createtable(L, (int)l->nports, 0);
+    for (size_t k = 0; k < l->nports; ++k) {
+        lua_pushinteger(L, l->ports[k]);
+        lua_rawseti(L, -2, k + 1);
+    }
+    lua_setfield(L, -2, "ports");
+    lua_pushinteger(L, l->backlog);
+    lua_setfield(L, -2, "backlog");
+    lua_createtable(L, (int)l->nsamples, 0);
+    for (size_t i = 0; i < l->nsamples; ++i) {
+        const struct ms_listen_sample* sample = &l->samples[i];
+        lua_createtable(L, 0, 5);
+        lua_pushnumber(L, (sample->time.tv_sec * 1.0e9 + sample->time.tv_nsec));
+        lua_setfield(L, -2, "time_ns");
+        lua_pushinteger(L, sample->queue);
+        lua_setfield(L, -2, "queue");
+        lua_pushinteger(L, sample->sockets);
+        lua_setfield(L, -2, "sockets");
+        lua_pushinteger(L, (lua_Integer)sample->overflows);
+        lua_setfield(L, -2, "overflows");
+        lua_pushinteger(L, (lua_Integer)sample->drops);
+        lua_setfield(L, -2, "drops");
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "samples");
+    if (l->errmsg[0] != '\0') {
+        lua_pushstring(L, l->errmsg);
+        lua_setfield(L, -2, "error");
+    }
+}
+
+/*
+** Push resource usage of the client between before and after onto the stack, summed over
+** this process and the usage its worker processes reported after their setup, see
+** lcf_multi_sendfile
+*/
+static void ms_push_usage(lua_State* L, const struct rusage* before, const struct rusage* after,
+                          const struct ms_shared* shared, lua_Integer procs)
+{
+    lua_createtable(L, 0, 5);
+    uint64_t cpu_ns = ms_rusage_cpu_ns(after) - ms_rusage_cpu_ns(before) + shared->workers_cpu_ns;
+    long vcsw = after->ru_nvcsw - before->ru_nvcsw + shared->workers_vcsw;
+    long ivcsw = after->ru_nivcsw - before->ru_nivcsw + shared->workers_ivcsw;
+    lua_pushinteger(L, (lua_Integer)cpu_ns);
+    lua_setfield(L, -2, "cpu_ns");
+    lua_pushinteger(L, vcsw);
+    lua_setfield(L, -2, "vcsw");
+    lua_pushinteger(L, ivcsw);
+    lua_setfield(L, -2, "ivcsw");
+    lua_pushinteger(L, after->ru_maxrss > shared->workers_maxrss_kb ? after->ru_maxrss : shared->workers_maxrss_kb);
+    lua_setfield(L, -2, "maxrss_kb");
+    lua_pushinteger(L, procs);
+    lua_setfield(L, -2, "processes");
+}
+
+/* Push the TCP_INFO statistics of a connection as table */
+static void ms_push_tcp(lua_State* L, const struct ms_tcp_stats* tcp)
+{
+    const struct ms_tcp_info* t = &tcp->last;
+    lua_createtable(L, 0, 16);
+    lua_pushinteger(L, tcp->samples);
+    lua_setfield(L, -2, "samples");
+    lua_pushinteger(L, tcp->rtt_sum_us / tcp->samples);
+    lua_setfield(L, -2, "rtt_avg_us");
+    lua_pushinteger(L, tcp->rtt_max_us);
+    lua_setfield(L, -2, "rtt_max_us");
+    lua_pushinteger(L, tcp->cwnd_max);
+    lua_setfield(L, -2, "cwnd_max");
+    if (tcp->info_len == 0)
+        return;
+    lua_pushinteger(L, t->base.tcpi_rtt);
+    lua_setfield(L, -2, "rtt_us");
+    lua_pushinteger(L, t->base.tcpi_rttvar);
+    lua_setfield(L, -2, "rttvar_us");
+    lua_pushinteger(L, t->base.tcpi_rcv_rtt);
+    lua_setfield(L, -2, "rcv_rtt_us");
+    lua_pushinteger(L, t->base.tcpi_total_retrans);
+    lua_setfield(L, -2, "retrans");
+    lua_pushinteger(L, t->base.tcpi_lost);
+    lua_setfield(L, -2, "lost");
+    lua_pushinteger(L, t->base.tcpi_snd_cwnd);
+    lua_setfield(L, -2, "cwnd");
+    lua_pushinteger(L, t->base.tcpi_snd_mss);
+    lua_setfield(L, -2, "mss");
+    if (MS_TCP_HAS(tcp->info_len, min_rtt)) {
+        lua_pushinteger(L, t->min_rtt);
+        lua_setfield(L, -2, "min_rtt_us");
+    }
+    if (MS_TCP_HAS(tcp->info_len, delivery_rate)) {
+        lua_pushinteger(L, t->delivery_rate);
+        lua_setfield(L, -2, "delivery_rate");
+    }
+    if (MS_TCP_HAS(tcp->info_len, sndbuf_limited)) {
+        lua_pushinteger(L, t->busy_time);
+        lua_setfield(L, -2, "busy_us");
+        lua_pushinteger(L, t->rwnd_limited);
+        lua_setfield(L, -2, "rwnd_limited_us");
+        lua_pushinteger(L, t->sndbuf_limited);
+        lua_setfield(L, -2, "sndbuf_limited_us");
+    }
+    if (MS_TCP_HAS(tcp->info_len, rcv_ooopack)) {
+        lua_pushinteger(L, t->rcv_ooopack);
+        lua_setfield(L, -2, "ooo_packets");
+    }
+}
+
+/* Push a kernel timestamp of CLOCK_REALTIME as ns of CLOCK_MONOTONIC into field key, if it is set */
+static void ms_push_kernel_time(lua_State* L, const struct timespec* ts, const struct ms_shared* shared, const char* key)
+{
+    if (ts->tv_sec == 0)
+        return;
+    int64_t ns = (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec - shared->realtime_offset_ns;
+    lua_pushnumber(L, (double)ns);
+    lua_setfield(L, -2, key);
+}
+
+/* Push the socket queue depths of a connection as table, start is the time of slot 0 */
+static void ms_push_queues(lua_State* L, const struct ms_result* r, const struct timespec* start)
+{
+    lua_createtable(L, 0, 5);
+    lua_pushnumber(L, start->tv_sec * 1.0e9 + start->tv_nsec + (double)r->queue_first * r->queue_step_ns);
+    lua_setfield(L, -2, "start_ns");
+    lua_pushinteger(L, r->queue_step_ns);
+    lua_setfield(L, -2, "step_ns");
+    static const char* const names[] = { "unsent", "unacked", "inq" };
+    for (int f = 0; f < 3; ++f) {
+        lua_createtable(L, r->nqueues, 0);
+        for (uint32_t k = 0; k < r->nqueues; ++k) {
+            const struct ms_queue_sample* q = &r->queues[k];
+            lua_pushinteger(L, f == 0 ? q->unsent : f == 1 ? q->unacked : q->inq);
+            lua_rawseti(L, -2, k + 1);
+        }
+        lua_setfield(L, -2, names[f]);
+    }
+}
+
+/*
+** Push the throughput counters of a connection as table, start is the time of bucket 0.
+** The sender and the receiver may have doubled their bucket length a different number
+** of times, so both are pushed with the larger one.
+*/
+static void ms_push_buckets(lua_State* L, const struct ms_result* r, const struct timespec* start)
+{
+    const struct ms_buckets* both[2] = { &r->sent, &r->received };
+    uint64_t step_ns = 0, first = UINT64_MAX, end = 0;
+    for (int i = 0; i < 2; ++i) {
+        if (both[i]->n > 0 && both[i]->step_ns > step_ns)
+            step_ns = both[i]->step_ns;
+    }
+    for (int i = 0; i < 2; ++i) {
+        uint64_t scale = both[i]->n > 0 ? step_ns / both[i]->step_ns : 0;
+        if (scale > 0 && both[i]->first / scale < first)
+            first = both[i]->first / scale;
+        if (scale > 0 && (both[i]->first + both[i]->n - 1) / scale + 1 > end)
+            end = (both[i]->first + both[i]->n - 1) / scale + 1;
+    }
+    lua_createtable(L, 0, 6);
+    lua_pushnumber(L, start->tv_sec * 1.0e9 + start->tv_nsec);
+    lua_setfield(L, -2, "start_ns");
+    lua_pushinteger(L, (lua_Integer)first);
+    lua_setfield(L, -2, "first");
+    lua_pushinteger(L, (lua_Integer)step_ns);
+    lua_setfield(L, -2, "step_ns");
+    static const char* const names[] = { "sent", "received", "responses" };
+    for (int f = 0; f < 3; ++f) {
+        const struct ms_buckets* b = both[f > 0];
+        uint64_t scale = b->n > 0 ? step_ns / b->step_ns : 1;
+        lua_createtable(L, (int)(end - first), 0);
+        for (uint64_t k = 0; k < end - first; ++k) {
+            lua_pushinteger(L, 0);
+            lua_rawseti(L, -2, (lua_Integer)k + 1);
+        }
+        for (uint32_t k = 0; k < b->n; ++k) {
+            lua_Integer idx = (lua_Integer)((b->first + k) / scale - first) + 1;
+            lua_rawgeti(L, -1, idx);
+            lua_Integer sum = lua_tointeger(L, -1) + (lua_Integer)(f == 2 ? b->slots[k].responses : b->slots[k].bytes);
+            lua_pop(L, 1);
+            lua_pushinteger(L, sum);
+            lua_rawseti(L, -2, idx);
+        }
+        lua_setfield(L, -2, names[f]);
+    }
+}
+
+/* Push result of a connection onto the stack, see lcf_multi_sendfile */
+static void ms_push_result(lua_State* L, const struct ms_result* r, const struct ms_target* t,
+                           size_t ntargets, int with_runs, const struct ms_shared* shared)
+{
+    if (r->state == MS_RESULT_NONE) {
+        lua_pushstring(L, "Worker process ended before the connection finished");
+        return;
+    }
+    if (r->state == MS_RESULT_ERROR) {
+        lua_pushstring(L, r->errmsg);
+        return;
+    }
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, r->send_total);
+    lua_setfield(L, -2, "total_sent");
+    lua_pushinteger(L, r->recv_total);
+    lua_setfield(L, -2, "total_received");
+    lua_pushnumber(L, (r->connect_start.tv_sec * 1.0e9 + r->connect_start.tv_nsec));
+    lua_setfield(L, -2, "connect_start_ns");
+    lua_pushnumber(L, (r->connect_end.tv_sec * 1.0e9 + r->connect_end.tv_nsec));
+    lua_setfield(L, -2, "connect_end_ns");
+    lua_pushnumber(L, (r->send_start.tv_sec * 1.0e9 + r->send_start.tv_nsec));
+    lua_setfield(L, -2, "send_start_ns");
+    lua_pushnumber(L, (r->send_end.tv_sec * 1.0e9 + r->send_end.tv_nsec));
+    lua_setfield(L, -2, "send_end_ns");
+    lua_pushnumber(L, (r->receive_start.tv_sec * 1.0e9 + r->receive_start.tv_nsec));
+    lua_setfield(L, -2, "receive_start_ns");
+    lua_pushnumber(L, (r->receive_end.tv_sec * 1.0e9 + r->receive_end.tv_nsec));
+    lua_setfield(L, -2, "receive_end_ns");
+    lua_pushinteger(L, r->responses);
+    lua_setfield(L, -2, "responses");
+    lua_pushinteger(L, r->sender_cpu_ns);
+    lua_setfield(L, -2, "sender_cpu_ns");
+    lua_pushinteger(L, r->receiver_cpu_ns);
+    lua_setfield(L, -2, "receiver_cpu_ns");
+    lua_pushinteger(L, r->vcsw);
+    lua_setfield(L, -2, "vcsw");
+    lua_pushinteger(L, r->ivcsw);
+    lua_setfield(L, -2, "ivcsw");
+    lua_pushinteger(L, r->local_port);
+    lua_setfield(L, -2, "local_port");
+    if (r->tcp.samples > 0) {
+        ms_push_tcp(L, &r->tcp);
+        lua_setfield(L, -2, "tcp");
+    }
+    if (r->nqueues > 0) {
+        ms_push_queues(L, r, &shared->start);
+        lua_setfield(L, -2, "queues");
+    }
+    if (r->sent.n > 0 || r->received.n > 0) {
+        ms_push_buckets(L, r, &shared->start);
+        lua_setfield(L, -2, "buckets");
+    }
+    if (shared->gap_ns) {
+        double start_ns = shared->start.tv_sec * 1.0e9 + shared->start.tv_nsec;
+        lua_createtable(L, r->ngaps, 0);
+        for (uint32_t k = 0; k < r->ngaps; ++k) {
+            lua_createtable(L, 0, 2);
+            lua_pushnumber(L, start_ns + (double)r->gaps[k].start_ns);
+            lua_setfield(L, -2, "start_ns");
+            lua_pushnumber(L, start_ns + (double)r->gaps[k].end_ns);
+            lua_setfield(L, -2, "end_ns");
+            lua_rawseti(L, -2, k + 1);
+        }
+        lua_setfield(L, -2, "gaps");
+        lua_pushinteger(L, (lua_Integer)r->gaps_total);
+        lua_setfield(L, -2, "gaps_total");
+    }
+    /* Kernel timestamps replace these if available */
+    if (r->recv_total > 0) {
+        lua_pushnumber(L, (r->first_byte.tv_sec * 1.0e9 + r->first_byte.tv_nsec));
+        lua_setfield(L, -2, "first_byte_ns");
+        lua_pushnumber(L, (r->last_byte.tv_sec * 1.0e9 + r->last_byte.tv_nsec));
+        lua_setfield(L, -2, "last_byte_ns");
+    }
+    if (r->responses > 0) {
+        lua_pushnumber(L, (r->first_response.tv_sec * 1.0e9 + r->first_response.tv_nsec));
+        lua_setfield(L, -2, "first_response_ns");
+    }
+    if (shared->timestamps) {
+        ms_push_kernel_time(L, &r->rx_first, shared, "first_byte_ns");
+        ms_push_kernel_time(L, &r->rx_first_response, shared, "first_response_ns");
+        ms_push_kernel_time(L, &r->rx_last, shared, "last_byte_ns");
+        if (r->rx_last.tv_sec != 0) {
+            /* Delay until the receiver thread ran and got the last data */
+            int64_t ret = (int64_t)r->rx_last_return.tv_sec * 1000000000 + r->rx_last_return.tv_nsec;
+            int64_t ns = (int64_t)r->rx_last.tv_sec * 1000000000 + r->rx_last.tv_nsec - shared->realtime_offset_ns;
+            lua_pushinteger(L, ret > ns ? ret - ns : 0);
+            lua_setfield(L, -2, "wakeup_ns");
+        }
+        ms_push_kernel_time(L, &r->tx_sent, shared, "request_sent_ns");
+        ms_push_kernel_time(L, &r->tx_acked, shared, "request_acked_ns");
+    }
+    if (ntargets > 1) {
+        lua_pushinteger(L, r->target);
+        lua_setfield(L, -2, "target");
+    }
+    if (t->nin_files > 1) {
+        lua_pushstring(L, t->in_files[r->in_idx]);
+        lua_setfield(L, -2, "in_file");
+    }
+    if (r->parse_error[0] != '\0') {
+        lua_pushstring(L, r->parse_error);
+        lua_setfield(L, -2, "parse_error");
+    }
+    if (with_runs) {
+        lua_pushinteger(L, r->nruns);
+        lua_setfield(L, -2, "runs");
+    }
+    if (r->endpoints != NULL) {
+        lua_createtable(L, t->mix->n, 0);
+        for (size_t k = 0; k < t->mix->n; ++k) {
+            const struct ms_endpoint* ep = &r->endpoints[k];
+            lua_createtable(L, 0, 4);
+            lua_pushinteger(L, ep->requests);
+            lua_setfield(L, -2, "requests");
+            lua_pushinteger(L, ep->responses);
+            lua_setfield(L, -2, "responses");
+            lua_pushinteger(L, ep->bytes);
+            lua_setfield(L, -2, "bytes");
+            lua_createtable(L, 5, 0);
+            for (int s = 0; s < 5; ++s) {
+                lua_pushinteger(L, ep->status_classes[s]);
+                lua_rawseti(L, -2, s + 1);
+            }
+            lua_setfield(L, -2, "status_classes");
+            lua_rawseti(L, -2, k + 1);
         }
-        conn->receiver.created = 1;
-        pthread_attr_destroy(&attr);
+        lua_setfield(L, -2, "endpoints");
+    }
+    if (t->use_replay) {
+        lua_pushinteger(L, r->lag_max);
+        lua_setfield(L, -2, "replay_lag_max_ns");
+        lua_pushinteger(L, r->lag_total);
+        lua_setfield(L, -2, "replay_lag_total_ns");
+        lua_pushinteger(L, r->late);
+        lua_setfield(L, -2, "replay_late");
+    }
+    if (t->bodies != NULL) {
+        lua_pushinteger(L, r->body_count);
+        lua_setfield(L, -2, "body_count");
+        lua_pushinteger(L, r->body_sent);
+        lua_setfield(L, -2, "body_sent");
+        lua_pushinteger(L, r->body_framing);
+        lua_setfield(L, -2, "body_framing");
+        lua_pushinteger(L, r->body_ns);
+        lua_setfield(L, -2, "body_ns");
     }
-    return last;
-failed:
-    ms_destroy_conns(last, 1);
-    return NULL;
 }
 
 /*
@@ -356,26 +4095,160 @@ failed:
 ** calls to send the requests, and the other one using blocking recv() and write()
 ** calls to store the responses in the output files.
 **
-** multi_sendfile(in_file, hostname, port, num_threads)
-**   in_file (string)       Input file name.
+** multi_sendfile(in_file, out_file_fmt, hostname, port, num_conns, use_shutdown, ignore_out [, opts])
+**   in_file (string|table) Input file name, or sequence of input file names which are
+**                          assigned round-robin to the connections.
 **   out_file_fmt (string)  Format for output file names, e.g. responses-%d.txt
 **   hostname (string)      Host name of target host.
 **   port (string)          Port number or service name of target host.
 **   num_conns (integer)    Number of concurrent connections to used.
 **   use_shutdown (bool)    Call shutdown() if all data has been sent. This might cause problems.
 **   ignore_out (bool)      Do not create output files. This improves performance.
+**   opts (table)           Optional settings:
+**     log_file (string)    Record all responses into this single framed log file
+**                          instead of one output file per connection.
+**     store_dir (string)   Record responses into this deduplicating store directory
+**                          instead of one output file per connection.
+**     template (string)    Generate requests from this template instead of sending
+**                          in_file. It contains the request line and headers, except
+**                          for the Connection header, which is added automatically.
+**     nreq (integer)       Number of requests to generate per connection.
+**     seed (integer)       Seed for random template values.
+**     mix (table)          Weighted request mix instead of a single template: sequence of
+**                          tables with the keys weight (integer) and template (string).
+**                          For every request, one entry is picked randomly by weight.
+**     replay (table)       Replay schedules instead of sending the whole in_file: sequence
+**                          with one string per connection, containing packed native
+**                          uint64_t quadruples of send time in ns relative to the start,
+**                          offset and length of a request within in_file, and flags
+**                          (1 if the request is HEAD and the response has no body).
+**     bodies (table)       Sequence of file names. Requests of the template or mix with
+**                          POST, PUT or PATCH method get the next of these bodies,
+**                          which is sent with sendfile().
+**     chunk_size (integer) Send bodies with chunked transfer encoding in chunks of
+**                          this size instead of with Content-Length.
+**     procs (integer)      Number of worker processes, which are forked to run an equal share
+**                          of the connections each. They wait on the same process-shared
+**                          barrier and copy their results into a shared mapping. Cannot
+**                          be combined with store_dir.
+**     cpu_sets (table)     Sequence of CPU lists like "0-3,8". The threads of each connection
+**                          are restricted to one of them, assigned round-robin by connection
+**                          ID, and its memory is mapped separately and first touched while
+**                          running there, so that it is placed on their NUMA node.
+**     server_pids (table)  Sequence of process IDs of the server, which are sampled by a
+**                          separate thread from the start until all connections finished.
+**     sample_interval_ms (integer) Interval of these samples (default: 100).
+**     server_threads (bool) Also keep every server thread and note in every sample, which
+**                          connection socket each thread is reading or writing.
+**     tcp_info (bool)      Sample TCP_INFO of every connection socket at sample_interval_ms
+**                          by a separate thread in every process, and once more when its
+**                          receiver ends.
+**     queues (bool)        Sample the send and receive queues of every connection socket
+**                          at sample_interval_ms by the same thread.
+**     timestamps (bool)    Enable SO_TIMESTAMPING on every connection socket to record kernel
+**                          timestamps of received data and of request data sent and
+**                          acknowledged, without the delay until a thread is scheduled.
+**     bucket_ms (integer)  Count the bytes sent and received and the responses of every
+**                          connection in time buckets of this length, or 0 (default).
+**     gap_ms (integer)     Record the gaps between responses of every connection, which
+**                          last at least this long, or 0 (default).
+**     progress (bool)      Print the throughput and the number of active, finished and
+**                          failed connections every second to stderr during the run.
+**     progress_requests (integer) Number of requests of all connections, to estimate the
+**                          remaining time, or 0 (default) if unknown.
+**     listen_ports (table) Sequence of ports of listening sockets of the server on this host,
+**                          whose accept queues are sampled at sample_interval_ms by a
+**                          separate thread from the start until all connections finished.
+**     ready (function)     Called without arguments once all connections are set up, right
+**                          before they are started. It may return a time in ns of the
+**                          clock used by monotonic_ns, until which the start is delayed.
+**                          If it raises an error, the benchmark is aborted.
+**     targets (table)      Sequence of additional targets, whose connections share the
+**                          barrier and clock with the first one and follow its connections.
+**                          Each is a table with host, port (both string), num_conns
+**                          (integer), in_file and the settings template, mix, nreq, seed,
+**                          replay, bodies and chunk_size as above.
 ** Returns a table with indices 1..num_conns, with entries representing the results of each
 ** connection. The entry is either a string with an error message, or a table with the keys
 ** total_sent (integer), total_received (integer), connect_start_ns, connect_end_ns,
 ** send_start_ns, send_end_ns, receive_start_ns, receive_end_ns (all double) with the total number
 ** of bytes sent and received and the timestamps recorded by the workder threads.
+** Connection tables with received data also contain first_byte_ns, last_byte_ns (after the
+** recv() which returned the first and the last data) and, with a complete response,
+** first_response_ns (after the recv() which completed the first response, all double).
+** Connection tables also contain the number of complete responses (integer), parse_error
+** (string, only on framing errors), and runs (integer, number of runs written to the store).
+** With a store, the results table has the field unique_responses (integer).
+** With gap_ms, connection tables contain gaps, a sequence of tables with start_ns and
+** end_ns (double, after the recv() which completed the last response before the gap and
+** the next one), the longest at most 256 gaps, and gaps_total (integer, all gaps).
+** SIGINT during the run ends all connections at once. Those which had not finished are
+** errors "Interrupted", and the results table has the field interrupted (true).
+** With a mix of several entries, connection tables contain endpoints, a sequence with one
+** table per mix entry with the keys requests, responses, bytes (all integer) and
+** status_classes (sequence of counts for status classes 1xx..5xx).
+** With replay, connection tables contain replay_lag_max_ns, replay_lag_total_ns (both
+** integer, delay behind schedule) and replay_late (integer, requests more than 1 ms late).
+** With targets, connection tables contain target (integer, 1 for the first target).
+** With several input files, connection tables contain in_file (string).
+** With bodies, connection tables contain body_count, body_sent (bytes of body payload),
+** body_framing (bytes of chunked encoding around it) and body_ns (time spent sending
+** bodies, all integer).
+** Connection tables also contain sender_cpu_ns and receiver_cpu_ns (CPU time of the two
+** threads), vcsw and ivcsw (their voluntary and involuntary context switches, all integer).
+** The results table has the field client, a table with the CPU time (cpu_ns) and context
+** switches (vcsw, ivcsw) of the whole client from the start until all connections have
+** finished, including worker processes, the peak RSS of the largest client process
+** (maxrss_kb) and the number of processes (all integer).
+** With server_pids, the results table has the field server, a table with pids, samples and
+** error (string, only if sampling stopped early). Samples is a sequence of tables with
+** time_ns (double, same clock as the connection timestamps) and the integers processes (still
+** existing), cpu_ns (user plus system, of exited processes until they exited), rss_kb, threads, vcsw, ivcsw (context switches of all
+** threads), run_ns and wait_ns (time running and waiting for a CPU from schedstat), fds,
+** read_bytes and write_bytes (the last three only if readable), summed over all processes.
+** With server_threads, server also has threads, a sequence with one table per server thread
+** with pid, tid, name, run_ns and wait_ns (during the run), started (bool, thread started
+** during the run) and ports, which maps the local
+** ports of client connections the thread was seen in I/O on to tables with the number of
+** samples and the times of the first and last of them (first_ns, last_ns), and sockets,
+** which maps the local ports of client connections whose sockets the server had open to
+** such tables with an additional pid.
+** Connection tables contain local_port (integer) to match these.
+** With tcp_info, connection tables contain tcp, a table with the number of samples, the
+** average and largest smoothed RTT (rtt_avg_us, rtt_max_us) and the largest congestion
+** window (cwnd_max) over them, and from the last sample rtt_us, rttvar_us, rcv_rtt_us
+** (RTT estimated by the receiving side), retrans (total retransmitted segments), lost, cwnd
+** (in segments) and mss. If the kernel reports them, it also contains min_rtt_us,
+** delivery_rate (bytes/s), busy_us, rwnd_limited_us and sndbuf_limited_us (time sending
+** data and time of that limited by the receive window of the server or by the send
+** buffer) and ooo_packets (out-of-order packets received, mostly losses of the server).
+** All values are integers and describe the connection as seen by the client.
+** With queues, connection tables contain queues, a time series of the socket queues with
+** start_ns (double, time of the first slot), step_ns (integer, length of a slot, which
+** grows for long runs to fit at most 256 slots) and the sequences unsent (request bytes
+** not sent yet), unacked (request bytes not acknowledged by the server) and inq
+** (response bytes not read yet by the client), each with the largest sample of a slot.
+** With timestamps, first_byte_ns, first_response_ns and last_byte_ns are kernel timestamps
+** of the data received, and connection tables contain request_sent_ns and request_acked_ns
+** (last request byte passed to the device and acknowledged by the server), all double on
+** the clock of the other timestamps, and each only if the kernel reported it. With a kernel
+** timestamp of the last data, wakeup_ns (integer) is the delay until the receiver got it.
+** With bucket_ms, connection tables contain buckets, a table with start_ns (double, time
+** the first bucket counts from), first (integer, number of the first bucket), step_ns
+** (integer, length of a bucket, which grows for long runs to fit at most 1024 buckets) and
+** the sequences sent, received and responses (integers per bucket).
+** With listen_ports, the results table has the field listen, a table with ports, backlog
+** (largest backlog of the listening sockets, 0 if none was found), samples and error
+** (string, only if sampling stopped early). Samples is a sequence of tables with time_ns
+** (double) and the integers queue (connections waiting for accept(), summed over the
+** listening sockets), sockets (listening sockets found) and the counters overflows and
+** drops (ListenOverflows and ListenDrops of /proc/net/netstat, for all listening sockets).
 */
 static int lcf_multi_sendfile(lua_State* L)
 {
-    const char* in_file = luaL_checkstring(L, 1);
     const char* out_file_fmt = luaL_checkstring(L, 2);
-    const char* host = luaL_checkstring(L, 3);
-    const char* port = luaL_checkstring(L, 4);
+    luaL_checkstring(L, 3);
+    luaL_checkstring(L, 4);
     lua_Integer num_conns = luaL_checkinteger(L, 5);
     luaL_checktype(L, 6, LUA_TBOOLEAN);
     luaL_checktype(L, 7, LUA_TBOOLEAN);
@@ -384,75 +4257,1062 @@ static int lcf_multi_sendfile(lua_State* L)
         return luaL_error(L, "number of connections must greater than zero and smaller than %zu", max_conn);
     int use_shutdown = lua_toboolean(L, 6);
     int ignore_out = lua_toboolean(L, 7);
-    /* Use a barrier to ensure that threads start simultaneously, if possible */
-    pthread_barrier_t barrier;
-    int err = pthread_barrier_init(&barrier, NULL, (unsigned)(num_conns * 2 + 1));
-    if (err)
-        return luaL_error(L, "pthread_barrier_init failed: %s", strerror(err));
-    /* Open sockets, files, start worker threads */
+    const char* log_file = NULL;
+    const char* store_dir = NULL;
+    int opts = 0;
+    size_t ntargets = 1;
+    if (! lua_isnoneornil(L, 8)) {
+        luaL_checktype(L, 8, LUA_TTABLE);
+        opts = 8;
+        lua_getfield(L, 8, "log_file");
+        log_file = luaL_optstring(L, -1, NULL);
+        lua_getfield(L, 8, "store_dir");
+        store_dir = luaL_optstring(L, -1, NULL);
+        lua_getfield(L, 8, "targets");
+        if (! lua_isnil(L, -1)) {
+            luaL_checktype(L, -1, LUA_TTABLE);
+            ntargets += lua_rawlen(L, -1);
+        }
+        lua_pop(L, 3);
+    }
     char errmsg[8192];
-    struct ms_conn* conns = ms_create_conns(
-        errmsg, sizeof errmsg,
-        in_file, out_file_fmt, host, port, num_conns,
-        &barrier,
-        use_shutdown, ignore_out
-    );
-    if (conns == NULL) {
-        pthread_barrier_destroy(&barrier);
+    struct ms_writer* use_writer = NULL;
+    struct ms_store store;
+    struct ms_store* use_store = NULL;
+    FILE* index = NULL;
+    struct ms_shared* shared = MAP_FAILED;
+    size_t shared_len = 0;
+    int barrier_created = 0, ready_created = 0;
+    lua_Integer procs = 1;
+    struct ms_placement placement = { NULL, 0 };
+    struct ms_conn* conns = NULL;
+    pid_t* pids = NULL;
+    size_t nworkers = 0;
+    size_t total_conns = 0;
+    pid_t* server_pids = NULL;
+    size_t nserver_pids = 0;
+    lua_Integer sample_interval_ms = 100, bucket_ms = 0, gap_ms = 0, progress_requests = 0;
+    int progress = 0;
+    struct ms_reporter reporter;
+    memset(&reporter, 0, sizeof reporter);
+    struct sigaction old_int;
+    int server_threads = 0;
+    int tcp_info = 0, queues = 0, timestamps = 0;
+    struct ms_sampler sampler;
+    memset(&sampler, 0, sizeof sampler);
+    struct ms_ticker conn_sampler;
+    memset(&conn_sampler, 0, sizeof conn_sampler);
+    uint16_t* listen_ports = NULL;
+    size_t nlisten_ports = 0;
+    struct ms_listen listener;
+    memset(&listener, 0, sizeof listener);
+    listener.fd = -1;
+    /* Load settings of all targets */
+    struct ms_target* targets = calloc(ntargets, sizeof *targets);
+    if (targets == NULL) {
+        snprintf(errmsg, sizeof errmsg, "Out of memory");
+        goto failed;
+    }
+    if (opts && ms_opt_integer(L, opts, "procs", 1, 1, &procs, errmsg, sizeof errmsg) < 0)
+        goto failed;
+    if (procs > 1 && store_dir != NULL && ! ignore_out) {
+        snprintf(errmsg, sizeof errmsg, "store_dir cannot be combined with procs");
+        goto failed;
+    }
+    /* Server processes to sample during the run */
+    if (opts) {
+        if (ms_opt_integer(L, opts, "sample_interval_ms", 100, 1, &sample_interval_ms, errmsg, sizeof errmsg) < 0)
+            goto failed;
+        if (ms_opt_integer(L, opts, "bucket_ms", 0, 0, &bucket_ms, errmsg, sizeof errmsg) < 0)
+            goto failed;
+        if (ms_opt_integer(L, opts, "gap_ms", 0, 0, &gap_ms, errmsg, sizeof errmsg) < 0)
+            goto failed;
+        if (ms_opt_integer(L, opts, "progress_requests", 0, 0, &progress_requests, errmsg, sizeof errmsg) < 0)
+            goto failed;
+        lua_getfield(L, opts, "progress");
+        progress = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, opts, "server_threads");
+        server_threads = lua_toboolean(L, -1);
+        lua_getfield(L, opts, "tcp_info");
+        tcp_info = lua_toboolean(L, -1);
+        lua_getfield(L, opts, "queues");
+        queues = lua_toboolean(L, -1);
+        lua_getfield(L, opts, "timestamps");
+        timestamps = lua_toboolean(L, -1);
+        lua_pop(L, 4);
+        lua_getfield(L, opts, "server_pids");
+        if (! lua_isnil(L, -1)) {
+            if (! lua_istable(L, -1) || (nserver_pids = lua_rawlen(L, -1)) == 0) {
+                snprintf(errmsg, sizeof errmsg, "server_pids must be a non-empty sequence");
+                goto failed;
+            }
+            if ((server_pids = calloc(nserver_pids, sizeof *server_pids)) == NULL) {
+                snprintf(errmsg, sizeof errmsg, "Out of memory");
+                goto failed;
+            }
+            for (size_t k = 0; k < nserver_pids; ++k) {
+                lua_rawgeti(L, -1, k + 1);
+                if (! lua_isinteger(L, -1) || lua_tointeger(L, -1) <= 0) {
+                    snprintf(errmsg, sizeof errmsg, "server_pids must contain process IDs");
+                    goto failed;
+                }
+                server_pids[k] = (pid_t)lua_tointeger(L, -1);
+                lua_pop(L, 1);
+            }
+        }
+        lua_getfield(L, opts, "listen_ports");
+        if (! lua_isnil(L, -1)) {
+            if (! lua_istable(L, -1) || (nlisten_ports = lua_rawlen(L, -1)) == 0) {
+                snprintf(errmsg, sizeof errmsg, "listen_ports must be a non-empty sequence");
+                goto failed;
+            }
+            if ((listen_ports = calloc(nlisten_ports, sizeof *listen_ports)) == NULL) {
+                snprintf(errmsg, sizeof errmsg, "Out of memory");
+                goto failed;
+            }
+            for (size_t k = 0; k < nlisten_ports; ++k) {
+                lua_rawgeti(L, -1, k + 1);
+                if (! lua_isinteger(L, -1) || lua_tointeger(L, -1) <= 0 || lua_tointeger(L, -1) > 65535) {
+                    snprintf(errmsg, sizeof errmsg, "listen_ports must contain port numbers");
+                    goto failed;
+                }
+                listen_ports[k] = (uint16_t)lua_tointeger(L, -1);
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 2);
+    }
+    for (size_t k = 0; k < ntargets; ++k) {
+        struct ms_target* t = &targets[k];
+        int target_opts = opts;
+        if (k == 0) {
+            t->host = lua_tostring(L, 3);
+            t->port = lua_tostring(L, 4);
+            if (ms_target_in_files(L, 1, t, errmsg, sizeof errmsg) < 0)
+                goto failed;
+        } else {
+            lua_getfield(L, 8, "targets");
+            lua_rawgeti(L, -1, k);
+            target_opts = lua_gettop(L);
+            lua_getfield(L, target_opts, "host");
+            lua_getfield(L, target_opts, "port");
+            if (! lua_istable(L, target_opts) || lua_type(L, -2) != LUA_TSTRING || lua_type(L, -1) != LUA_TSTRING) {
+                snprintf(errmsg, sizeof errmsg, "target #%zu needs host and port strings", k + 1);
+                goto failed;
+            }
+            t->host = lua_tostring(L, -2);
+            t->port = lua_tostring(L, -1);
+            lua_pop(L, 2);
+            if (ms_opt_integer(L, target_opts, "num_conns", 1, 1, &num_conns, errmsg, sizeof errmsg) < 0)
+                goto failed;
+            lua_getfield(L, target_opts, "in_file");
+            if (ms_target_in_files(L, lua_gettop(L), t, errmsg, sizeof errmsg) < 0)
+                goto failed;
+            lua_pop(L, 1);
+        }
+        if ((size_t)num_conns > max_conn - total_conns) {
+            snprintf(errmsg, sizeof errmsg, "total number of connections must be smaller than %zu", max_conn);
+            goto failed;
+        }
+        t->num_conns = (size_t)num_conns;
+        total_conns += t->num_conns;
+        if (ms_target_load(L, target_opts, t, errmsg, sizeof errmsg) < 0)
+            goto failed;
+        if (k > 0)
+            lua_pop(L, 2);
+    }
+    if ((size_t)procs > total_conns)
+        procs = (lua_Integer)total_conns;
+    /* CPU sets for the threads of connections */
+    if (opts) {
+        lua_getfield(L, opts, "cpu_sets");
+        if (! lua_isnil(L, -1)) {
+            if (! lua_istable(L, -1) || (placement.nsets = lua_rawlen(L, -1)) == 0) {
+                snprintf(errmsg, sizeof errmsg, "cpu_sets must be a non-empty sequence");
+                goto failed;
+            }
+            if ((placement.sets = calloc(placement.nsets, sizeof *placement.sets)) == NULL) {
+                snprintf(errmsg, sizeof errmsg, "Out of memory");
+                goto failed;
+            }
+            for (size_t k = 0; k < placement.nsets; ++k) {
+                lua_rawgeti(L, -1, k + 1);
+                if (lua_type(L, -1) != LUA_TSTRING || ms_parse_cpulist(lua_tostring(L, -1), &placement.sets[k]) < 0) {
+                    snprintf(errmsg, sizeof errmsg, "cpu_sets[%zu] is not a CPU list like 0-3,8", k + 1);
+                    goto failed;
+                }
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
+    }
+    /* Map memory for results, endpoint statistics and synchronization, which is
+       shared with worker processes */
+    size_t nendpoints = 0;
+    for (size_t k = 0; k < ntargets; ++k) {
+        if (targets[k].mix != NULL && targets[k].mix->n > 1)
+            nendpoints += targets[k].num_conns * targets[k].mix->n;
+    }
+    uint32_t queue_cap = queues ? MS_QUEUE_SLOTS : 0;
+    uint32_t bucket_cap = bucket_ms ? MS_BUCKET_SLOTS : 0;
+    uint32_t gap_cap = gap_ms ? MS_GAP_SLOTS : 0;
+    shared_len = sizeof (struct ms_shared) + total_conns * sizeof (struct ms_result)
+        + nendpoints * sizeof (struct ms_endpoint) + total_conns * queue_cap * sizeof (struct ms_queue_sample)
+        + total_conns * 2 * bucket_cap * sizeof (struct ms_bucket) + total_conns * gap_cap * sizeof (struct ms_gap);
+    shared = mmap(NULL, shared_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        snprintf(errmsg, sizeof errmsg, "Cannot map %zu bytes for results: %s", shared_len, strerror(errno));
+        goto failed;
+    }
+    struct ms_endpoint* endpoints = (struct ms_endpoint*)&shared->results[total_conns];
+    for (size_t k = 0; k < ntargets; ++k) {
+        targets[k].replay.start = &shared->start;
+        if (targets[k].mix != NULL && targets[k].mix->n > 1) {
+            targets[k].endpoints = endpoints;
+            endpoints += targets[k].num_conns * targets[k].mix->n;
+        }
+    }
+    /* Connections are sampled by a separate thread in every process */
+    if (tcp_info || queues)
+        shared->conn_interval_ns = (uint64_t)sample_interval_ms * 1000000;
+    shared->tcp_info = tcp_info;
+    shared->queue_cap = queue_cap;
+    if (timestamps) {
+        /* Kernel timestamps use CLOCK_REALTIME, read it between two readings of the other one */
+        struct timespec mono1, real, mono2;
+        clock_gettime(CLOCK_MONOTONIC, &mono1);
+        clock_gettime(CLOCK_REALTIME, &real);
+        clock_gettime(CLOCK_MONOTONIC, &mono2);
+        int64_t mono_ns = ((int64_t)mono1.tv_sec * 1000000000 + mono1.tv_nsec
+                           + (int64_t)mono2.tv_sec * 1000000000 + mono2.tv_nsec) / 2;
+        shared->realtime_offset_ns = (int64_t)real.tv_sec * 1000000000 + real.tv_nsec - mono_ns;
+        shared->timestamps = 1;
+    }
+    struct ms_queue_sample* queue_slots = (struct ms_queue_sample*)endpoints;
+    for (size_t i = 0; queues && i < total_conns; ++i)
+        shared->results[i].queues = queue_slots + i * queue_cap;
+    /* Buckets follow, two per connection, so that sender and receiver never share them */
+    struct ms_bucket* bucket_slots = (struct ms_bucket*)(queue_slots + total_conns * queue_cap);
+    for (size_t i = 0; bucket_cap && i < total_conns; ++i) {
+        shared->results[i].sent.slots = bucket_slots + 2 * i * bucket_cap;
+        shared->results[i].received.slots = bucket_slots + (2 * i + 1) * bucket_cap;
+    }
+    shared->bucket_ns = (uint64_t)bucket_ms * 1000000;
+    struct ms_gap* gap_slots = (struct ms_gap*)(bucket_slots + total_conns * 2 * bucket_cap);
+    for (size_t i = 0; gap_cap && i < total_conns; ++i)
+        shared->results[i].gaps = gap_slots + i * gap_cap;
+    shared->gap_ns = (uint64_t)gap_ms * 1000000;
+    /* A single sendfile() of the whole input would only count the bytes sent at the end */
+    if (bucket_ms || progress)
+        shared->send_chunk = 64 * 1024;
+    /* Open deduplicating store or shared response log */
+    if (store_dir != NULL && ! ignore_out) {
+        if (ms_store_open(&store, store_dir, errmsg, sizeof errmsg) < 0)
+            goto failed;
+        use_store = &store;
+        char path[4200];
+        snprintf(path, sizeof path, "%s/index.txt", store_dir);
+        if ((index = fopen(path, "w")) == NULL) {
+            snprintf(errmsg, sizeof errmsg, "Cannot open index file '%s': %s", path, strerror(errno));
+            goto failed;
+        }
+        fprintf(index, "# sockbiter response store: connection hash count\n");
+    } else if (log_file != NULL && ! ignore_out) {
+        if (ms_writer_open(&shared->writer, log_file, procs > 1, errmsg, sizeof errmsg) < 0)
+            goto failed;
+        use_writer = &shared->writer;
+    }
+    /* Use a barrier to ensure that threads of all processes start simultaneously, if possible */
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    if (procs > 1)
+        pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    int err = pthread_barrier_init(&shared->barrier, &attr, (unsigned)(total_conns * 2 + 1));
+    pthread_barrierattr_destroy(&attr);
+    if (err) {
+        snprintf(errmsg, sizeof errmsg, "pthread_barrier_init failed: %s", strerror(err));
+        goto failed;
+    }
+    barrier_created = 1;
+    /* Open sockets, files, start worker threads of all targets, either in this
+       process or in worker processes with an equal share of the connections each */
+    if (procs == 1) {
+        if (ms_create_range(&conns, errmsg, sizeof errmsg, targets, ntargets, 0, total_conns,
+                            out_file_fmt, shared, &placement, use_shutdown, ignore_out, use_writer, use_store) < 0) {
+            /* Threads created so far stay blocked by the barrier, which cannot be destroyed */
+            barrier_created = 0;
+            goto failed;
+        }
+    } else {
+        if (sem_init(&shared->ready, 1, 0) < 0) {
+            snprintf(errmsg, sizeof errmsg, "sem_init failed: %s", strerror(errno));
+            goto failed;
+        }
+        ready_created = 1;
+        if ((pids = calloc((size_t)procs, sizeof *pids)) == NULL) {
+            snprintf(errmsg, sizeof errmsg, "Out of memory");
+            goto failed;
+        }
+        fflush(NULL);
+        for (size_t p = 0; p < (size_t)procs; ++p) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                snprintf(errmsg, sizeof errmsg, "fork failed: %s", strerror(errno));
+                goto failed;
+            }
+            if (pid == 0) {
+                ms_worker(shared, targets, ntargets, total_conns * p / procs, total_conns * (p + 1) / procs,
+                          out_file_fmt, &placement, use_shutdown, ignore_out, use_writer);
+            }
+            pids[nworkers++] = pid;
+        }
+        if (ms_wait_workers(shared, pids, nworkers, errmsg, sizeof errmsg) < 0)
+            goto failed;
+    }
+    /* Let the caller agree on a start time, e.g. with other hosts */
+    if (opts) {
+        lua_getfield(L, opts, "ready");
+        if (! lua_isnil(L, -1)) {
+            if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
+                snprintf(errmsg, sizeof errmsg, "%s", lua_isstring(L, -1) ? lua_tostring(L, -1) : "ready failed");
+                lua_pop(L, 1);
+                /* Release all threads, which exit without connecting */
+                shared->abort = 1;
+                pthread_barrier_wait(&shared->barrier);
+                for (struct ms_conn* c = conns; c != NULL; c = c->prev) {
+                    pthread_join(c->sender.thread, NULL);
+                    pthread_join(c->receiver.thread, NULL);
+                }
+                ms_destroy_conns(conns, 0);
+                conns = NULL;
+                goto failed;
+            }
+            if (lua_isnumber(L, -1)) {
+                uint64_t at = (uint64_t)lua_tonumber(L, -1);
+                struct timespec due = { (time_t)(at / 1000000000), (long)(at % 1000000000) };
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+                    ;
+            }
+        }
+        lua_pop(L, 1);
+    }
+    /* Wait until all threads are blocked by the barrier, then start all */
+    struct rusage usage_before, usage_after;
+    getrusage(RUSAGE_SELF, &usage_before);
+    if (server_pids != NULL)
+        ms_sampler_start(&sampler, server_pids, nserver_pids, sample_interval_ms, server_threads);
+    if (listen_ports != NULL)
+        ms_listen_start(&listener, listen_ports, nlisten_ports, sample_interval_ms);
+    clock_gettime(CLOCK_MONOTONIC, &shared->start);
+    if (procs == 1 && shared->conn_interval_ns)
+        ms_ticker_start(&conn_sampler, shared->conn_interval_ns, (int(*)(void*))ms_conn_tick, conns);
+    if (progress)
+        ms_reporter_start(&reporter, shared, total_conns, (uint64_t)progress_requests);
+    /* SIGINT ends the run early, with the results of the connections finished until then */
+    ms_interrupt_install(shared, conns, pids, nworkers, &old_int);
+    pthread_barrier_wait(&shared->barrier);
+    /* Join all threads or worker processes, then generate results table */
+    if (procs == 1) {
+        ms_join_conns(conns, index, &conn_sampler);
+    } else {
+        for (size_t p = 0; p < nworkers; ++p) {
+            waitpid(pids[p], NULL, 0);
+            pids[p] = 0;
+        }
+    }
+    sigaction(SIGINT, &old_int, NULL);
+    if (procs == 1)
+        ms_destroy_conns(conns, 0);
+    nworkers = 0;
+    ms_reporter_stop(&reporter);
+    ms_ticker_stop(&sampler.ticker);
+    ms_listen_stop(&listener);
+    getrusage(RUSAGE_SELF, &usage_after);
+    lua_createtable(L, total_conns, 0);
+    for (size_t i = 0; i < total_conns; ++i) {
+        const struct ms_result* r = &shared->results[i];
+        ms_push_result(L, r, &targets[r->target - 1], ntargets, use_store != NULL, shared);
+        lua_rawseti(L, -2, i + 1);
+    }
+    ms_push_usage(L, &usage_before, &usage_after, shared, procs);
+    lua_setfield(L, -2, "client");
+    if (server_pids != NULL) {
+        ms_push_server(L, &sampler);
+        lua_setfield(L, -2, "server");
+    }
+    if (listen_ports != NULL) {
+        ms_push_listen(L, &listener);
+        lua_setfield(L, -2, "listen");
+    }
+    if (shared->interrupted) {
+        lua_pushboolean(L, 1);
+        lua_setfield(L, -2, "interrupted");
+    }
+    /* Threads of worker processes may have exited before leaving the barrier, which
+       would block pthread_barrier_destroy; the mapping is discarded anyways */
+    if (procs == 1)
+        pthread_barrier_destroy(&shared->barrier);
+    if (ready_created)
+        sem_destroy(&shared->ready);
+    if (use_writer != NULL)
+        ms_writer_close(use_writer);
+    if (use_store != NULL) {
+        lua_pushinteger(L, use_store->count);
+        lua_setfield(L, -2, "unique_responses");
+        ms_store_close(use_store);
+    }
+    munmap(shared, shared_len);
+    free(placement.sets);
+    free(server_pids);
+    free(listener.samples);
+    free(listen_ports);
+    free(pids);
+    for (size_t k = 0; k < ntargets; ++k)
+        ms_target_free(&targets[k]);
+    free(targets);
+    if (index != NULL && fclose(index) != 0) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Cannot write index file in '%s'", store_dir);
+        return 2;
+    }
+    return 1;
+failed:
+    /* Threads and worker processes may be blocked by the barrier already */
+    if (conns != NULL)
+        ms_destroy_conns(conns, 1);
+    for (size_t p = 0; p < nworkers; ++p) {
+        if (pids[p] > 0) {
+            kill(pids[p], SIGKILL);
+            waitpid(pids[p], NULL, 0);
+        }
+    }
+    free(pids);
+    free(placement.sets);
+    ms_ticker_stop(&conn_sampler);
+    ms_ticker_stop(&sampler.ticker);
+    free(sampler.samples);
+    free(sampler.pid_cpu_ns);
+    free(sampler.tasks);
+    free(sampler.cur);
+    free(sampler.ended);
+    free(sampler.serves);
+    free(server_pids);
+    ms_listen_stop(&listener);
+    free(listener.samples);
+    free(listen_ports);
+    if (ready_created)
+        sem_destroy(&shared->ready);
+    if (barrier_created && procs == 1)
+        pthread_barrier_destroy(&shared->barrier);
+    for (size_t k = 0; targets != NULL && k < ntargets; ++k)
+        ms_target_free(&targets[k]);
+    free(targets);
+    if (index != NULL)
+        fclose(index);
+    if (use_store != NULL)
+        ms_store_close(use_store);
+    if (use_writer != NULL)
+        ms_writer_close(use_writer);
+    if (shared != MAP_FAILED)
+        munmap(shared, shared_len);
+    lua_pushnil(L);
+    lua_pushstring(L, errmsg);
+    return 2;
+}
+
+/*
+** Split a shared response log back into one file per connection.
+** Output files are kept open while extracting; if the process runs out of file
+** descriptors, all of them are closed and reopened in append mode on demand.
+**
+** log_extract(log_file, out_file_fmt)
+**   log_file (string)      Log file written by multi_sendfile with opts.log_file.
+**   out_file_fmt (string)  Format for output file names, e.g. responses-%d.txt
+** Returns a table with the keys connections, chunks and bytes (all integer),
+** or nil and an error message.
+*/
+static int lcf_log_extract(lua_State* L)
+{
+    const char* log_file = luaL_checkstring(L, 1);
+    const char* out_file_fmt = luaL_checkstring(L, 2);
+    char errmsg[8192] = "";
+    FILE* f = fopen(log_file, "rb");
+    if (f == NULL) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Cannot open log file '%s': %s", log_file, strerror(errno));
+        return 2;
+    }
+    char magic[sizeof MS_LOG_MAGIC - 1];
+    if (fread(magic, 1, sizeof magic, f) != sizeof magic || memcmp(magic, MS_LOG_MAGIC, sizeof magic) != 0) {
+        fclose(f);
+        lua_pushnil(L);
+        lua_pushfstring(L, "'%s' is not a sockbiter response log", log_file);
+        return 2;
+    }
+    /* fds[id] is the open output file or -1, created[id] tells if it was truncated already */
+    int* fds = NULL;
+    char* created = NULL;
+    size_t nfds = 0, connections = 0, chunks = 0, bytes = 0;
+    char buf[64 * 1024];
+    struct ms_log_frame frame;
+    size_t rlen;
+    while ((rlen = fread(&frame, 1, sizeof frame, f)) == sizeof frame) {
+        if (frame.conn_id == 0) {
+            snprintf(errmsg, sizeof errmsg, "Invalid connection ID 0 in chunk #%zu", chunks + 1);
+            goto done;
+        }
+        /* Grow descriptor table */
+        if (frame.conn_id >= nfds) {
+            size_t n = nfds ? nfds : 64;
+            while (n <= frame.conn_id)
+                n *= 2;
+            int* nfd = realloc(fds, n * sizeof *fds);
+            if (nfd != NULL)
+                fds = nfd;
+            char* ncr = realloc(created, n);
+            if (ncr != NULL)
+                created = ncr;
+            if (nfd == NULL || ncr == NULL) {
+                snprintf(errmsg, sizeof errmsg, "Out of memory");
+                goto done;
+            }
+            for (size_t i = nfds; i < n; ++i) {
+                fds[i] = -1;
+                created[i] = 0;
+            }
+            nfds = n;
+        }
+        /* Open output file for this connection */
+        if (fds[frame.conn_id] < 0) {
+            char out_file[4096];
+            snprintf(out_file, sizeof out_file, out_file_fmt, (int)frame.conn_id);
+            int flags = O_WRONLY|O_CREAT|(created[frame.conn_id] ? O_APPEND : O_TRUNC);
+            int fd = open(out_file, flags, 0666);
+            if (fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+                for (size_t i = 0; i < nfds; ++i) {
+                    if (fds[i] >= 0) {
+                        close(fds[i]);
+                        fds[i] = -1;
+                    }
+                }
+                fd = open(out_file, flags, 0666);
+            }
+            if (fd < 0) {
+                snprintf(errmsg, sizeof errmsg, "Cannot open output file '%s': %s", out_file, strerror(errno));
+                goto done;
+            }
+            if (! created[frame.conn_id])
+                ++connections;
+            fds[frame.conn_id] = fd;
+            created[frame.conn_id] = 1;
+        }
+        /* Copy chunk data */
+        size_t remaining = frame.len;
+        while (remaining > 0) {
+            size_t want = remaining < sizeof buf ? remaining : sizeof buf;
+            if (fread(buf, 1, want, f) != want) {
+                snprintf(errmsg, sizeof errmsg, "Truncated data in chunk #%zu of connection %u",
+                    chunks + 1, (unsigned)frame.conn_id);
+                goto done;
+            }
+            char* now = buf;
+            while (want > 0) {
+                ssize_t wlen = write(fds[frame.conn_id], now, want);
+                if (wlen < 0) {
+                    snprintf(errmsg, sizeof errmsg, "Cannot write output file of connection %u: %s",
+                        (unsigned)frame.conn_id, strerror(errno));
+                    goto done;
+                }
+                want -= wlen;
+                now += wlen;
+                remaining -= wlen;
+            }
+        }
+        bytes += frame.len;
+        ++chunks;
+    }
+    if (rlen != 0)
+        snprintf(errmsg, sizeof errmsg, "Truncated frame header after chunk #%zu", chunks);
+    else if (ferror(f))
+        snprintf(errmsg, sizeof errmsg, "Cannot read log file '%s'", log_file);
+done:
+    for (size_t i = 0; i < nfds; ++i) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    free(fds);
+    free(created);
+    fclose(f);
+    if (errmsg[0] != '\0') {
         lua_pushnil(L);
         lua_pushstring(L, errmsg);
         return 2;
     }
-    /* Wait until all threads are blocked by the barrier, then start all */
-    pthread_barrier_wait(&barrier);
-    /* Join all threads and generate results table */
-    lua_createtable(L, num_conns, 0);
-    lua_Integer i = 0;
-    for (struct ms_conn* c = conns; c != NULL; c = c->prev) {
-        ++i;
-        /* Join sender thread */
-        pthread_join(c->sender.thread, NULL);
-        if (! c->sender.successful) {
-            /* Sender failed, receiver probably hangs - cancel it */
-            // pthread_cancel(c->receiver.thread); /* Doesn't seem to work without special libc */
-            lua_pushstring(L, c->sender.errmsg);
-            lua_rawseti(L, -2, i);
-            continue;
-        } else {
-            /* Join receiver thread */
-            pthread_join(c->receiver.thread, NULL);
-            if (! c->receiver.successful) {
-                lua_pushstring(L, c->receiver.errmsg);
-                lua_rawseti(L, -2, i);
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, connections);
+    lua_setfield(L, -2, "connections");
+    lua_pushinteger(L, chunks);
+    lua_setfield(L, -2, "chunks");
+    lua_pushinteger(L, bytes);
+    lua_setfield(L, -2, "bytes");
+    return 1;
+}
+
+/*
+** Offline analyzer for recorded response files. Every file is mapped into memory
+** and split into responses by the same parser the receiver threads use. Files
+** are distributed over a number of worker threads, one file at a time.
+*/
+#define AN_MAX_STATUS   16              /* Distinct status codes recorded per file */
+#define AN_SIZE_BUCKETS 48              /* Response sizes by powers of two */
+
+struct an_file {
+    const char* path;
+    size_t bytes;                       /* File size */
+    size_t responses;                   /* Complete responses */
+    uint64_t min_size, max_size, sum_size;
+    size_t size_hist[AN_SIZE_BUCKETS];  /* size_hist[i] counts responses with 2^i <= size < 2^(i+1) */
+    int status_code[AN_MAX_STATUS];
+    size_t status_count[AN_MAX_STATUS];
+    size_t nstatus;
+    size_t status_other;                /* Responses with status codes that did not fit */
+    int truncated;                      /* File ended within a response */
+    size_t tail_bytes;                  /* Bytes of incomplete response at the end */
+    size_t error_offset;                /* Offset of framing error */
+    char error[256];                    /* Framing or I/O error, empty if none */
+};
+
+struct an_work {
+    struct an_file* files;
+    size_t nfiles;
+    size_t next;                        /* Next file to analyze, taken atomically */
+};
+
+static void an_count(struct an_file* af, const struct rp_parser* p)
+{
+    ++af->responses;
+    uint64_t size = p->res_length;
+    if (af->responses == 1 || size < af->min_size)
+        af->min_size = size;
+    if (size > af->max_size)
+        af->max_size = size;
+    af->sum_size += size;
+    size_t bucket = 0;
+    while (bucket + 1 < AN_SIZE_BUCKETS && (size >> (bucket + 1)) != 0)
+        ++bucket;
+    ++af->size_hist[bucket];
+    for (size_t i = 0; i < af->nstatus; ++i) {
+        if (af->status_code[i] == p->res_status) {
+            ++af->status_count[i];
+            return;
+        }
+    }
+    if (af->nstatus < AN_MAX_STATUS) {
+        af->status_code[af->nstatus] = p->res_status;
+        af->status_count[af->nstatus] = 1;
+        ++af->nstatus;
+    } else {
+        ++af->status_other;
+    }
+}
+
+static void an_file_run(struct an_file* af)
+{
+    int fd = open(af->path, O_RDONLY);
+    if (fd < 0) {
+        snprintf(af->error, sizeof af->error, "Cannot open '%s': %s", af->path, strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        snprintf(af->error, sizeof af->error, "Cannot stat '%s': %s", af->path, strerror(errno));
+        close(fd);
+        return;
+    }
+    af->bytes = st.st_size;
+    if (af->bytes == 0) {
+        close(fd);
+        return;
+    }
+    char* data = mmap(NULL, af->bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        snprintf(af->error, sizeof af->error, "Cannot mmap '%s': %s", af->path, strerror(errno));
+        return;
+    }
+    madvise(data, af->bytes, MADV_SEQUENTIAL);
+    struct rp_parser* p = malloc(sizeof *p);
+    if (p == NULL) {
+        snprintf(af->error, sizeof af->error, "Out of memory");
+        munmap(data, af->bytes);
+        return;
+    }
+    rp_init(p, 0);
+    size_t pos = 0, response_start = 0;
+    while (pos < af->bytes) {
+        size_t used;
+        int result = rp_feed(p, data + pos, af->bytes - pos, &used);
+        pos += used;
+        if (result == RP_DONE) {
+            an_count(af, p);
+            response_start = pos;
+        } else if (result == RP_FAIL) {
+            af->error_offset = pos;
+            snprintf(af->error, sizeof af->error, "%s", p->errmsg);
+            break;
+        }
+    }
+    if (af->error[0] == '\0') {
+        int result = rp_finish(p);
+        if (result == RP_DONE) {
+            an_count(af, p);
+        } else if (result == RP_FAIL) {
+            af->truncated = 1;
+            af->tail_bytes = af->bytes - response_start;
+        }
+    }
+    free(p);
+    munmap(data, af->bytes);
+}
+
+static void* an_worker_thread(struct an_work* work)
+{
+    for (;;) {
+        size_t i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED);
+        if (i >= work->nfiles)
+            break;
+        an_file_run(&work->files[i]);
+    }
+    return NULL;
+}
+
+/*
+** Parse recorded response files in parallel.
+**
+** analyze_files(files [, num_threads])
+**   files (table)          Sequence of file names.
+**   num_threads (integer)  Number of worker threads, defaults to the number of online CPUs.
+** Returns a table with one entry per file, with the keys file (string), bytes, responses,
+** min_size, max_size, sum_size (all integer), sizes (table mapping the lower bound of each
+** power-of-two size bucket to its count), status (table mapping status code to count),
+** status_other (integer), truncated (bool), tail_bytes (integer), and error, error_offset
+** if a framing error occurred. The second return value is the number of threads used.
+*/
+static int lcf_analyze_files(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_Integer nthreads = luaL_optinteger(L, 2, sysconf(_SC_NPROCESSORS_ONLN));
+    size_t nfiles = lua_rawlen(L, 1);
+    if (nthreads < 1)
+        nthreads = 1;
+    if ((size_t)nthreads > nfiles)
+        nthreads = nfiles ? (lua_Integer)nfiles : 1;
+    struct an_work work;
+    work.nfiles = nfiles;
+    work.next = 0;
+    work.files = calloc(nfiles ? nfiles : 1, sizeof *work.files);
+    if (work.files == NULL)
+        return luaL_error(L, "out of memory");
+    /* File names stay referenced by the table at index 1 */
+    for (size_t i = 0; i < nfiles; ++i) {
+        lua_rawgeti(L, 1, i + 1);
+        work.files[i].path = lua_tostring(L, -1);
+        lua_pop(L, 1);
+        if (work.files[i].path == NULL) {
+            free(work.files);
+            return luaL_error(L, "file name #%d is not a string", (int)(i + 1));
+        }
+    }
+    /* Analyze on worker threads, fall back to the current thread */
+    pthread_t* threads = calloc(nthreads, sizeof *threads);
+    lua_Integer started = 0;
+    while (threads != NULL && started < nthreads) {
+        if (pthread_create(&threads[started], NULL, (void*(*)(void*))an_worker_thread, &work) != 0)
+            break;
+        ++started;
+    }
+    if (started == 0)
+        an_worker_thread(&work);
+    for (lua_Integer t = 0; t < started; ++t)
+        pthread_join(threads[t], NULL);
+    free(threads);
+    /* Generate results table */
+    lua_createtable(L, nfiles, 0);
+    for (size_t i = 0; i < nfiles; ++i) {
+        struct an_file* af = &work.files[i];
+        lua_createtable(L, 0, 16);
+        lua_pushstring(L, af->path);
+        lua_setfield(L, -2, "file");
+        lua_pushinteger(L, af->bytes);
+        lua_setfield(L, -2, "bytes");
+        lua_pushinteger(L, af->responses);
+        lua_setfield(L, -2, "responses");
+        lua_pushinteger(L, af->min_size);
+        lua_setfield(L, -2, "min_size");
+        lua_pushinteger(L, af->max_size);
+        lua_setfield(L, -2, "max_size");
+        lua_pushinteger(L, af->sum_size);
+        lua_setfield(L, -2, "sum_size");
+        lua_newtable(L);
+        for (size_t b = 0; b < AN_SIZE_BUCKETS; ++b) {
+            if (af->size_hist[b] == 0)
                 continue;
-            }
+            lua_pushinteger(L, af->size_hist[b]);
+            lua_rawseti(L, -2, b == 0 ? 0 : ((lua_Integer)1 << b));
         }
-        /* Threads were successful, add table with results */
-        lua_createtable(L, 0, 3);
-        lua_pushinteger(L, c->in_len);
-        lua_setfield(L, -2, "total_sent");
-        lua_pushinteger(L, c->recv_total);
-        lua_setfield(L, -2, "total_received");
-        lua_pushnumber(L, (c->connect_start.tv_sec * 1.0e9 + c->connect_start.tv_nsec));
-        lua_setfield(L, -2, "connect_start_ns");
-        lua_pushnumber(L, (c->connect_end.tv_sec * 1.0e9 + c->connect_end.tv_nsec));
-        lua_setfield(L, -2, "connect_end_ns");
-        lua_pushnumber(L, (c->send_start.tv_sec * 1.0e9 + c->send_start.tv_nsec));
-        lua_setfield(L, -2, "send_start_ns");
-        lua_pushnumber(L, (c->send_end.tv_sec * 1.0e9 + c->send_end.tv_nsec));
-        lua_setfield(L, -2, "send_end_ns");
-        lua_pushnumber(L, (c->receive_start.tv_sec * 1.0e9 + c->receive_start.tv_nsec));
-        lua_setfield(L, -2, "receive_start_ns");
-        lua_pushnumber(L, (c->receive_end.tv_sec * 1.0e9 + c->receive_end.tv_nsec));
-        lua_setfield(L, -2, "receive_end_ns");
-        lua_rawseti(L, -2, i);
+        lua_setfield(L, -2, "sizes");
+        lua_createtable(L, 0, af->nstatus);
+        for (size_t s = 0; s < af->nstatus; ++s) {
+            lua_pushinteger(L, af->status_count[s]);
+            lua_rawseti(L, -2, af->status_code[s]);
+        }
+        lua_setfield(L, -2, "status");
+        lua_pushinteger(L, af->status_other);
+        lua_setfield(L, -2, "status_other");
+        lua_pushboolean(L, af->truncated);
+        lua_setfield(L, -2, "truncated");
+        lua_pushinteger(L, af->tail_bytes);
+        lua_setfield(L, -2, "tail_bytes");
+        if (af->error[0] != '\0') {
+            lua_pushstring(L, af->error);
+            lua_setfield(L, -2, "error");
+            lua_pushinteger(L, af->error_offset);
+            lua_setfield(L, -2, "error_offset");
+        }
+        lua_rawseti(L, -2, i + 1);
     }
-    ms_destroy_conns(conns, 0);
-    pthread_barrier_destroy(&barrier);
+    free(work.files);
+    lua_pushinteger(L, started ? started : 1);
+    return 2;
+}
+
+/*
+** Minimal blocking TCP socket functions for the coordinator and agents.
+**
+** tcp_connect(host, port)  Returns connected socket, or nil and an error message.
+** tcp_listen(host, port)   Returns listening socket on host (nil for all addresses),
+**                          or nil and an error message.
+** tcp_accept(fd)           Returns accepted socket and peer address, or nil and an error message.
+** sock_send(fd, data)      Sends all of data. Returns true, or nil and an error message.
+** sock_recv(fd, len, timeout_ms)  Returns exactly len bytes, or nil and an error message
+**                          if the connection fails or is closed before, or if no data
+**                          arrives for timeout_ms (optional, default: wait forever).
+** sock_close(fd)           Closes socket.
+**
+** Connected sockets use TCP keep-alive probes, so that a peer host which went away is
+** noticed within about half a minute even without a timeout.
+*/
+
+/* Options of coordinator and agent sockets */
+static void ms_sock_setup(int fd)
+{
+    int one = 1, idle = 10, interval = 5, count = 3;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof one);
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof idle);
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof interval);
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof count);
+}
+
+static int lcf_tcp_connect(lua_State* L)
+{
+    const char* host = luaL_checkstring(L, 1);
+    const char* port = luaL_checkstring(L, 2);
+    char errmsg[256];
+    int fd = connecttcpsock(AF_UNSPEC, host, port, errmsg, sizeof errmsg, 0, 1, 0);
+    if (fd < 0) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Cannot connect to %s:%s: %s", host, port, errmsg);
+        return 2;
+    }
+    ms_sock_setup(fd);
+    lua_pushinteger(L, fd);
+    return 1;
+}
+
+static int lcf_tcp_listen(lua_State* L)
+{
+    const char* host = luaL_optstring(L, 1, NULL);
+    const char* port = luaL_checkstring(L, 2);
+    char errmsg[256];
+    int fd = listentcpsock(AF_UNSPEC, host, port, errmsg, sizeof errmsg, 1);
+    if (fd < 0) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Cannot listen on %s:%s: %s", host ? host : "*", port, errmsg);
+        return 2;
+    }
+    lua_pushinteger(L, fd);
+    return 1;
+}
+
+static int lcf_tcp_accept(lua_State* L)
+{
+    int lfd = (int)luaL_checkinteger(L, 1);
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof addr;
+    int fd;
+    while ((fd = accept4(lfd, (struct sockaddr*)&addr, &addrlen, SOCK_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    if (fd < 0) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "accept failed: %s", strerror(errno));
+        return 2;
+    }
+    ms_sock_setup(fd);
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    if (getnameinfo((struct sockaddr*)&addr, addrlen, host, sizeof host, port, sizeof port,
+                    NI_NUMERICHOST|NI_NUMERICSERV) != 0)
+        snprintf(host, sizeof host, "?");
+    lua_pushinteger(L, fd);
+    lua_pushfstring(L, "%s:%s", host, port);
+    return 2;
+}
+
+static int lcf_sock_send(lua_State* L)
+{
+    int fd = (int)luaL_checkinteger(L, 1);
+    size_t len;
+    const char* data = luaL_checklstring(L, 2, &len);
+    while (len > 0) {
+        ssize_t slen = send(fd, data, len, MSG_NOSIGNAL);
+        if (slen < 0) {
+            if (errno == EINTR)
+                continue;
+            lua_pushnil(L);
+            lua_pushfstring(L, "send failed: %s", strerror(errno));
+            return 2;
+        }
+        data += slen;
+        len -= slen;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int lcf_sock_recv(lua_State* L)
+{
+    int fd = (int)luaL_checkinteger(L, 1);
+    lua_Integer len = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, len >= 0, 2, "length must not be negative");
+    int timeout_ms = (int)luaL_optinteger(L, 3, -1);
+    luaL_Buffer b;
+    char* buf = luaL_buffinitsize(L, &b, (size_t)len);
+    size_t have = 0;
+    while (have < (size_t)len) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready <= 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, ready == 0 ? "timed out" : strerror(errno));
+            return 2;
+        }
+        ssize_t rlen = recv(fd, buf + have, (size_t)len - have, 0);
+        if (rlen < 0 && errno == EINTR)
+            continue;
+        if (rlen <= 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, rlen == 0 ? "connection closed by peer" : strerror(errno));
+            return 2;
+        }
+        have += rlen;
+    }
+    luaL_pushresultsize(&b, have);
+    return 1;
+}
+
+static int lcf_sock_close(lua_State* L)
+{
+    close((int)luaL_checkinteger(L, 1));
+    return 0;
+}
+
+/*
+** cpu_affinity(pid)
+**   pid (integer)          Process ID, or 0 for this process.
+** Returns the CPUs the process may run on as CPU list like "0-3,8", or nil and an error message.
+*/
+static int lcf_cpu_affinity(lua_State* L)
+{
+    pid_t pid = (pid_t)luaL_checkinteger(L, 1);
+    cpu_set_t set;
+    if (sched_getaffinity(pid, sizeof set, &set) < 0) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "Cannot get CPU affinity of PID %d: %s", (int)pid, strerror(errno));
+        return 2;
+    }
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+        if (! CPU_ISSET(c, &set) || (c > 0 && CPU_ISSET(c - 1, &set)))
+            continue;
+        int last = c;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set))
+            ++last;
+        if (luaL_bufflen(&b) > 0)
+            luaL_addchar(&b, ',');
+        lua_pushfstring(L, last > c ? "%d-%d" : "%d", c, last);
+        luaL_addvalue(&b);
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/*
+** find_processes(name)
+**   name (string)          Command name as in /proc/PID/comm, e.g. "nginx".
+** Returns a sorted sequence of the IDs of all other processes with this name.
+*/
+static int lcf_find_processes(lua_State* L)
+{
+    const char* name = luaL_checkstring(L, 1);
+    lua_newtable(L);
+    DIR* dir = opendir("/proc");
+    if (dir == NULL)
+        return 1;
+    /* Directory order is not numeric, so collect first */
+    pid_t* found = NULL;
+    size_t nfound = 0, cap = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char* end;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0 || pid == (long)getpid())
+            continue;
+        char path[300], comm[64];
+        snprintf(path, sizeof path, "/proc/%s/comm", entry->d_name);
+        if (ms_read_proc(path, comm, sizeof comm) <= 0)
+            continue;
+        comm[strcspn(comm, "\n")] = '\0';
+        if (strcmp(comm, name) != 0)
+            continue;
+        if (nfound == cap) {
+            pid_t* grown = realloc(found, (cap = cap ? cap * 2 : 16) * sizeof *found);
+            if (grown == NULL)
+                break;
+            found = grown;
+        }
+        found[nfound++] = (pid_t)pid;
+    }
+    closedir(dir);
+    for (size_t i = 1; i < nfound; ++i) {
+        pid_t pid = found[i];
+        size_t j = i;
+        for (; j > 0 && found[j - 1] > pid; --j)
+            found[j] = found[j - 1];
+        found[j] = pid;
+    }
+    for (size_t i = 0; i < nfound; ++i) {
+        lua_pushinteger(L, found[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    free(found);
     return 1;
 }
 
-static int lcf_cputime_ns(lua_State* L)
+static int lcf_monotonic_ns(lua_State* L)
 {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -472,10 +5332,30 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
     luaL_openlibs(L);
-    lua_pushcfunction(L, lcf_cputime_ns);
-    lua_setglobal(L, "cputime_ns");
+    lua_pushcfunction(L, lcf_monotonic_ns);
+    lua_setglobal(L, "monotonic_ns");
     lua_pushcfunction(L, lcf_multi_sendfile);
     lua_setglobal(L, "multi_sendfile");
+    lua_pushcfunction(L, lcf_log_extract);
+    lua_setglobal(L, "log_extract");
+    lua_pushcfunction(L, lcf_analyze_files);
+    lua_setglobal(L, "analyze_files");
+    lua_pushcfunction(L, lcf_tcp_connect);
+    lua_setglobal(L, "tcp_connect");
+    lua_pushcfunction(L, lcf_tcp_listen);
+    lua_setglobal(L, "tcp_listen");
+    lua_pushcfunction(L, lcf_tcp_accept);
+    lua_setglobal(L, "tcp_accept");
+    lua_pushcfunction(L, lcf_sock_send);
+    lua_setglobal(L, "sock_send");
+    lua_pushcfunction(L, lcf_sock_recv);
+    lua_setglobal(L, "sock_recv");
+    lua_pushcfunction(L, lcf_sock_close);
+    lua_setglobal(L, "sock_close");
+    lua_pushcfunction(L, lcf_cpu_affinity);
+    lua_setglobal(L, "cpu_affinity");
+    lua_pushcfunction(L, lcf_find_processes);
+    lua_setglobal(L, "find_processes");
     lua_pushinteger(L, argc);
     lua_createtable(L, argc, 0);
     for (int i = 0; i < argc; ++i) {
@@ -4,7 +4,17 @@
 local argc, argv = ...
 local help = [=[
 sockbiter - HTTP/1.1 load generator and server analyzer
-Usage: sockbiter [options] http://hostname[:port][/path]
+Usage: sockbiter [options] http://hostname[:port][/path] [[options] URI...]
+       (the path may contain template placeholders, see -template)
+       sockbiter extract logfile|storedir [format]
+       sockbiter analyze [-j threads] [-human] [files...]
+       sockbiter agent -listen [host:]port
+
+Several URIs can be benchmarked at once; their connections start together
+and results are grouped per URI. Options apply to the following URI and the
+ones after it until given again, except for -template, -mix, -requests,
+-body, -chunked and -replay, which only apply to the next URI. Response
+recording and output options apply to all URIs.
 
 Options:
     -c conns         Number of parallel connections.
@@ -12,12 +22,129 @@ Options:
     -nocheck         Do not store received responses.
                      This option is useful when the disk is too slow to
                      store responses without introducing delays.
+    -log file        Record all responses into a single log file instead
+                     of one file per connection. Use "extract" to split
+                     it into per-connection files (default format:
+                     responses-%d.txt).
+    -dedup dir       Record responses into a deduplicating store: only the
+                     first occurrence of each distinct response (ignoring
+                     Date-like headers) is written, plus an index of runs
+                     of identical responses per connection. "extract"
+                     rebuilds the per-connection files from it. Each
+                     connection buffers a whole response in memory.
+    -template file   Generate requests from a template file containing the
+                     request line and headers (without Connection header).
+                     Placeholders are expanded for every request:
+                       {{seq}}          Request number within connection
+                       {{gseq}}         Request number across connections
+                       {{conn}}         Connection ID
+                       {{rand:min:max}} Random integer of [min..max]
+                       {{rstr:len}}     Random string of [a-z0-9]
+                       {{pick:a|b|c}}   Randomly chosen alternative
+    -mix file        Send a weighted mix of requests instead of the URI path.
+                     Every line of the file contains a weight, an optional
+                     method and a path, which may contain placeholders:
+                       70 /api/items
+                       20 /search?q={{rstr:5}}
+                       10 HEAD /static/logo.png
+                     Results are reported per mix entry.
+    -seed n          Seed for random template values and mix (default: 1).
+    -method m        Request method for the URI path (default: GET).
+    -requests file   Send the raw requests of this file instead of generating
+                     them; the last request should close the connection.
+                     Can be given several times, and the name may contain %d
+                     to use the files numbered 1, 2, ... that exist. Files
+                     are assigned round-robin to the connections and results
+                     are grouped per file.
+    -body file       Send the file as request body of POST, PUT and PATCH
+                     requests with sendfile(). Can be given several times
+                     to use the bodies round-robin. Upload throughput is
+                     reported separately.
+    -chunked size    Send bodies with chunked transfer encoding in chunks of
+                     size bytes instead of with Content-Length.
+    -replay file     Replay an access log instead of sending -n requests.
+                     Accepts common/combined log format and JSON lines with
+                     method, path, headers and timestamp. Requests are
+                     distributed round-robin over the connections and sent
+                     at their original relative times; the lag behind this
+                     schedule is reported.
+    -speed x         Replay speed multiplier, e.g. 10 for ten times faster,
+                     or "max" to send as fast as possible (default: 1).
+    -agents list     Run the benchmark on agents started with "sockbiter agent"
+                     instead of locally. The list contains host:port pairs,
+                     separated by commas. Every agent runs all connections,
+                     all agents start at the same time, and their results
+                     are merged into one report. Agents run any benchmark
+                     they are sent, so only listen on trusted networks.
+    -procs p         Run the connections in p forked worker processes instead
+                     of one process, to spread file descriptors, threads and
+                     memory over several address spaces (default: 1).
+    -cpus list       Pin the threads of each connection to one of the listed
+                     CPUs, e.g. 0-3,8, assigned round-robin.
+    -avoid-pid pid   Keep threads off the CPUs the process pid (e.g. the
+                     server on the same host) may run on.
+    -numa            Spread connections round-robin over the NUMA nodes,
+                     running their threads and placing their memory on the
+                     node. Can be combined with -cpus and -avoid-pid, which
+                     then restrict the CPUs of every node.
+    -client-limit p  Warn when the sender and receiver threads of a connection
+                     use more than p percent of a CPU core, as the results are
+                     then bounded by the client (default: 50).
+    -server-pid p    Sample CPU, memory, threads, context switches, file
+                     descriptors and I/O of the server during the run. p is
+                     a process ID, a list like 120,121 or a process name,
+                     which selects all processes with that name.
+    -sample-interval ms
+                     Interval of server and TCP samples in ms (default: 100).
+    -server-threads  With -server-pid, also sample which connection socket
+                     every server thread reads or writes, to show which
+                     threads served which connections, how long they ran and
+                     waited for a CPU, and the threading model of the server.
+                     Needs permission to read /proc/PID/fd of the server.
+                     Only for a single URI.
+    -tcp-info        Sample TCP_INFO of every connection during the run and at
+                     its end, to show RTT, retransmits, congestion window,
+                     delivery rate and what limited sending, as seen by the
+                     client. Tells slow servers apart from lossy links.
+    -queues          Sample the send and receive queues of every connection
+                     during the run, to show over time whether request data
+                     waits for the server or the network, or response data
+                     for the client. Use a small -sample-interval for short
+                     runs.
+    -progress        Print the throughput, the connections active, finished
+                     and failed, and the estimated remaining time every
+                     second during the run. Ctrl-C ends a run early in any
+                     case, with the results of the finished connections.
+    -buckets ms      Count the bytes and responses of every connection in
+                     time buckets of ms milliseconds (10 to 1000) and show
+                     the throughput over time with its minimum, maximum and
+                     standard deviation, to find drops like GC pauses.
+    -stalls ms[,percent]
+                     Record gaps of at least ms milliseconds between the
+                     responses of every connection and report the pauses of
+                     at least that long in which at least percent (default:
+                     90) of the active connections stalled at once, like GC
+                     pauses or lock convoys of the server.
+    -kernel-timestamps
+                     Use kernel timestamps (SO_TIMESTAMPING) of the last byte
+                     received, which exclude the delay until the receiver
+                     thread runs, and report when the last request byte was
+                     sent and acknowledged by the server.
+    -accept-queue    Sample the accept queue of the listening sockets of the
+                     server on the target ports of this host and the system
+                     counters of listen queue overflows and drops, to detect
+                     a listen backlog which is too small for the connections.
     -shutwr          Half-close connection after all data has been sent.
                      This can cause problems with some servers.
     -human           Use human-readable number formats to print results.
     -no-sample       Do not show sample request.
     -no-perconn      Do not show per-connection details.
     -no-timings      Do not show timing table.
+    -timing-rows n   Show one row per connection in the timing table up to n
+                     connections (default: 100). Beyond, connections with the
+                     same timeline share a row, and if there are still more
+                     than n rows, a heat-map shows the share of connections
+                     in each phase instead.
     -no-summary      Do not show summary.
 
 Timing diagram explanation:
@@ -32,11 +159,550 @@ if argc < 2 then
     print(help)
     return 1
 end
+
+-- Number formatting
+local function set_number_format(human)
+    if human then
+        function format_bytes(b)
+            local kb, mb, gb = b/1024, b/(1024*1024), b/(1024*1024*1024)
+            if b < 1024 then
+                return string.format("%12.2f B", b)
+            end
+            if kb < 1024 then
+                return string.format("%12.2f KB", kb)
+            end
+            if mb < 1024 then
+                return string.format("%12.2f MB", mb)
+            end
+            return string.format("%12.2f GB", gb)
+        end
+        function format_ns(ns, fmt)
+            fmt = fmt or "%12.2f"
+            local us, ms, s = ns/1.0e3, ns/1.0e6, ns/1.0e9
+            if ns < 1000 then
+                return string.format(fmt.." ns", ns)
+            end
+            if us < 1000 then
+                return string.format(fmt.." us", us)
+            end
+            if ms < 1000 then
+                return string.format(fmt.." ms", ms)
+            end
+            return string.format(fmt.." sec", s)
+        end
+        function format_rps(nreq, ns)
+            local rps = nreq / (ns / 1.0e9)
+            if rps > 1000 then
+                if rps > 1000000 then
+                    return string.format("%12.2f M", rps / 1000000)
+                else
+                    return string.format("%12.2f K", rps / 1000)
+                end
+            else
+                return string.format("%12.2f", rps)
+            end
+        end
+    else
+        function format_bytes(n)
+            return string.format("%12.2f B", n)
+        end
+        function format_ns(ns, fmt)
+            fmt = fmt or "%12.2f"
+            return string.format(fmt.." ms", ns / 1.0e6)
+        end
+        function format_rps(nreq, ns)
+            local rps = nreq / (ns / 1.0e9)
+            return string.format("%12.2f", rps)
+        end
+    end
+end
+function format_tp(b, ns)
+    return format_bytes(b / (ns / 1.0e9)).."/sec"
+end
+
+-- Rebuild per-connection files from a deduplicating response store.
+-- Returns nil if dir is not a store, otherwise the same values as log_extract.
+local function store_extract(dir, fmt)
+    local index = io.open(dir.."/index.txt", "rb")
+    if not index then
+        return nil
+    end
+    local stats = { connections = 0, chunks = 0, bytes = 0 }
+    local objects, out, out_id = {}, nil, nil
+    for line in index:lines() do
+        local id, hash, count = line:match("^(%d+) (%x+) (%d+)$")
+        if id then
+            if id ~= out_id then
+                if out then
+                    out:close()
+                end
+                out = io.open(string.format(fmt, tonumber(id)), "wb")
+                if not out then
+                    index:close()
+                    return nil, "Cannot open output file '"..string.format(fmt, tonumber(id)).."'"
+                end
+                out_id = id
+                stats.connections = stats.connections + 1
+            end
+            local data = objects[hash]
+            if not data then
+                local obj = io.open(dir.."/"..hash..".http", "rb")
+                if not obj then
+                    out:close()
+                    index:close()
+                    return nil, "Missing object "..hash.." in store '"..dir.."'"
+                end
+                data = obj:read("a")
+                obj:close()
+                objects[hash] = data
+            end
+            for _ = 1, tonumber(count) do
+                out:write(data)
+            end
+            stats.chunks = stats.chunks + 1
+            stats.bytes = stats.bytes + #data * tonumber(count)
+        end
+    end
+    if out then
+        out:close()
+    end
+    index:close()
+    return stats
+end
+
+-- Subcommand: split shared response log or store into per-connection files
+if argv[1] == "extract" then
+    if argc < 3 or argc > 4 then
+        print("Usage: sockbiter extract logfile|storedir [format]")
+        return 1
+    end
+    local fmt = argv[3] or "responses-%d.txt"
+    local stats, err = store_extract(argv[2], fmt)
+    if not stats and not err then
+        stats, err = log_extract(argv[2], fmt)
+    end
+    if not stats then
+        print("Extraction failed: "..tostring(err))
+        return 1
+    end
+    print("Extracted "..stats.bytes.." bytes in "..stats.chunks.." chunks for "
+        ..stats.connections.." connections into "..fmt)
+    return 0
+end
+
+-- Subcommand: parse recorded response files in parallel and report on them
+if argv[1] == "analyze" then
+    local files, nthreads, human = {}, nil, false
+    local i = 2
+    while i < argc do
+        if argv[i] == "-j" then
+            nthreads = argv[i + 1] and math.tointeger(tonumber(argv[i + 1]))
+            if not nthreads or nthreads <= 0 then
+                print("Error in option -j: Expected positive nonzero integer as number of threads")
+                return 1
+            end
+            i = i + 1
+        elseif argv[i] == "-human" then
+            human = true
+        else
+            table.insert(files, argv[i])
+        end
+        i = i + 1
+    end
+    -- Without file arguments, look for responses-1.txt, responses-2.txt, ...
+    if #files == 0 then
+        while true do
+            local name = string.format("responses-%d.txt", #files + 1)
+            local f = io.open(name, "rb")
+            if not f then
+                break
+            end
+            f:close()
+            table.insert(files, name)
+        end
+    end
+    if #files == 0 then
+        print("Error: No response files found")
+        return 1
+    end
+    set_number_format(human)
+    local start = monotonic_ns()
+    local analysis, used_threads = analyze_files(files, nthreads)
+    local stop = monotonic_ns()
+    -- Aggregate
+    local total_bytes, total_responses, sum_size, min_size, max_size = 0, 0, 0, nil, nil
+    local status, sizes, status_other = {}, {}, 0
+    local failed, truncated = 0, 0
+    for _, a in ipairs(analysis) do
+        total_bytes = total_bytes + a.bytes
+        total_responses = total_responses + a.responses
+        sum_size = sum_size + a.sum_size
+        if a.responses > 0 then
+            min_size = math.min(min_size or a.min_size, a.min_size)
+            max_size = math.max(max_size or a.max_size, a.max_size)
+        end
+        for code, n in pairs(a.status) do
+            status[code] = (status[code] or 0) + n
+        end
+        for bucket, n in pairs(a.sizes) do
+            sizes[bucket] = (sizes[bucket] or 0) + n
+        end
+        status_other = status_other + a.status_other
+        if a.error then
+            failed = failed + 1
+        end
+        if a.truncated then
+            truncated = truncated + 1
+        end
+    end
+    print("---------- Analysis ----------")
+    print("Analyzed "..#files.." file"..(#files == 1 and "" or "s").." with "..used_threads
+        .." thread"..(used_threads == 1 and "" or "s")..", "..format_ns(stop - start, "%.2f"))
+    print("Total bytes  . . . . . . . "..format_bytes(total_bytes))
+    print("Total responses  . . . . . "..string.format("%12d", total_responses))
+    print("Files with framing errors  "..string.format("%12d", failed))
+    print("Files with truncated tail  "..string.format("%12d", truncated))
+    if total_responses > 0 then
+        print("Smallest response  . . . . "..format_bytes(min_size))
+        print("Average response . . . . . "..format_bytes(sum_size / total_responses))
+        print("Largest response . . . . . "..format_bytes(max_size))
+        print("")
+        print("Status distribution:")
+        local codes = {}
+        for code in pairs(status) do
+            table.insert(codes, code)
+        end
+        table.sort(codes)
+        for _, code in ipairs(codes) do
+            print(string.format("  %3d %12d %7.2f%%", code, status[code], status[code] * 100 / total_responses))
+        end
+        if status_other > 0 then
+            print(string.format("  ??? %12d %7.2f%%  (too many distinct codes)", status_other, status_other * 100 / total_responses))
+        end
+        print("")
+        print("Size distribution:")
+        local buckets = {}
+        for bucket in pairs(sizes) do
+            table.insert(buckets, bucket)
+        end
+        table.sort(buckets)
+        for _, bucket in ipairs(buckets) do
+            local upper = bucket == 0 and 2 or bucket * 2
+            print("  "..format_bytes(bucket).." .. "..format_bytes(upper - 1)
+                ..string.format(" %12d %7.2f%%", sizes[bucket], sizes[bucket] * 100 / total_responses))
+        end
+    end
+    print("")
+    -- With many files, only list the ones with problems
+    local only_problems = #analysis > 100
+    print("Per-connection results"..(only_problems and " (only files with problems):" or ":"))
+    local name_len = 0
+    for _, a in ipairs(analysis) do
+        name_len = math.max(name_len, #a.file)
+    end
+    for _, a in ipairs(analysis) do
+        local state = "ok"
+        if a.error then
+            state = "framing error at offset "..a.error_offset..": "..a.error
+        elseif a.truncated then
+            state = "truncated tail of "..a.tail_bytes.." bytes"
+        end
+        if not only_problems or state ~= "ok" then
+            print(string.format("  %-"..name_len.."s %10d responses %s  %s", a.file, a.responses, format_bytes(a.bytes), state))
+        end
+    end
+    return (failed > 0 or truncated > 0) and 1 or 0
+end
+
+-- Messages between coordinator and agents: Lua values serialized as a table
+-- constructor, prefixed with their length as line of 10 digits
+local function serialize(v, out)
+    local t = type(v)
+    if t == "table" then
+        table.insert(out, "{")
+        for k, x in pairs(v) do
+            if type(x) ~= "function" then
+                table.insert(out, "[")
+                serialize(k, out)
+                table.insert(out, "]=")
+                serialize(x, out)
+                table.insert(out, ",")
+            end
+        end
+        table.insert(out, "}")
+    else
+        table.insert(out, string.format("%q", v))
+    end
+    return out
+end
+
+local function send_message(fd, v)
+    local s = table.concat(serialize(v, {}))
+    return sock_send(fd, string.format("%010d\n", #s)..s)
+end
+
+-- Messages carry the request and body files of a benchmark and its results
+local max_message_len = 1024 * 1024 * 1024
+-- Time to wait for a message, except for the results of a benchmark
+local message_timeout_ms = 60000
+
+-- Receive a message, waiting at most timeout_ms (optional) for its data. A message is a
+-- table constructor and evaluated without access to anything, with its number of
+-- instructions limited to a multiple of its size, so that it cannot hang the receiver.
+local function recv_message(fd, timeout_ms)
+    local header, err = sock_recv(fd, 11, timeout_ms)
+    if not header then
+        return nil, err
+    end
+    local len = math.tointeger(tonumber(header:sub(1, 10)))
+    if not len or len < 0 then
+        return nil, "Invalid message header"
+    end
+    if len > max_message_len then
+        return nil, "Message of "..len.." bytes is too large"
+    end
+    local s, err2 = sock_recv(fd, len, timeout_ms)
+    if not s then
+        return nil, err2
+    end
+    local chunk = load("return "..s, "=message", "t", {})
+    if not chunk then
+        return nil, "Invalid message"
+    end
+    debug.sethook(function() error("Message takes too long to evaluate", 0) end, "", 16 * len + 1000)
+    local ok, v = pcall(chunk)
+    debug.sethook()
+    if not ok or type(v) ~= "table" then
+        return nil, "Invalid message"
+    end
+    return v
+end
+
+-- Remove the local files of a benchmark
+local function remove_files(names)
+    for _, lname in pairs(names) do
+        os.remove(lname)
+    end
+end
+
+-- Store the files of a benchmark under local names with prefix. Returns a table of the
+-- local name of each file, or nil and an error message.
+local function store_files(files, prefix)
+    local names = {}
+    for name, data in pairs(files) do
+        local lname = prefix..name:gsub("[^%w%.%-]", "_")
+        local lf, err = io.open(lname, "wb")
+        local ok = false
+        if lf then
+            names[name] = lname
+            local wok, werr = lf:write(data)
+            local cok, cerr = lf:close()
+            ok, err = wok and cok, werr or cerr
+        end
+        if not ok then
+            remove_files(names)
+            return nil, "Cannot store "..name..": "..tostring(err)
+        end
+    end
+    return names
+end
+
+-- Settings of a benchmark which an agent takes from the coordinator, per target and for the
+-- whole run. Others, like log files, server processes or CPU sets, are never taken.
+local agent_target_keys = { "host", "port", "num_conns", "in_file", "template", "mix", "nreq", "seed", "replay",
+    "bodies", "chunk_size" }
+local agent_run_keys = { "procs", "sample_interval_ms", "tcp_info", "queues", "timestamps", "bucket_ms", "gap_ms" }
+
+-- Local names of the files list (a name or a sequence of names), which must all have been
+-- shipped, see store_files. Returns nil and an error message otherwise.
+local function shipped_files(list, names)
+    local local_names = {}
+    for k, name in ipairs(type(list) == "table" and list or { list }) do
+        local_names[k] = names[name]
+        if not local_names[k] then
+            return nil, "File '"..tostring(name).."' was not sent with the benchmark"
+        end
+    end
+    return type(list) == "table" and local_names or local_names[1]
+end
+
+-- Options of a benchmark sent by a coordinator, with only the allowed settings and the
+-- shipped files under their local names. Returns nil and an error message if invalid.
+local function agent_opts(sent, names)
+    if type(sent) ~= "table" or (sent.targets ~= nil and type(sent.targets) ~= "table") then
+        return nil, "Invalid benchmark settings"
+    end
+    local opts, err
+    for k, s in ipairs({ sent, table.unpack(sent.targets or {}) }) do
+        if type(s) ~= "table" then
+            return nil, "Invalid settings of target #"..k
+        end
+        local t = {}
+        for _, key in ipairs(agent_target_keys) do
+            t[key] = s[key]
+        end
+        -- With a template or mix, the input file is only the name of the requests
+        if not t.template and not t.mix then
+            t.in_file, err = shipped_files(t.in_file, names)
+            if not t.in_file then
+                return nil, err
+            end
+        end
+        if t.bodies ~= nil then
+            if type(t.bodies) ~= "table" then
+                return nil, "Invalid bodies of target #"..k
+            end
+            t.bodies, err = shipped_files(t.bodies, names)
+            if not t.bodies then
+                return nil, err
+            end
+        end
+        if k == 1 then
+            opts = t
+        else
+            opts.targets = opts.targets or {}
+            opts.targets[k - 1] = t
+        end
+    end
+    for _, key in ipairs(agent_run_keys) do
+        opts[key] = sent[key]
+    end
+    return opts
+end
+
+-- Serve one coordinator: answer pings and run the benchmarks it sends. Files the
+-- benchmark needs are shipped with it and stored under local names with prefix.
+-- Returns when the coordinator closes the connection, or nil and an error.
+local function agent_session(fd, prefix)
+    while true do
+        local msg, err = recv_message(fd, message_timeout_ms)
+        if not msg then
+            return err == "connection closed by peer" or nil, err
+        end
+        if msg.type == "ping" then
+            send_message(fd, { type = "pong", now = monotonic_ns() })
+        elseif msg.type == "run" then
+            local names, rerr = store_files(msg.files, prefix)
+            local results, opts
+            if names then
+                opts, rerr = agent_opts(msg.opts, names)
+            end
+            if opts then
+                -- Report readiness once all connections are set up, then wait for the start time
+                opts.ready = function()
+                    local m, err = send_message(fd, { type = "ready" })
+                    while m do
+                        m, err = recv_message(fd, message_timeout_ms)
+                        if m and m.type == "start" then
+                            return m.start_ns
+                        elseif m and m.type == "ping" then
+                            m, err = send_message(fd, { type = "pong", now = monotonic_ns() })
+                        elseif m then
+                            m, err = nil, "Unexpected message '"..tostring(m.type).."'"
+                        end
+                    end
+                    error("Coordinator: "..tostring(err), 0)
+                end
+                print("Running benchmark of "..tostring(opts.host)..":"..tostring(opts.port)
+                    ..(opts.targets and " and "..#opts.targets.." more targets" or "").."...")
+                results, rerr = multi_sendfile(opts.in_file, prefix.."responses-%d.txt", opts.host, opts.port,
+                    opts.num_conns, msg.shutwr, msg.nocheck, opts)
+            end
+            if names then
+                remove_files(names)
+            end
+            print(results and "Benchmark finished" or "Benchmark failed: "..tostring(rerr))
+            local ok, serr = send_message(fd, { type = "results", results = results, err = rerr })
+            if not ok then
+                return nil, serr
+            end
+        else
+            return nil, "Unexpected message '"..tostring(msg.type).."'"
+        end
+    end
+end
+
+-- Subcommand: run benchmarks sent by a coordinator, see -agents
+if argv[1] == "agent" then
+    if argc ~= 4 or argv[2] ~= "-listen" then
+        print("Usage: sockbiter agent -listen [host:]port")
+        return 1
+    end
+    local host, port = argv[3]:match("^(.*):(%d+)$")
+    if not host then
+        port = argv[3]
+    end
+    local lfd, err = tcp_listen(host ~= "" and host or nil, port)
+    if not lfd then
+        print("Error: "..err)
+        return 1
+    end
+    print("Agent listening on "..argv[3])
+    while true do
+        local fd, peer = tcp_accept(lfd)
+        if not fd then
+            print("Error: "..peer)
+            return 1
+        end
+        print("Coordinator connected from "..peer)
+        local pok, ok, serr = pcall(agent_session, fd, "agent-"..port.."-")
+        if not pok then
+            ok, serr = nil, ok
+        end
+        print(ok and "Coordinator disconnected" or "Session failed: "..tostring(serr))
+        sock_close(fd)
+    end
+end
+
+-- Lists like "0-3,8" of CPUs or connections as sorted sequences of numbers and back
+local function parse_cpulist(s)
+    local seen, list = {}, {}
+    for item in s:gmatch("[^,]+") do
+        local lo, hi = item:match("^%s*(%d+)%s*$")
+        if lo then
+            hi = lo
+        else
+            lo, hi = item:match("^%s*(%d+)%-(%d+)%s*$")
+        end
+        if not lo or tonumber(hi) < tonumber(lo) then
+            return nil
+        end
+        for c = tonumber(lo), tonumber(hi) do
+            if not seen[c] then
+                seen[c] = true
+                table.insert(list, c)
+            end
+        end
+    end
+    table.sort(list)
+    return list, seen
+end
+
+local function format_ranges(list)
+    local parts, i = {}, 1
+    while i <= #list do
+        local j = i
+        while list[j + 1] == list[j] + 1 do
+            j = j + 1
+        end
+        table.insert(parts, j > i and list[i].."-"..list[j] or tostring(list[i]))
+        i = j + 1
+    end
+    return table.concat(parts, ",")
+end
+
 local options = {
-    nreq = 1, nconns = 1, nocheck = false, shutwr = false, human = false,
-    show_sample = true, show_conndetails = true, show_timings = true, show_summary = true,
+    nreq = 1, nconns = 1, nocheck = false, log = nil, dedup = nil, template = nil, mix = nil, seed = 1,
+    replay = nil, speed = 1, method = "GET", bodies = {}, chunk_size = 0, requests = {},
+    procs = 1, agents = nil, cpus = nil, avoid_pid = nil, numa = false, client_limit = 50, server_pid = nil, sample_interval = 100, server_threads = false, tcp_info = false, queues = false, progress = false, buckets = nil, stall_gap = nil, stall_share = 90, accept_queue = false, timestamps = false, shutwr = false, human = false,
+    show_sample = true, show_conndetails = true, show_timings = true, timing_rows = 100, show_summary = true,
 }
-local uri, option
+-- Options given before a URI apply to it and all following URIs until given again,
+-- except for the request sources which only apply to the next URI
+local targets, option = {}, nil
+local per_uri = { c = true, n = true, template = true, mix = true, seed = true, replay = true, speed = true,
+    method = true, body = true, chunked = true, requests = true }
+local trailing                          -- Option for the next URI given after the last one
 for i = 1, argc - 1 do
     if option then
         -- If option is set, this argument is the value for the option.
@@ -56,6 +722,124 @@ for i = 1, argc - 1 do
                 return 1
             end
             options.nreq = n
+        elseif option == "log" then
+            options.log = argv[i]
+        elseif option == "dedup" then
+            options.dedup = argv[i]
+        elseif option == "template" then
+            options.template = argv[i]
+        elseif option == "mix" then
+            options.mix = argv[i]
+        elseif option == "seed" then
+            local n = math.tointeger(tonumber(argv[i]))
+            if not n then
+                print("Error in option -seed: Expected integer, but got '"..argv[i].."'")
+                return 1
+            end
+            options.seed = n
+        elseif option == "replay" then
+            options.replay = argv[i]
+        elseif option == "speed" then
+            local n = tonumber(argv[i])
+            if argv[i] == "max" then
+                n = 0
+            elseif not n or n <= 0 then
+                print("Error in option -speed: Expected positive number or 'max', but got '"..argv[i].."'")
+                return 1
+            end
+            options.speed = n
+        elseif option == "method" then
+            if not argv[i]:match("^%u+$") then
+                print("Error in option -method: Expected upper-case method name, but got '"..argv[i].."'")
+                return 1
+            end
+            options.method = argv[i]
+        elseif option == "body" then
+            table.insert(options.bodies, argv[i])
+        elseif option == "requests" then
+            table.insert(options.requests, argv[i])
+        elseif option == "chunked" then
+            local n = tonumber(argv[i])
+            if math.type(n) ~= "integer" or n <= 0 then
+                print("Error in option -chunked: Expected positive nonzero integer"
+                    .." as chunk size, but got '"..argv[i].."'")
+                return 1
+            end
+            options.chunk_size = n
+        elseif option == "procs" then
+            local n = tonumber(argv[i])
+            if math.type(n) ~= "integer" or n <= 0 then
+                print("Error in option -procs: Expected positive nonzero integer"
+                    .." as number of processes, but got '"..argv[i].."'")
+                return 1
+            end
+            options.procs = n
+        elseif option == "client-limit" then
+            local n = tonumber(argv[i])
+            if not n or n <= 0 then
+                print("Error in option -client-limit: Expected positive percentage, but got '"..argv[i].."'")
+                return 1
+            end
+            options.client_limit = n
+        elseif option == "server-pid" then
+            options.server_pid = argv[i]
+        elseif option == "sample-interval" then
+            local n = tonumber(argv[i])
+            if math.type(n) ~= "integer" or n <= 0 then
+                print("Error in option -sample-interval: Expected positive nonzero integer"
+                    .." as interval in ms, but got '"..argv[i].."'")
+                return 1
+            end
+            options.sample_interval = n
+        elseif option == "buckets" then
+            local n = tonumber(argv[i])
+            if math.type(n) ~= "integer" or n < 10 or n > 1000 then
+                print("Error in option -buckets: Expected bucket length from 10 to 1000 ms, but got '"..argv[i].."'")
+                return 1
+            end
+            options.buckets = n
+        elseif option == "timing-rows" then
+            local n = tonumber(argv[i])
+            if math.type(n) ~= "integer" or n < 0 then
+                print("Error in option -timing-rows: Expected number of rows, but got '"..argv[i].."'")
+                return 1
+            end
+            options.timing_rows = n
+        elseif option == "stalls" then
+            local gap, share = argv[i]:match("^(%d+)$"), nil
+            if not gap then
+                gap, share = argv[i]:match("^(%d+),(%d+)$")
+            end
+            gap, share = tonumber(gap), tonumber(share or options.stall_share)
+            if not gap or gap <= 0 or share <= 0 or share > 100 then
+                print("Error in option -stalls: Expected gap in ms and optionally a percentage like 20,50, but got '"
+                    ..argv[i].."'")
+                return 1
+            end
+            options.stall_gap, options.stall_share = gap, share
+        elseif option == "cpus" then
+            if not argv[i]:match("^%d[%d,%-]*$") or not parse_cpulist(argv[i]) then
+                print("Error in option -cpus: Expected CPU list like 0-3,8, but got '"..argv[i].."'")
+                return 1
+            end
+            options.cpus = argv[i]
+        elseif option == "avoid-pid" then
+            local n = tonumber(argv[i])
+            if math.type(n) ~= "integer" or n <= 0 then
+                print("Error in option -avoid-pid: Expected process ID, but got '"..argv[i].."'")
+                return 1
+            end
+            options.avoid_pid = n
+        elseif option == "agents" then
+            options.agents = {}
+            for item in argv[i]:gmatch("[^,]+") do
+                local host, port = item:match("^(.+):(%d+)$")
+                if not host then
+                    print("Error in option -agents: Expected host:port, but got '"..item.."'")
+                    return 1
+                end
+                table.insert(options.agents, { host = host, port = port, label = item })
+            end
         end
         option = nil
     elseif argv[i]:sub(1, 1) == "-" then
@@ -71,6 +855,20 @@ for i = 1, argc - 1 do
             options.shutwr = true
         elseif op == "human" then
             options.human = true
+        elseif op == "numa" then
+            options.numa = true
+        elseif op == "server-threads" then
+            options.server_threads = true
+        elseif op == "tcp-info" then
+            options.tcp_info = true
+        elseif op == "queues" then
+            options.queues = true
+        elseif op == "progress" then
+            options.progress = true
+        elseif op == "accept-queue" then
+            options.accept_queue = true
+        elseif op == "kernel-timestamps" then
+            options.timestamps = true
         elseif op == "no-sample" then
             options.show_sample = false
         elseif op == "no-perconn" then
@@ -79,179 +877,1075 @@ for i = 1, argc - 1 do
             options.show_timings = false
         elseif op == "no-summary" then
             options.show_summary = false
-        elseif op == "c" or op == "n" then
+        elseif op == "c" or op == "n" or op == "log" or op == "dedup" or op == "template" or op == "mix" or op == "seed"
+                or op == "replay" or op == "speed" or op == "method" or op == "body" or op == "chunked"
+                or op == "requests" or op == "procs" or op == "agents" or op == "cpus" or op == "avoid-pid"
+                or op == "client-limit" or op == "server-pid" or op == "sample-interval" or op == "buckets" or op == "stalls" or op == "timing-rows" then
             option = op
+            if per_uri[op] then
+                trailing = argv[i]
+            end
         else
             print("Error: Unknown option '"..argv[i].."'.")
             print("To show a list of all options, use --help")
             return 1
         end
     else
-        -- If it is neither an option nor an argument, it is the URI.
-        uri = argv[i]
-        break
+        -- If it is neither an option nor an argument, it is a URI.
+        local copy = {}
+        for k, v in pairs(options) do
+            copy[k] = v
+        end
+        table.insert(targets, { uri = argv[i], options = copy })
+        options.template, options.mix, options.replay = nil, nil, nil
+        options.bodies, options.requests, options.chunk_size = {}, {}, 0
+        trailing = nil
     end
 end
 if option then
     print("Error: Missing value for option '"..option.."'")
     return 1
 end
-if not uri then
+if #targets == 0 then
     print("Error: URI is missing")
     return 1
 end
-
--- Extract and validate URI parts
-if uri:sub(1, 7) ~= "http://" then
-    print("Error: Expected URI starting with 'http://' but got '"..uri.."'")
+if trailing then
+    print("Error: Option '"..trailing.."' after the last URI would not apply to any URI")
     return 1
 end
-local uri_noproto = uri:sub(8)
-local port_start, target_start
-for i = 1, #uri_noproto do
-    local c = uri_noproto:sub(i, i)
-    if c == ":" and not port_start then
-        port_start = i
-    end
-    if c == "/" then
-        target_start = i
-        break
+-- Response checking and reporting options apply to the whole run
+for _, t in ipairs(targets) do
+    for _, k in ipairs({ "nocheck", "log", "dedup", "shutwr", "human",
+            "show_sample", "show_conndetails", "show_timings", "show_summary" }) do
+        t.options[k] = options[k]
     end
 end
-local host, port, target = uri_noproto, "80", "/"
-if port_start then
-    port = target_start and uri_noproto:sub(port_start + 1, target_start - 1) or uri_noproto:sub(port_start + 1)
-    host = uri_noproto:sub(1, port_start - 1)
+if options.log and options.dedup then
+    print("Error: Options -log and -dedup cannot be combined")
+    return 1
+end
+if options.nocheck and (options.log or options.dedup) then
+    print("Error: Option -nocheck cannot be combined with -log or -dedup")
+    return 1
 end
-if target_start then
-    target = uri_noproto:sub(target_start)
-    if not port_start then
-        host = uri_noproto:sub(1, target_start - 1)
-    end
+if options.procs > 1 and options.dedup then
+    print("Error: Options -procs and -dedup cannot be combined")
+    return 1
+end
+if options.agents and (options.log or options.dedup) then
+    print("Error: Option -agents cannot be combined with -log or -dedup")
+    return 1
+end
+if options.agents and (options.cpus or options.avoid_pid or options.numa) then
+    print("Error: Option -agents cannot be combined with -cpus, -avoid-pid or -numa")
+    return 1
+end
+if options.agents and (options.server_pid or options.accept_queue or options.progress) then
+    print("Error: Option -agents cannot be combined with -server-pid, -accept-queue or -progress")
+    return 1
 end
-if host == "" then
-    print("Error: Host name is empty")
+if options.server_threads and not options.server_pid then
+    print("Error: Option -server-threads needs -server-pid")
     return 1
 end
-local intport = math.tointeger(port)
-if not intport or intport < 0 or intport > 65535 then
-    print("Error: Expected port to be integer of [0..65535], but got '"..port.."'")
+-- Server sockets are matched to connections by the client's local port alone, which
+-- connections to different targets may share
+if options.server_threads and #targets > 1 then
+    print("Error: Option -server-threads cannot be combined with several URIs")
     return 1
 end
-port = tostring(intport)
+local upload_methods = { POST = true, PUT = true, PATCH = true }
+for _, t in ipairs(targets) do
+    local options = t.options
+    if options.template and options.mix then
+        print("Error: Options -template and -mix cannot be combined")
+        return 1
+    end
+    if options.replay and (options.template or options.mix or #options.bodies > 0) then
+        print("Error: Option -replay cannot be combined with -template, -mix or -body")
+        return 1
+    end
+    if #options.bodies > 0 and not options.mix and not options.template and not upload_methods[options.method] then
+        print("Error: Option -body needs -method POST, PUT or PATCH")
+        return 1
+    end
+    if #options.requests > 0 and (options.template or options.mix or options.replay or #options.bodies > 0) then
+        print("Error: Option -requests cannot be combined with -template, -mix, -replay or -body")
+        return 1
+    end
+    if options.chunk_size > 0 and #options.bodies == 0 then
+        print("Error: Option -chunked needs -body")
+        return 1
+    end
+end
 
 -- Number formatting
-if options.human then
-    function format_bytes(b)
-        local kb, mb, gb = b/1024, b/(1024*1024), b/(1024*1024*1024)
-        if b < 1024 then
-            return string.format("%12.2f B", b)
+set_number_format(options.human)
+
+-- Days since 1970-01-01 of a proleptic Gregorian calendar date
+local function days_from_civil(y, m, d)
+    y = m <= 2 and y - 1 or y
+    local era = (y >= 0 and y or y - 399) // 400
+    local yoe = y - era * 400
+    local doy = (153 * (m > 2 and m - 3 or m + 9) + 2) // 5 + d - 1
+    return era * 146097 + yoe * 365 + yoe // 4 - yoe // 100 + doy - 719468
+end
+
+-- Convert access log timestamp into seconds since epoch. Accepts numbers, CLF
+-- timestamps like "10/Oct/2000:13:55:36 -0700" and ISO 8601 like "2000-10-10T20:55:36.25Z".
+local months = { Jan = 1, Feb = 2, Mar = 3, Apr = 4, May = 5, Jun = 6, Jul = 7, Aug = 8, Sep = 9, Oct = 10, Nov = 11, Dec = 12 }
+local function parse_log_time(s)
+    if type(s) == "number" then
+        return s
+    end
+    if type(s) ~= "string" then
+        return nil
+    end
+    local d, mon, y, h, mi, sec, frac, tz = s:match("^(%d+)/(%a+)/(%d+):(%d+):(%d+):(%d+)(%.?%d*)%s*(.*)$")
+    if d then
+        mon = months[mon]
+    else
+        y, mon, d, h, mi, sec, frac, tz = s:match("^(%d+)%-(%d+)%-(%d+)[T ](%d+):(%d+):(%d+)(%.?%d*)%s*(.*)$")
+        mon = tonumber(mon)
+    end
+    if not d or not mon then
+        return tonumber(s)
+    end
+    local t = days_from_civil(tonumber(y), mon, tonumber(d)) * 86400
+        + tonumber(h) * 3600 + tonumber(mi) * 60 + tonumber(sec)
+    if #frac > 1 then
+        t = t + tonumber("0"..frac)
+    end
+    local sign, tzh, tzm = tz:match("^([+-])(%d%d):?(%d%d)$")
+    if sign then
+        local offset = tonumber(tzh) * 3600 + tonumber(tzm) * 60
+        t = sign == "+" and t - offset or t + offset
+    end
+    return t
+end
+
+-- Minimal JSON decoder for replay logs. Returns value, or nil and an error message.
+local function json_decode(s)
+    local pos = 1
+    local escapes = { b = "\b", f = "\f", n = "\n", r = "\r", t = "\t" }
+    local function skip()
+        pos = s:find("[^ \t\r\n]", pos) or #s + 1
+    end
+    local function expect(c)
+        skip()
+        if s:sub(pos, pos) ~= c then
+            error("expected '"..c.."'", 0)
         end
-        if kb < 1024 then
-            return string.format("%12.2f KB", kb)
+        pos = pos + 1
+    end
+    local function decode_string()
+        local out = {}
+        expect('"')
+        while true do
+            local _, stop, chunk, c = s:find('^([^"\\]*)(["\\])', pos)
+            if not stop then
+                error("unterminated string", 0)
+            end
+            table.insert(out, chunk)
+            pos = stop + 1
+            if c == '"' then
+                return table.concat(out)
+            end
+            local e = s:sub(pos, pos)
+            if e == "u" then
+                local hex = s:match("^%x%x%x%x", pos + 1)
+                if not hex then
+                    error("invalid unicode escape", 0)
+                end
+                table.insert(out, utf8.char(tonumber(hex, 16)))
+                pos = pos + 5
+            else
+                table.insert(out, escapes[e] or e)
+                pos = pos + 1
+            end
         end
-        if mb < 1024 then
-            return string.format("%12.2f MB", mb)
+    end
+    local decode_value
+    function decode_value()
+        skip()
+        local c = s:sub(pos, pos)
+        if c == "{" then
+            local obj = {}
+            pos = pos + 1
+            skip()
+            if s:sub(pos, pos) == "}" then
+                pos = pos + 1
+                return obj
+            end
+            repeat
+                local key = decode_string()
+                expect(":")
+                obj[key] = decode_value()
+                skip()
+                c = s:sub(pos, pos)
+                pos = pos + 1
+            until c ~= ","
+            if c ~= "}" then
+                error("expected ',' or '}'", 0)
+            end
+            return obj
+        elseif c == "[" then
+            local arr = {}
+            pos = pos + 1
+            skip()
+            if s:sub(pos, pos) == "]" then
+                pos = pos + 1
+                return arr
+            end
+            repeat
+                table.insert(arr, decode_value())
+                skip()
+                c = s:sub(pos, pos)
+                pos = pos + 1
+            until c ~= ","
+            if c ~= "]" then
+                error("expected ',' or ']'", 0)
+            end
+            return arr
+        elseif c == '"' then
+            return decode_string()
+        end
+        local literal = s:match("^[%w%.%+%-]+", pos)
+        if not literal then
+            error("unexpected character", 0)
         end
-        return string.format("%12.2f GB", gb)
+        pos = pos + #literal
+        if literal == "true" then
+            return true
+        elseif literal == "false" then
+            return false
+        elseif literal == "null" then
+            return nil
+        end
+        return tonumber(literal) or error("invalid literal '"..literal.."'", 0)
     end
-    function format_ns(ns, fmt)
-        fmt = fmt or "%12.2f"
-        local us, ms, s = ns/1.0e3, ns/1.0e6, ns/1.0e9
-        if ns < 1000 then
-            return string.format(fmt.." ns", ns)
+    local ok, value = pcall(function()
+        local v = decode_value()
+        skip()
+        if pos <= #s then
+            error("trailing data", 0)
         end
-        if us < 1000 then
-            return string.format(fmt.." us", us)
+        return v
+    end)
+    if not ok then
+        return nil, value.." at position "..pos
+    end
+    return value
+end
+
+-- Read access log for replay, either in common/combined log format or as JSON lines
+-- with the keys method, path, headers (object) and timestamp. Returns a list of
+-- entries with time, method, path and headers sorted by time, or nil and an error.
+local function read_replay_log(path)
+    local f, err = io.open(path, "rb")
+    if not f then
+        return nil, err
+    end
+    local entries, lineno = {}, 0
+    for line in f:lines() do
+        lineno = lineno + 1
+        line = line:gsub("\r$", "")
+        local entry
+        if line:match("^%s*{") then
+            local obj, jerr = json_decode(line)
+            if type(obj) ~= "table" then
+                f:close()
+                return nil, "line "..lineno..": "..tostring(jerr or "expected JSON object")
+            end
+            entry = {
+                time = parse_log_time(obj.timestamp or obj.time),
+                method = obj.method or "GET", path = obj.path or obj.url, headers = {},
+            }
+            if type(obj.headers) == "table" then
+                for name, value in pairs(obj.headers) do
+                    table.insert(entry.headers, { name, tostring(value) })
+                end
+                table.sort(entry.headers, function(a, b) return a[1] < b[1] end)
+            end
+        elseif not line:match("^%s*$") and not line:match("^%s*#") then
+            local ts, method, target, rest = line:match('^%S+ %S+ %S+ %[([^%]]+)%] "(%u+) (%S+)[^"]*"(.*)$')
+            if not ts then
+                f:close()
+                return nil, "line "..lineno..": not in common or combined log format"
+            end
+            entry = { time = parse_log_time(ts), method = method, path = target, headers = {} }
+            local referer, agent = rest:match('^ %S+ %S+ "([^"]*)" "([^"]*)"')
+            if referer and referer ~= "-" then
+                table.insert(entry.headers, { "Referer", referer })
+            end
+            if agent and agent ~= "-" then
+                table.insert(entry.headers, { "User-Agent", agent })
+            end
         end
-        if ms < 1000 then
-            return string.format(fmt.." ms", ms)
+        if entry then
+            if not entry.time then
+                f:close()
+                return nil, "line "..lineno..": missing or invalid timestamp"
+            end
+            if type(entry.method) ~= "string" or not entry.method:match("^%u+$")
+                    or type(entry.path) ~= "string" or entry.path == "" or entry.path:find("%s") then
+                f:close()
+                return nil, "line "..lineno..": invalid method or path"
+            end
+            for _, h in ipairs(entry.headers) do
+                if h[1]:find("[%c%s:]") or h[2]:find("%c") then
+                    f:close()
+                    return nil, "line "..lineno..": invalid header '"..h[1].."'"
+                end
+            end
+            entry.index = #entries + 1
+            table.insert(entries, entry)
         end
-        return string.format(fmt.." sec", s)
     end
-    function format_rps(nreq, ns)
-        local rps = nreq / (ns / 1.0e9)
-        if rps > 1000 then
-            if rps > 1000000 then
-                return string.format("%12.2f M", rps / 1000000)
+    f:close()
+    table.sort(entries, function(a, b)
+        if a.time ~= b.time then
+            return a.time < b.time
+        end
+        return a.index < b.index
+    end)
+    return entries
+end
+
+local outfmt = "responses-%d.txt"
+
+-- Parse URI of a target and generate its requests into infile unless they are generated
+-- by multi_sendfile. Returns table with the settings of the target, or nil after printing an error.
+local function prepare_target(options, uri, infile)
+    -- Extract and validate URI parts
+    if uri:sub(1, 7) ~= "http://" then
+        print("Error: Expected URI starting with 'http://' but got '"..uri.."'")
+        return nil
+    end
+    local uri_noproto = uri:sub(8)
+    local port_start, target_start
+    for i = 1, #uri_noproto do
+        local c = uri_noproto:sub(i, i)
+        if c == ":" and not port_start then
+            port_start = i
+        end
+        if c == "/" then
+            target_start = i
+            break
+        end
+    end
+    local host, port, target = uri_noproto, "80", "/"
+    if port_start then
+        port = target_start and uri_noproto:sub(port_start + 1, target_start - 1) or uri_noproto:sub(port_start + 1)
+        host = uri_noproto:sub(1, port_start - 1)
+    end
+    if target_start then
+        target = uri_noproto:sub(target_start)
+        if not port_start then
+            host = uri_noproto:sub(1, target_start - 1)
+        end
+    end
+    if host == "" then
+        print("Error: Host name is empty")
+        return nil
+    end
+    local intport = math.tointeger(port)
+    if not intport or intport < 0 or intport > 65535 then
+        print("Error: Expected port to be integer of [0..65535], but got '"..port.."'")
+        return nil
+    end
+    port = tostring(intport)
+
+    local function build_request(method, path)
+        return method.." "..path.." HTTP/1.1\r\n"
+          .."Host: "..host..":"..port.."\r\n"
+          .."User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:88.0) Gecko/20100101 Firefox/88.0\r\n"
+          .."Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8\r\n"
+          .."Accept-Language: en-US,en;q=0.5\r\n"
+          .."Accept-Encoding: gzip, deflate\r\n"
+          .."Upgrade-Insecure-Requests: 1\r\n"
+          ..((#options.bodies > 0 and upload_methods[method]) and "Content-Type: application/octet-stream\r\n" or "")
+    end
+
+    -- Request head of a replayed log entry, keeping its headers except for the ones
+    -- describing the original connection and body
+    local function build_replay_request(entry)
+        local lines = { entry.method.." "..entry.path.." HTTP/1.1\r\n", "Host: "..host..":"..port.."\r\n" }
+        for _, h in ipairs(entry.headers) do
+            local name = h[1]:lower()
+            if name ~= "host" and name ~= "connection" and name ~= "keep-alive"
+                    and name ~= "content-length" and name ~= "transfer-encoding" then
+                table.insert(lines, h[1]..": "..h[2].."\r\n")
+            end
+        end
+        return table.concat(lines)
+    end
+    local req = build_request(options.method, target)
+    -- Requests with placeholders are expanded by multi_sendfile instead of using the input file
+    local template, mix, replay_entries, request_files
+    if #options.requests > 0 then
+        -- Expand %d patterns into the numbered files which exist
+        request_files = {}
+        for _, name in ipairs(options.requests) do
+            if name:find("%d", 1, true) then
+                local n = 0
+                while true do
+                    local numbered = name:gsub("%%d", tostring(n + 1))
+                    local rf = io.open(numbered, "rb")
+                    if not rf then
+                        break
+                    end
+                    rf:close()
+                    table.insert(request_files, numbered)
+                    n = n + 1
+                end
+                if n == 0 then
+                    print("Error: No request files match '"..name.."'")
+                    return nil
+                end
             else
-                return string.format("%12.2f K", rps / 1000)
+                table.insert(request_files, name)
+            end
+        end
+        -- Use the first request of the first file as sample
+        local rf, err = io.open(request_files[1], "rb")
+        if not rf then
+            print("Error: Cannot open request file: "..tostring(err))
+            return nil
+        end
+        local data = rf:read(64 * 1024) or ""
+        rf:close()
+        req = data:match("^(.-\r\n)\r\n") or data
+    elseif options.replay then
+        local entries, err = read_replay_log(options.replay)
+        if not entries then
+            print("Error: Cannot read replay log: "..tostring(err))
+            return nil
+        end
+        if #entries == 0 then
+            print("Error: Replay log contains no requests")
+            return nil
+        end
+        replay_entries = entries
+        req = build_replay_request(entries[1])
+    elseif options.mix then
+        local mf, err = io.open(options.mix, "rb")
+        if not mf then
+            print("Error: Cannot open mix file: "..tostring(err))
+            return nil
+        end
+        mix = {}
+        local lineno = 0
+        for line in mf:lines() do
+            lineno = lineno + 1
+            line = line:gsub("\r$", "")
+            if not line:match("^%s*$") and not line:match("^%s*#") then
+                local weight, rest = line:match("^%s*(%d+)%s+(.-)%s*$")
+                local method, path = (rest or ""):match("^(%u+)%s+(%S+)$")
+                if not method then
+                    method, path = "GET", rest
+                end
+                weight = math.tointeger(tonumber(weight))
+                if not weight or weight <= 0 or not path or path == "" or path:find("%s") then
+                    print("Error in mix file line "..lineno..": Expected 'weight [method] path', but got '"..line.."'")
+                    mf:close()
+                    return nil
+                end
+                table.insert(mix, {
+                    weight = weight, method = method, path = path,
+                    template = build_request(method, path),
+                })
             end
+        end
+        mf:close()
+        if #mix == 0 then
+            print("Error: Mix file contains no entries")
+            return nil
+        end
+        req = mix[1].template
+    elseif options.template then
+        local tf, err = io.open(options.template, "rb")
+        if not tf then
+            print("Error: Cannot open template file: "..tostring(err))
+            return nil
+        end
+        local lines = {}
+        for line in tf:read("a"):gmatch("[^\r\n]+") do
+            table.insert(lines, line.."\r\n")
+        end
+        tf:close()
+        template = table.concat(lines)
+        req = template
+    elseif target:find("{{", 1, true) or #options.bodies > 0 or options.method == "HEAD" then
+        -- Request heads for bodies are generated by multi_sendfile as well, and HEAD
+        -- requests, so that their responses are parsed without body
+        template = req
+    end
+    -- Sizes of request bodies
+    local body_sizes = {}
+    for i, name in ipairs(options.bodies) do
+        local bf, err = io.open(name, "rb")
+        if not bf then
+            print("Error: Cannot open body file: "..tostring(err))
+            return nil
+        end
+        body_sizes[i] = bf:seek("end")
+        bf:close()
+    end
+    local req_close = req.."Connection: close\r\n\r\n"
+    local req_keepalive = req.."Connection: keep-alive\r\n\r\n"
+    if options.show_sample then
+        print("------- Sample request"..((template or mix) and " template" or "").." -------")
+        if #options.bodies > 0 and upload_methods[req:match("^%u+")] then
+            io.write(req..(options.chunk_size > 0 and "Transfer-Encoding: chunked\r\n" or "Content-Length: "..body_sizes[1].."\r\n")
+                .."Connection: close\r\n\r\n")
+            print("<body from "..options.bodies[1]..">")
+        elseif request_files then
+            io.write(req.."\r\n")
         else
-            return string.format("%12.2f", rps)
+            io.write(req_close)
         end
     end
-else
-    function format_bytes(n)
-        return string.format("%12.2f B", n)
+    -- Number of requests sent by each connection
+    local conn_requests = {}
+    for i = 1, options.nconns do
+        conn_requests[i] = options.nreq
+    end
+    local replay, replay_duration
+    if mix then
+        print("Requests will be generated from a mix of "..#mix.." entries with seed "..options.seed..".")
+    elseif template then
+        print("Requests will be generated from template with seed "..options.seed..".")
+    elseif request_files then
+        infile = #request_files > 1 and request_files or request_files[1]
+    elseif replay_entries then
+        -- Write all requests into one file in log order; each connection gets a schedule
+        -- of its round-robin share, with the last request closing the connection
+        if #replay_entries < options.nconns then
+            options.nconns = #replay_entries
+            print("Reducing connections to "..options.nconns.." to match the number of requests.")
+        end
+        print("Generating replay file with "..#replay_entries.." request"..(#replay_entries == 1 and "" or "s").."..")
+        local last_of, schedules = {}, {}
+        for k = 1, #replay_entries do
+            last_of[(k - 1) % options.nconns + 1] = k
+        end
+        conn_requests = {}
+        for i = 1, options.nconns do
+            conn_requests[i] = 0
+            schedules[i] = {}
+        end
+        local f = assert(io.open(infile, "wb"))
+        local t0, offset = replay_entries[1].time, 0
+        for k, e in ipairs(replay_entries) do
+            local c = (k - 1) % options.nconns + 1
+            local r = build_replay_request(e)..(last_of[c] == k and "Connection: close\r\n\r\n" or "Connection: keep-alive\r\n\r\n")
+            f:write(r)
+            local t = options.speed > 0 and math.floor((e.time - t0) * 1.0e9 / options.speed) or 0
+            table.insert(schedules[c], string.pack("=I8I8I8I8", t, offset, #r, e.method == "HEAD" and 1 or 0))
+            offset = offset + #r
+            conn_requests[c] = conn_requests[c] + 1
+        end
+        f:close()
+        replay = {}
+        for i = 1, options.nconns do
+            replay[i] = table.concat(schedules[i])
+        end
+        replay_duration = options.speed > 0 and (replay_entries[#replay_entries].time - t0) * 1.0e9 / options.speed or 0
+    else
+        print("Generating input file with "..options.nreq.." request"..(options.nreq == 1 and "" or "s").."..")
+        local f = assert(io.open(infile, "wb"))
+        for i = 1, options.nreq do
+            if i < options.nreq then
+                f:write(req_keepalive)
+            else
+                f:write(req_close)
+            end
+        end
+        f:close()
     end
-    function format_ns(ns, fmt)
-        fmt = fmt or "%12.2f"
-        return string.format(fmt.." ms", ns / 1.0e6)
+    return {
+        uri = uri, host = host, port = port, path = target, options = options, infile = infile,
+        template = template, mix = mix, replay = replay, replay_entries = replay_entries,
+        replay_duration = replay_duration, request_files = request_files, body_sizes = body_sizes,
+        conn_requests = conn_requests,
+    }
+end
+local prepared = {}
+local function any_target(f)
+    for _, t in ipairs(prepared) do
+        if f(t) then
+            return true
+        end
+    end
+    return false
+end
+for k, t in ipairs(targets) do
+    if #targets > 1 then
+        print("=========== Target "..k.." ===========")
+        print(t.uri)
     end
-    function format_rps(nreq, ns)
-        local rps = nreq / (ns / 1.0e9)
-        return string.format("%12.2f", rps)
+    local p = prepare_target(t.options, t.uri, #targets > 1 and "requests-"..k..".txt" or "requests.txt")
+    if not p then
+        return 1
     end
+    p.label = p.host..":"..p.port..p.path
+    prepared[k] = p
 end
-function format_tp(b, ns)
-    return format_bytes(b / (ns / 1.0e9)).."/sec"
+if not options.log and not options.dedup then
+    os.execute("rm -f responses-*.txt")
 end
+print("")
 
--- Generate requests
-local infile = "requests.txt"
-local outfmt = "responses-%d.txt"
-local req =
-    "GET "..target.." HTTP/1.1\r\n"
-  .."Host: "..host..":"..port.."\r\n"
-  .."User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:88.0) Gecko/20100101 Firefox/88.0\r\n"
-  .."Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8\r\n"
-  .."Accept-Language: en-US,en;q=0.5\r\n"
-  .."Accept-Encoding: gzip, deflate\r\n"
-  .."Upgrade-Insecure-Requests: 1\r\n"
-local req_close = req.."Connection: close\r\n\r\n"
-local req_keepalive = req.."Connection: keep-alive\r\n\r\n"
-if options.show_sample then
-    print("------- Sample request -------")
-    io.write(req_close)
-end
-print("Generating input file with "..options.nreq.." request"..(options.nreq == 1 and "" or "s").."..")
-local f = assert(io.open(infile, "wb"))
-for i = 1, options.nreq do
-    if i < options.nreq then
-        f:write(req_keepalive)
+-- Run benchmark on agents instead of locally. Every agent runs all connections; the results
+-- are concatenated in agent order, with timestamps converted to the local clock.
+local function run_on_agents(agents, opts)
+    local function fail(msg)
+        for _, a in ipairs(agents) do
+            if a.fd then
+                sock_close(a.fd)
+                a.fd = nil
+            end
+        end
+        return nil, msg
+    end
+    -- Ship the files multi_sendfile opens along with the settings
+    local files = {}
+    for _, s in ipairs({ opts, table.unpack(opts.targets or {}) }) do
+        local names = { table.unpack(s.bodies or {}) }
+        if not s.template and not s.mix then
+            for _, name in ipairs(type(s.in_file) == "table" and s.in_file or { s.in_file }) do
+                table.insert(names, name)
+            end
+        end
+        for _, name in ipairs(names) do
+            if not files[name] then
+                local sf, err = io.open(name, "rb")
+                if not sf then
+                    return fail(err)
+                end
+                files[name] = sf:read("a")
+                sf:close()
+            end
+        end
+    end
+    -- Send run to all agents first, so that they set up their connections in parallel
+    for _, a in ipairs(agents) do
+        local fd, err = tcp_connect(a.host, a.port)
+        if not fd then
+            return fail(err)
+        end
+        a.fd = fd
+        local ok, serr = send_message(fd, { type = "run", opts = opts, files = files,
+            shutwr = options.shutwr, nocheck = options.nocheck })
+        if not ok then
+            return fail(a.label..": "..serr)
+        end
+    end
+    for _, a in ipairs(agents) do
+        local m, err = recv_message(a.fd, message_timeout_ms)
+        if not m or m.type ~= "ready" then
+            return fail(a.label..": "..tostring(m and m.err or err))
+        end
+    end
+    -- Estimate clock offset of each agent from the ping with the shortest round trip
+    local max_rtt = 0
+    for _, a in ipairs(agents) do
+        a.rtt = nil
+        for _ = 1, 8 do
+            local t0 = monotonic_ns()
+            local ok, err = send_message(a.fd, { type = "ping" })
+            local m, rerr = ok and recv_message(a.fd, message_timeout_ms)
+            local t2 = monotonic_ns()
+            if not m or m.type ~= "pong" then
+                return fail(a.label..": "..tostring(err or rerr))
+            end
+            if not a.rtt or t2 - t0 < a.rtt then
+                a.rtt, a.offset = t2 - t0, m.now - (t0 + t2) / 2
+            end
+        end
+        max_rtt = math.max(max_rtt, a.rtt)
+    end
+    -- Start all agents at the same local time, leaving room for the start messages
+    local start = monotonic_ns() + 50e6 + 2 * max_rtt
+    for _, a in ipairs(agents) do
+        local ok, err = send_message(a.fd, { type = "start", start_ns = start + a.offset })
+        if not ok then
+            return fail(a.label..": "..err)
+        end
+    end
+    local results = { client = { cpu_ns = 0, vcsw = 0, ivcsw = 0, maxrss_kb = 0, processes = 0 } }
+    for _, a in ipairs(agents) do
+        local m, err = recv_message(a.fd)
+        if not m or m.type ~= "results" then
+            return fail(a.label..": "..tostring(err))
+        end
+        if not m.results then
+            return fail(a.label..": "..tostring(m.err))
+        end
+        for _, v in ipairs(m.results) do
+            if type(v) == "table" then
+                for _, key in ipairs({ "connect_start_ns", "connect_end_ns", "send_start_ns", "send_end_ns",
+                        "receive_start_ns", "receive_end_ns", "first_byte_ns", "first_response_ns", "last_byte_ns",
+                        "request_sent_ns", "request_acked_ns" }) do
+                    v[key] = v[key] and v[key] - a.offset
+                end
+                if v.queues then
+                    v.queues.start_ns = v.queues.start_ns - a.offset
+                end
+                if v.buckets then
+                    v.buckets.start_ns = v.buckets.start_ns - a.offset
+                end
+                for _, gap in ipairs(v.gaps or {}) do
+                    gap.start_ns, gap.end_ns = gap.start_ns - a.offset, gap.end_ns - a.offset
+                end
+            end
+            table.insert(results, v)
+        end
+        local c = results.client
+        for _, key in ipairs({ "cpu_ns", "vcsw", "ivcsw", "processes" }) do
+            c[key] = c[key] + m.results.client[key]
+        end
+        c.maxrss_kb = math.max(c.maxrss_kb, m.results.client.maxrss_kb)
+    end
+    fail()
+    return results
+end
+
+-- CPU placement of connection threads. Returns the CPU lists which are assigned round-robin
+-- to the connections and a description, nothing if threads are not placed, or false after
+-- printing an error.
+local function plan_placement()
+    if not options.cpus and not options.avoid_pid and not options.numa then
+        return
+    end
+    local mask, err = cpu_affinity(0)
+    if not mask then
+        print("Error: "..err)
+        return false
+    end
+    local allowed = parse_cpulist(mask)
+    local function keep(list, f)
+        local out = {}
+        for _, c in ipairs(list) do
+            if f(c) then
+                table.insert(out, c)
+            end
+        end
+        return out
+    end
+    local notes = {}
+    if options.cpus then
+        local _, want = parse_cpulist(options.cpus)
+        allowed = keep(allowed, function(c) return want[c] end)
+    end
+    if options.avoid_pid then
+        local avoid_mask, aerr = cpu_affinity(options.avoid_pid)
+        if not avoid_mask then
+            print("Error: "..aerr)
+            return false
+        end
+        local _, avoid = parse_cpulist(avoid_mask)
+        allowed = keep(allowed, function(c) return not avoid[c] end)
+        table.insert(notes, "avoiding CPUs "..avoid_mask.." of PID "..options.avoid_pid)
+    end
+    if #allowed == 0 then
+        print("Error: No CPUs are left to run connections on")
+        return false
+    end
+    local sets, desc = {}, nil
+    if options.numa then
+        -- Nodes without CPUs or /sys information are left out
+        local function read_line(path)
+            local sf = io.open(path, "r")
+            local line = sf and sf:read("l")
+            if sf then
+                sf:close()
+            end
+            return line
+        end
+        local _, is_allowed = parse_cpulist(format_ranges(allowed))
+        local parts = {}
+        for _, node in ipairs(parse_cpulist(read_line("/sys/devices/system/node/online") or "") or {}) do
+            local node_cpus = parse_cpulist(read_line("/sys/devices/system/node/node"..node.."/cpulist") or "") or {}
+            node_cpus = keep(node_cpus, function(c) return is_allowed[c] end)
+            if #node_cpus > 0 then
+                table.insert(sets, format_ranges(node_cpus))
+                table.insert(parts, "node "..node.." (CPUs "..sets[#sets]..")")
+            end
+        end
+        if #sets == 0 then
+            sets = { format_ranges(allowed) }
+            parts = { "one node (CPUs "..sets[1]..")" }
+        end
+        desc = "connections spread over NUMA "..table.concat(parts, ", ")
+    elseif options.cpus then
+        for _, c in ipairs(allowed) do
+            table.insert(sets, tostring(c))
+        end
+        desc = "connections pinned round-robin to CPUs "..format_ranges(allowed)
     else
-        f:write(req_close)
+        sets = { format_ranges(allowed) }
+        desc = "all threads on CPUs "..sets[1]
+    end
+    if #notes > 0 then
+        desc = desc..", "..table.concat(notes, ", ")
+    end
+    return sets, desc
+end
+local cpu_sets, placement = plan_placement()
+if cpu_sets == false then
+    return 1
+end
+
+-- Server processes to sample, given by IDs or by name
+local server_pids
+if options.server_pid then
+    if options.server_pid:match("^[%d,]+$") then
+        server_pids = {}
+        for pid in options.server_pid:gmatch("%d+") do
+            local f = io.open("/proc/"..pid.."/stat", "r")
+            if not f then
+                print("Error in option -server-pid: No process with ID "..pid)
+                return 1
+            end
+            f:close()
+            table.insert(server_pids, math.tointeger(tonumber(pid)))
+        end
+    else
+        server_pids = find_processes(options.server_pid)
+        if #server_pids == 0 then
+            print("Error in option -server-pid: No process named '"..options.server_pid.."'")
+            return 1
+        end
+    end
+end
+
+-- Ports of the listening sockets of the server, if it runs on this host
+local listen_ports
+if options.accept_queue then
+    listen_ports = {}
+    local seen = {}
+    for _, t in ipairs(prepared) do
+        local port = math.tointeger(t.port)
+        if not seen[port] then
+            seen[port] = true
+            table.insert(listen_ports, port)
+        end
     end
 end
-f:close()
-os.execute("rm -f responses-*.txt")
-print("")
 
 -- Run benchmark
+local function print_target_info(t, indent)
+    local o = t.options
+    print(indent.." * Parallel connections: "..o.nconns)
+    if t.replay then
+        print(indent.." * Replayed requests:    "..#t.replay_entries.." over "..format_ns(t.replay_duration, "%.2f")
+            ..(o.speed > 0 and " (speed "..o.speed.."x)" or " (as fast as possible)"))
+    elseif t.request_files then
+        print(indent.." * Request files:        "..table.concat(t.request_files, ", "))
+    else
+        print(indent.." * Requests/connection:  "..o.nreq)
+    end
+    if #o.bodies > 0 then
+        local total = 0
+        for _, size in ipairs(t.body_sizes) do
+            total = total + size
+        end
+        print(indent.." * Request bodies:       "..#o.bodies.." file"..(#o.bodies == 1 and "" or "s")
+            ..", average "..string.format("%.0f", total / #o.bodies).." bytes"
+            ..(o.chunk_size > 0 and ", chunks of "..o.chunk_size.." bytes" or ""))
+    end
+end
 print("---------- Benchmark ---------")
-print("Benchmarking "..host..":"..port)
-print(" * Parallel connections: "..options.nconns)
-print(" * Requests/connection:  "..options.nreq)
+if #prepared == 1 then
+    print("Benchmarking "..prepared[1].host..":"..prepared[1].port)
+    print_target_info(prepared[1], "")
+else
+    print("Benchmarking "..#prepared.." targets with a shared start:")
+    for k, t in ipairs(prepared) do
+        print(" ["..k.."] "..t.label)
+        print_target_info(t, "    ")
+    end
+end
+-- Merge per-target connection settings; connections are numbered across targets,
+-- and with agents, the connections of each agent follow the ones of the previous agent
+local nagents = options.agents and #options.agents or 1
+local conn_requests, conn_target, conn_agent = {}, {}, {}
+for a = 1, nagents do
+    for k, t in ipairs(prepared) do
+        for i = 1, t.options.nconns do
+            table.insert(conn_requests, t.conn_requests[i])
+            table.insert(conn_target, k)
+            table.insert(conn_agent, a)
+        end
+    end
+end
+local agent_conns = #conn_target // nagents
+options.nconns = #conn_target
+-- Groups of connections which are shown separately in timing table and summary:
+-- agents, targets, and request files within targets
+local group_names, conn_group = {}, {}
+do
+    local group_of, nth = {}, {}
+    for i, k in ipairs(conn_target) do
+        local t = prepared[k]
+        local name = #prepared > 1 and t.label or ""
+        local key = conn_agent[i]..":"..k
+        nth[key] = (nth[key] or 0) + 1
+        if t.request_files and #t.request_files > 1 then
+            local file = t.request_files[(nth[key] - 1) % #t.request_files + 1]
+            name = name == "" and file or name.." "..file
+        end
+        if nagents > 1 then
+            name = "agent "..options.agents[conn_agent[i]].label..(name == "" and "" or " "..name)
+        end
+        if not group_of[name] then
+            table.insert(group_names, name)
+            group_of[name] = #group_names
+        end
+        conn_group[i] = group_of[name]
+    end
+    -- A single unnamed group is not worth showing
+    if #group_names == 1 then
+        group_names, conn_group = {}, {}
+    end
+end
+if options.agents then
+    print(" * Agents:               "..nagents.." (each running all connections)")
+end
+if options.procs > 1 then
+    print(" * Worker processes:     "..math.min(options.procs, agent_conns))
+end
+if placement then
+    print(" * CPU placement:        "..placement)
+end
+if server_pids then
+    print(" * Server processes:     "..table.concat(server_pids, ", ")
+        ..(options.server_pid:match("^[%d,]+$") and "" or " ("..options.server_pid..")")
+        ..", sampled every "..options.sample_interval.." ms")
+end
+if options.tcp_info then
+    print(" * TCP statistics:       sampled every "..options.sample_interval.." ms")
+end
+if options.queues then
+    print(" * Socket queues:        sampled every "..options.sample_interval.." ms")
+end
+if options.buckets then
+    print(" * Throughput buckets:   "..options.buckets.." ms")
+end
+if options.stall_gap then
+    print(" * Stall detection:      gaps from "..options.stall_gap.." ms, pauses of "..options.stall_share
+        .."% of the connections")
+end
+if options.timestamps then
+    print(" * Kernel timestamps:    received data, request data sent and acknowledged")
+end
+if listen_ports then
+    print(" * Accept queue:         port "..table.concat(listen_ports, ", ")
+        ..", sampled every "..options.sample_interval.." ms")
+end
 if options.shutwr then
     print(" * Connections will be closed after requests have been sent")
 end
 if options.nocheck then
     print(" * Responses will not be stored checked")
+elseif options.log then
+    print(" * Responses will be recorded into "..options.log)
+elseif options.dedup then
+    print(" * Responses will be deduplicated into "..options.dedup)
 end
 print("Waiting for completion...")
-local start = cputime_ns()
-local results, err = multi_sendfile(infile, outfmt, host, port, options.nconns, options.shutwr, options.nocheck)
-local stop = cputime_ns()
+local function target_settings(t)
+    return {
+        host = t.host,
+        port = t.port,
+        num_conns = t.options.nconns,
+        in_file = t.infile,
+        template = t.template,
+        mix = t.mix,
+        nreq = t.options.nreq,
+        seed = t.options.seed,
+        replay = t.replay,
+        bodies = #t.options.bodies > 0 and t.options.bodies or nil,
+        chunk_size = t.options.chunk_size,
+    }
+end
+local opts = target_settings(prepared[1])
+opts.log_file = options.log
+opts.store_dir = options.dedup
+opts.procs = options.procs
+opts.cpu_sets = cpu_sets
+opts.server_pids = server_pids
+opts.sample_interval_ms = options.sample_interval
+opts.server_threads = options.server_threads
+opts.tcp_info = options.tcp_info
+opts.queues = options.queues
+opts.listen_ports = listen_ports
+opts.timestamps = options.timestamps
+opts.bucket_ms = options.buckets
+opts.gap_ms = options.stall_gap
+if options.progress then
+    opts.progress = true
+    -- Requests in request files are only known by their responses
+    local expected = 0
+    for i, n in ipairs(conn_requests) do
+        if prepared[conn_target[i]].request_files then
+            expected = nil
+            break
+        end
+        expected = expected + n
+    end
+    opts.progress_requests = expected
+end
+if #prepared > 1 then
+    opts.targets = {}
+    for k = 2, #prepared do
+        table.insert(opts.targets, target_settings(prepared[k]))
+    end
+end
+local start = monotonic_ns()
+local results, err
+if options.agents then
+    results, err = run_on_agents(options.agents, opts)
+else
+    results, err = multi_sendfile(opts.in_file, outfmt, opts.host, opts.port, opts.num_conns,
+        options.shutwr, options.nocheck, opts)
+end
+local stop = monotonic_ns()
 if not results then
     print("Benchmark failed: "..tostring(err))
     return 1
 end
-print("Benchmark successful, "..format_ns(stop - start, "%.2f"))
+if results.interrupted then
+    print("Benchmark interrupted after "..format_ns(stop - start, "%.2f"):gsub("^ +", "")
+        ..", connections which had not finished failed")
+else
+    print("Benchmark successful, "..format_ns(stop - start, "%.2f"))
+end
+for _, a in ipairs(options.agents or {}) do
+    print(" * Agent "..a.label..": clock offset "..format_ns(a.offset, "%.3f")
+        ..", round trip "..format_ns(a.rtt, "%.3f"))
+end
 print("")
 
+-- The kernel timestamp of the last data received replaces the time after the last recv()
+-- returned, which includes the delay until the receiver thread was scheduled
+for _, v in ipairs(results) do
+    if type(v) == "table" and v.wakeup_ns then
+        v.receive_end_ns = math.max(v.last_byte_ns, v.receive_start_ns)
+    end
+end
+
 -- Calculate total/min/max/average, first and last timestamps
-local total_sent, total_received, valid_entries = 0, 0, 0
+-- Requests in request files are only known by their responses
+for i, v in ipairs(results) do
+    if prepared[conn_target[i]].request_files then
+        conn_requests[i] = type(v) == "table" and v.responses or 0
+    end
+end
+local total_sent, total_received, total_responses, total_requests, valid_entries = 0, 0, 0, 0, 0
 local sum_duration = 0.0
 local max_duration, avg_duration, min_duration
 local max_duration_id, min_duration_id
@@ -259,13 +1953,18 @@ local sum_connect = 0.0
 local max_connect, avg_connect, min_connect
 local max_connect_id, min_connect_id
 local earliest_connect_start, earliest_connect_end, last_receive_end
-local connection_errors = {}
+local connection_errors, parse_errors = {}, {}
 for i, v in ipairs(results) do
     if type(v) == "string" then
         connection_errors[v] = true
     else
         total_sent = total_sent + v.total_sent
         total_received = total_received + v.total_received
+        total_responses = total_responses + v.responses
+        total_requests = total_requests + conn_requests[i]
+        if v.parse_error then
+            parse_errors[v.parse_error] = true
+        end
         -- Duration of full connection: connect to close
         local duration = v.receive_end_ns - v.connect_start_ns
         if not min_duration or duration < min_duration then
@@ -306,6 +2005,150 @@ if valid_entries > 0 then
     avg_connect = sum_connect / valid_entries
 end
 
+-- Share of a CPU core used by the threads of a connection while it was open
+local function client_load(v)
+    local duration = v.receive_end_ns - v.connect_start_ns
+    return duration > 0 and (v.sender_cpu_ns + v.receiver_cpu_ns) * 100 / duration or 0
+end
+
+-- Time a connection spent sending data and the shares of it limited by the receive window
+-- of the server, by the send buffer and otherwise, mostly by the congestion window
+local function format_tcp_limits(busy, rwnd, sndbuf)
+    local other = math.max(busy - rwnd - sndbuf, 0)
+    return string.format("%11.1f%% receive window, %.1f%% send buffer, %.1f%% cwnd/other of ",
+        rwnd * 100 / busy, sndbuf * 100 / busy, other * 100 / busy)..format_ns(busy * 1000):gsub("^ +", "")
+end
+
+-- Server threads and the connections they served, matched by the local ports of connections.
+-- Each connection is attributed to the thread seen most often in I/O on it. Busy threads are
+-- only seen while blocked, so the sockets open in the server processes are used as well.
+local server = results.server
+local server_threads, conn_thread, conn_socket, threading_model, server_wait = {}, {}, {}, nil, nil
+if server and server.threads then
+    local conn_by_port, best = {}, {}
+    for i, v in ipairs(results) do
+        if type(v) == "table" then
+            conn_by_port[v.local_port] = i
+            conn_socket[i] = server.sockets[v.local_port]
+        end
+    end
+    -- Client connections open in the server at once, and the processes having them
+    local max_open, socket_pids, nsocket_pids, per_pid, most_per_pid = 0, {}, 0, {}, 0
+    for _, s in ipairs(server.samples) do
+        local open = 0
+        for _, sock in pairs(conn_socket) do
+            if sock.first_ns <= s.time_ns and s.time_ns <= sock.last_ns then
+                open = open + 1
+            end
+        end
+        max_open = math.max(max_open, open)
+    end
+    local nsockets = 0
+    for _, sock in pairs(conn_socket) do
+        nsockets = nsockets + 1
+        if not socket_pids[sock.pid] then
+            nsocket_pids = nsocket_pids + 1
+            socket_pids[sock.pid] = true
+        end
+        per_pid[sock.pid] = (per_pid[sock.pid] or 0) + 1
+        most_per_pid = math.max(most_per_pid, per_pid[sock.pid])
+    end
+    for _, t in ipairs(server.threads) do
+        t.conns, t.spans = {}, {}
+        for port, p in pairs(t.ports) do
+            local i = conn_by_port[port]
+            if i then
+                table.insert(t.conns, i)
+                table.insert(t.spans, p)
+                if not best[i] or p.samples > best[i] then
+                    conn_thread[i], best[i] = t, p.samples
+                end
+            end
+        end
+        table.sort(t.conns)
+        if #t.conns > 0 or t.run_ns > 0 then
+            table.insert(server_threads, t)
+        end
+    end
+    table.sort(server_threads, function(a, b)
+        if #a.conns ~= #b.conns then
+            return #a.conns > #b.conns
+        end
+        return a.run_ns > b.run_ns
+    end)
+    -- Threading model from the attribution
+    local mapped, serving, nserving, most, pids, npids = 0, {}, 0, 0, {}, 0
+    for _, t in pairs(conn_thread) do
+        mapped = mapped + 1
+        if not serving[t] then
+            nserving = nserving + 1
+            if not pids[t.pid] then
+                npids = npids + 1
+                pids[t.pid] = true
+            end
+        end
+        serving[t] = (serving[t] or 0) + 1
+        most = math.max(most, serving[t])
+    end
+    local unit = npids == nserving and npids > 1 and "processes" or "threads"
+    if mapped == 0 and nsockets == 0 then
+        threading_model = "unknown, no connection was seen in the server"
+    elseif nsockets > 1 and max_open == 1 then
+        threading_model = "serialized, one connection open at a time"
+            ..(nserving == 1 and " in thread "..next(serving).tid or "")
+    elseif nsocket_pids > 1 then
+        threading_model = most_per_pid == 1 and "one of "..nsocket_pids.." processes per connection"
+            or nsocket_pids.." processes, up to "..most_per_pid.." connections each"
+    elseif nserving == 1 then
+        threading_model = "event loop in thread "..next(serving).tid..", up to "..max_open.." connections open at once"
+    elseif nserving > 1 and most == 1 then
+        threading_model = "one of "..nserving.." "..unit.." per connection"
+    elseif nserving > 1 then
+        threading_model = "pool of "..nserving.." "..unit..", up to "..most.." connections each"
+    else
+        -- Busy threads are never seen in I/O, but a thread per connection is still visible by its start
+        local started = 0
+        for _, t in ipairs(server.threads) do
+            started = started + (t.started and 1 or 0)
+        end
+        threading_model = nsockets > 1 and started >= nsockets
+            and "probably one thread per connection, "..started.." threads started during the run"
+            or "up to "..max_open.." connections open at once, serving threads not seen in I/O"
+    end
+    threading_model = threading_model.." ("..math.max(mapped, nsockets).." of "..options.nconns.." connections seen)"
+    -- Share of the time serving threads were runnable but had no CPU
+    local run, wait = 0, 0
+    for t in pairs(serving) do
+        run, wait = run + t.run_ns, wait + t.wait_ns
+    end
+    server_wait = run + wait > 0 and wait * 100 / (run + wait) or nil
+end
+
+-- Timeline of a connection: connect and close ("*", "|"), send (">"), wait for the first
+-- response data ("-"), then receive ("<", or "X" while also sending)
+local function timeline(v, start_time, time_per_step, steps)
+    local chars = {}
+    local begin_send = (v.send_start_ns - start_time) / time_per_step
+    local end_send = (v.send_end_ns - start_time) / time_per_step
+    for i = math.floor(begin_send), math.floor(end_send) do
+        chars[i + 1] = ">"
+    end
+    local begin_recv = ((v.first_byte_ns or v.receive_end_ns) - start_time) / time_per_step
+    local end_recv = (v.receive_end_ns - start_time) / time_per_step
+    for i = math.floor((v.receive_start_ns - start_time) / time_per_step), math.floor(begin_recv) - 1 do
+        chars[i + 1] = chars[i + 1] or "-"
+    end
+    for i = math.floor(begin_recv), math.floor(end_recv) do
+        chars[i + 1] = chars[i + 1] == ">" and "X" or "<"
+    end
+    chars[math.floor((v.connect_end_ns - start_time) / time_per_step) + 1] = "*"
+    chars[math.floor((v.receive_end_ns - start_time) / time_per_step) + 1] = "|"
+    for i = 1, steps do
+        chars[i] = chars[i] or "."
+    end
+    return table.concat(chars)
+end
+
 -- Detailed per-connection results
 if options.show_conndetails then
     print("----- Connection details -----")
@@ -319,35 +2162,103 @@ if options.show_conndetails then
             local receive_time  = v.receive_end_ns - v.receive_start_ns
             print("  Bytes sent . . . . . . . "..format_bytes(v.total_sent))
             print("  Bytes received . . . . . "..format_bytes(v.total_received))
+            print("  Responses  . . . . . . . "..string.format("%12d", v.responses))
+            print("  Client CPU time  . . . . "..format_ns(v.sender_cpu_ns + v.receiver_cpu_ns)
+                ..string.format(" (%.1f%% of a core)", client_load(v)))
+            print("  Context switches . . . . "..string.format("%12d voluntary, %d involuntary", v.vcsw, v.ivcsw))
+            if cpu_sets then
+                print("  CPUs . . . . . . . . . . "..string.format("%12s", cpu_sets[(i - 1) % #cpu_sets + 1]))
+            end
+            if conn_socket[i] then
+                print("  Open in server process . "..string.format("%12d", conn_socket[i].pid)
+                    .." since "..format_ns(conn_socket[i].first_ns - v.connect_end_ns):gsub("^ +", "")
+                    .." after connect() (sampled)")
+            end
+            if conn_thread[i] then
+                print("  Server thread  . . . . . "..string.format("%12d", conn_thread[i].tid)
+                    ..(conn_thread[i].name ~= "" and " ("..conn_thread[i].name..")" or ""))
+            end
+            if v.tcp then
+                local tcp = v.tcp
+                print("  TCP RTT  . . . . . . . . "..format_ns(tcp.rtt_avg_us * 1000).." average, "
+                    ..format_ns(tcp.rtt_max_us * 1000):gsub("^ +", "").." at most over "..tcp.samples.." samples")
+                if tcp.rtt_us then
+                    print("  TCP RTT at end . . . . . "..format_ns(tcp.rtt_us * 1000)..", variance "
+                        ..format_ns(tcp.rttvar_us * 1000):gsub("^ +", "")
+                        ..(tcp.min_rtt_us and ", minimum "..format_ns(tcp.min_rtt_us * 1000):gsub("^ +", "") or ""))
+                    print("  TCP retransmits  . . . . "..string.format("%12d segments, %d lost", tcp.retrans, tcp.lost)
+                        ..(tcp.ooo_packets and string.format(", %d out-of-order packets received", tcp.ooo_packets) or ""))
+                    print("  TCP cwnd . . . . . . . . "..string.format("%12d segments at end, %d at most, MSS %d",
+                        tcp.cwnd, tcp.cwnd_max, tcp.mss))
+                end
+                if tcp.delivery_rate then
+                    print("  TCP delivery rate  . . . "..format_bytes(tcp.delivery_rate).."/sec")
+                end
+                if tcp.busy_us and tcp.busy_us > 0 then
+                    print("  TCP sending limited by . "..format_tcp_limits(tcp.busy_us, tcp.rwnd_limited_us, tcp.sndbuf_limited_us))
+                end
+            end
+            if v.request_acked_ns then
+                print("  Last request byte  . . . "..format_ns((v.request_sent_ns or v.send_end_ns) - v.connect_end_ns)
+                    .." sent, "..format_ns(v.request_acked_ns - v.connect_end_ns):gsub("^ +", "")
+                    .." acknowledged after connect()")
+            end
+            if v.wakeup_ns then
+                print("  Receiver wake-up delay . "..format_ns(v.wakeup_ns).." for the last data (excluded)")
+            end
+            if v.queues then
+                local unsent, unacked, inq = 0, 0, 0
+                for k = 1, #v.queues.unsent do
+                    unsent = math.max(unsent, v.queues.unsent[k])
+                    unacked = math.max(unacked, v.queues.unacked[k])
+                    inq = math.max(inq, v.queues.inq[k])
+                end
+                print("  Socket queues  . . . . . "..format_bytes(unsent).." unsent, "
+                    ..format_bytes(unacked):gsub("^ +", "").." unacked, "..format_bytes(inq):gsub("^ +", "")
+                    .." unread at most")
+            end
+            if v.parse_error then
+                print("  Response error . . . . . "..v.parse_error)
+            end
             print("  Connect time . . . . . . "..format_ns(v.connect_end_ns - v.connect_start_ns))
+            if v.first_byte_ns then
+                print("  Time to first byte . . . "..format_ns(v.first_byte_ns - v.send_start_ns))
+            end
+            if v.first_response_ns then
+                print("  Time to first response . "..format_ns(v.first_response_ns - v.send_start_ns))
+            end
+            if v.gaps and #v.gaps > 0 then
+                local longest = 0
+                for _, gap in ipairs(v.gaps) do
+                    longest = math.max(longest, gap.end_ns - gap.start_ns)
+                end
+                print("  Longest response gap . . "..format_ns(longest).." ("..v.gaps_total.." gaps of at least "
+                    ..options.stall_gap.." ms)")
+            end
             print("  Send time  . . . . . . . "..format_ns(send_time))
             print("  Receive time . . . . . . "..format_ns(receive_time))
             print("  Total time . . . . . . . "..format_ns(total_time))
             print("  Send throughput  . . . . "..format_tp(v.total_sent, send_time).." (only useful on localhost)")
             print("  Receive throughput . . . "..format_tp(v.total_received, receive_time))
-            print("  Req/second (connected) . "..format_rps(options.nreq, v.receive_end_ns - v.send_start_ns))
-            print("  Req/second . . . . . . . "..format_rps(options.nreq, v.receive_end_ns - v.connect_start_ns))
-            -- Generate timeline: First send (">"), then receive ("<", or "X" when ">"), then connect and close ("*", "|")
-            local chars = {}
-            local steps = 40
-            local start_time = v.connect_start_ns
-            local time_per_step = (v.receive_end_ns - v.connect_start_ns) / (steps - 1)
-            local begin_send = (v.send_start_ns - start_time) / time_per_step
-            local end_send = (v.send_end_ns - start_time) / time_per_step
-            for i = math.floor(begin_send), math.floor(end_send) do
-                chars[i + 1] = ">"
-            end
-            local begin_recv = (v.receive_start_ns - start_time) / time_per_step
-            local end_recv = (v.receive_end_ns - start_time) / time_per_step
-            for i = math.floor(begin_recv), math.floor(end_recv) do
-                chars[i + 1] = chars[i + 1] and "X" or "<"
+            print("  Req/second (connected) . "..format_rps(conn_requests[i], v.receive_end_ns - v.send_start_ns))
+            print("  Req/second . . . . . . . "..format_rps(conn_requests[i], v.receive_end_ns - v.connect_start_ns))
+            if v.body_sent then
+                print("  Bodies sent  . . . . . . "..string.format("%12d", v.body_count))
+                print("  Upload bytes . . . . . . "..format_bytes(v.body_sent))
+                print("  Request head bytes . . . "..format_bytes(v.total_sent - v.body_sent - v.body_framing))
+                if v.body_framing > 0 then
+                    print("  Chunk framing bytes  . . "..format_bytes(v.body_framing))
+                end
+                print("  Upload time  . . . . . . "..format_ns(v.body_ns))
+                print("  Upload throughput  . . . "..format_tp(v.body_sent, v.body_ns))
             end
-            chars[math.floor((v.connect_end_ns - start_time) / time_per_step) + 1] = "*"
-            chars[math.floor((v.receive_end_ns - start_time) / time_per_step) + 1] = "|"
-            for i = 1, steps do
-                chars[i] = chars[i] or "."
+            if v.replay_lag_max_ns then
+                print("  Requests . . . . . . . . "..string.format("%12d", conn_requests[i]))
+                print("  Replay lag (max) . . . . "..format_ns(v.replay_lag_max_ns))
+                print("  Late requests  . . . . . "..string.format("%12d", v.replay_late))
             end
-            print("  ["..table.concat(chars).."]")
+            local steps = 40
+            print("  ["..timeline(v, v.connect_start_ns, (v.receive_end_ns - v.connect_start_ns) / (steps - 1), steps).."]")
         end
     end
     print("")
@@ -359,7 +2270,9 @@ if valid_entries <= 0 then
     return 1
 end
 
--- Timing table to compare the different connections start/duration/end
+-- Timing table to compare the different connections start/duration/end. Many connections
+-- are condensed into one row per set of connections with the same timeline, or a heat-map
+-- of their phases, so that the output does not grow with the number of connections.
 if options.show_timings then
     print("-------- Timing table --------")
     local steps = 50
@@ -367,39 +2280,544 @@ if options.show_timings then
     local total_time = last_receive_end - start_time
     local time_per_step = total_time / (steps - 1)
     local i_maxlen = #tostring(#results)
-    -- Sort by connect()
+    local function column(ns)
+        return math.floor((ns - start_time) / time_per_step)
+    end
+    -- Connections with the same columns of their phase boundaries have the same timeline
+    local clusters, cluster_of, nclusters = {}, {}, 0
+    if valid_entries > options.timing_rows then
+        for i, v in ipairs(results) do
+            if type(v) == "table" and nclusters <= options.timing_rows then
+                local key = string.format("%d %d %d %d %d %d %d", conn_group[i] or 0, column(v.connect_end_ns),
+                    column(v.send_start_ns), column(v.send_end_ns), column(v.receive_start_ns),
+                    column(v.first_byte_ns or v.receive_end_ns), column(v.receive_end_ns))
+                local c = cluster_of[key]
+                if not c then
+                    c = { conn_idx = i, v = v, group = conn_group[i] or 0, count = 0 }
+                    cluster_of[key] = c
+                    table.insert(clusters, c)
+                    nclusters = nclusters + 1
+                elseif v.connect_end_ns < c.v.connect_end_ns then
+                    c.conn_idx, c.v = i, v
+                end
+                c.count = c.count + 1
+            end
+        end
+    end
+    -- Sort by group, then by connect()
     local sorted_conns = {}
-    for i, v in ipairs(results) do
-        if type(v) == "table" then
-            table.insert(sorted_conns, { conn_idx = i, v = v})
+    if valid_entries <= options.timing_rows then
+        for i, v in ipairs(results) do
+            if type(v) == "table" then
+                table.insert(sorted_conns, { conn_idx = i, v = v, group = conn_group[i] or 0 })
+            end
         end
+    elseif nclusters <= options.timing_rows then
+        sorted_conns = clusters
     end
     table.sort(sorted_conns, function(a, b)
+        if a.group ~= b.group then
+            return a.group < b.group
+        end
         return a.v.connect_end_ns < b.v.connect_end_ns
     end)
     -- Print time span
     print("Duration: "..format_ns(total_time, "%.2f")..", "..format_ns(time_per_step, "%.2f").." per column.")
+    -- The heat-map labels its rows with the phases instead
+    local heatmap = valid_entries > options.timing_rows and #sorted_conns == 0
+    if not heatmap then
+        print("* connected, > sending, - waiting for the first response, < receiving, X both, | closed")
+    end
     -- Print table
-    for entry_idx, entry in ipairs(sorted_conns) do
-        local conn_idx, v = entry.conn_idx, entry.v
-        local chars = {}
-        local begin_send = (v.send_start_ns - start_time) / time_per_step
-        local end_send = (v.send_end_ns - start_time) / time_per_step
-        for i = math.floor(begin_send), math.floor(end_send) do
-            chars[i + 1] = ">"
-        end
-        local begin_recv = (v.receive_start_ns - start_time) / time_per_step
-        local end_recv = (v.receive_end_ns - start_time) / time_per_step
-        for i = math.floor(begin_recv), math.floor(end_recv) do
-            chars[i + 1] = chars[i + 1] and "X" or "<"
-        end
-        chars[math.floor((v.connect_end_ns - start_time) / time_per_step) + 1] = "*"
-        chars[math.floor((v.receive_end_ns - start_time) / time_per_step) + 1] = "|"
-        for i = 1, steps do
-            chars[i] = chars[i] or "."
-        end
-        print(string.rep(" ", i_maxlen - #tostring(conn_idx)).."#"..conn_idx.." ["..table.concat(chars).."] "..string.format("%"..i_maxlen.."d", entry_idx))
+    local last_group
+    if valid_entries <= options.timing_rows then
+        for entry_idx, entry in ipairs(sorted_conns) do
+            local conn_idx, v = entry.conn_idx, entry.v
+            if #group_names > 1 and entry.group ~= last_group then
+                print(group_names[entry.group]..":")
+                last_group = entry.group
+            end
+            print(string.rep(" ", i_maxlen - #tostring(conn_idx)).."#"..conn_idx.." ["..timeline(v, start_time, time_per_step, steps)
+                .."] "..string.format("%"..i_maxlen.."d", entry_idx))
+        end
+    elseif #sorted_conns > 0 then
+        print(valid_entries.." connections in "..nclusters.." rows of connections with the same timeline:")
+        for _, entry in ipairs(sorted_conns) do
+            if #group_names > 1 and entry.group ~= last_group then
+                print(group_names[entry.group]..":")
+                last_group = entry.group
+            end
+            print(string.format("%"..i_maxlen.."d x [", entry.count)..timeline(entry.v, start_time, time_per_step, steps)
+                .."] e.g. #"..entry.conn_idx)
+        end
+    else
+        -- Heat-map: share of the connections of a group in each phase, per column, as digits
+        -- which do not collide with the phase characters of the timelines
+        local phases = {
+            { "* connecting ", "connect_start_ns", "connect_end_ns" },
+            { "> sending    ", "send_start_ns", "send_end_ns" },
+            { "- waiting    ", "receive_start_ns", "first_byte_ns" },
+            { "< receiving  ", "first_byte_ns", "receive_end_ns" },
+            { "  open       ", "connect_start_ns", "receive_end_ns" },
+        }
+        local maps, totals = {}, {}
+        for i, v in ipairs(results) do
+            if type(v) == "table" then
+                local group = conn_group[i] or 0
+                local map = maps[group]
+                if not map then
+                    map = {}
+                    for p = 1, #phases do
+                        map[p] = {}
+                        for k = 1, steps + 1 do
+                            map[p][k] = 0
+                        end
+                    end
+                    maps[group] = map
+                end
+                totals[group] = (totals[group] or 0) + 1
+                -- Columns from..to in each phase, added up as differences
+                for p, phase in ipairs(phases) do
+                    local from_ns, to_ns = v[phase[2]], v[phase[3]] or v.receive_end_ns
+                    if to_ns >= from_ns then
+                        local from, to = math.max(0, column(from_ns)) + 1, math.min(steps - 1, column(to_ns)) + 1
+                        map[p][from] = map[p][from] + 1
+                        map[p][to + 1] = map[p][to + 1] - 1
+                    end
+                end
+            end
+        end
+        print(valid_entries.." connections, the share of them in each phase per column in tens of percent, from \"0\""
+            .." below 10% to \"9\" from 90%, blank for none:")
+        local groups = {}
+        for group in pairs(maps) do
+            table.insert(groups, group)
+        end
+        table.sort(groups)
+        for _, group in ipairs(groups) do
+            if #group_names > 1 then
+                print(group_names[group]..":")
+            end
+            for p, phase in ipairs(phases) do
+                local chars, running = {}, 0
+                for k = 1, steps do
+                    running = running + maps[group][p][k]
+                    chars[k] = running > 0 and tostring(math.min(9, running * 10 // totals[group])) or " "
+                end
+                print(phase[1].."["..table.concat(chars).."]")
+            end
+        end
+    end
+    print("")
+end
+
+-- Socket queues over time: each row sums the largest queues of every connection within it.
+-- Request bytes not sent yet mean that the server does not read them (its receive window is
+-- full), unacknowledged ones are in flight on the network, and unread response bytes wait
+-- for the client. With empty queues, an open connection waits for the server to respond.
+local function queue_constraint(unsent, unacked, inq)
+    if unsent > 0 then
+        return "server window"
+    elseif inq > 0 and inq >= unacked then
+        return "client"
+    elseif unacked > 0 then
+        return "network"
+    end
+    return "server"
+end
+local queue_rows, queue_time = {}, {}
+if options.queues and valid_entries > 0 then
+    local nrows, duration = 20, last_receive_end - earliest_connect_start
+    local width = duration / nrows
+    for k = 1, nrows do
+        queue_rows[k] = { time = k * width, unsent = 0, unacked = 0, inq = 0,
+            unsent_conns = 0, unacked_conns = 0, inq_conns = 0, conns = 0 }
+    end
+    for _, v in ipairs(results) do
+        local q = type(v) == "table" and v.queues
+        if q then
+            local peak = {}
+            for k = 1, #q.unsent do
+                local t = q.start_ns + (k - 1) * q.step_ns - earliest_connect_start
+                local row = width > 0 and math.max(1, math.min(nrows, math.floor(t / width) + 1)) or 1
+                local p = peak[row] or { unsent = 0, unacked = 0, inq = 0 }
+                p.unsent = math.max(p.unsent, q.unsent[k])
+                p.unacked = math.max(p.unacked, q.unacked[k])
+                p.inq = math.max(p.inq, q.inq[k])
+                peak[row] = p
+                local c = queue_constraint(q.unsent[k], q.unacked[k], q.inq[k])
+                queue_time[c] = (queue_time[c] or 0) + q.step_ns
+            end
+            for row, p in pairs(peak) do
+                local r = queue_rows[row]
+                r.conns = r.conns + 1
+                for _, key in ipairs({ "unsent", "unacked", "inq" }) do
+                    r[key] = r[key] + p[key]
+                    r[key.."_conns"] = r[key.."_conns"] + (p[key] > 0 and 1 or 0)
+                end
+            end
+        end
+    end
+end
+
+-- Throughput over time, the buckets of all connections summed on a common time axis
+local series
+if options.buckets and valid_entries > 0 then
+    local origin, step = math.huge, 0
+    for _, v in ipairs(results) do
+        if type(v) == "table" and v.buckets then
+            origin = math.min(origin, v.buckets.start_ns)
+            step = math.max(step, v.buckets.step_ns)
+        end
+    end
+    if step > 0 then
+        -- Statistics only cover the whole buckets after the first response arrived
+        local first_response = math.huge
+        for _, v in ipairs(results) do
+            if type(v) == "table" and v.first_response_ns then
+                first_response = math.min(first_response, v.first_response_ns)
+            end
+        end
+        local n = math.max(1, math.ceil((last_receive_end - origin) / step))
+        series = { origin = origin, step = step, sent = {}, received = {}, responses = {},
+            from = math.floor((first_response - origin) / step) + 2, to = math.floor((last_receive_end - origin) / step) }
+        if series.to < series.from then
+            series.from, series.to = 1, n
+        end
+        series.receiving = {}
+        for _, key in ipairs({ "sent", "received", "responses", "receiving" }) do
+            for k = 1, n do
+                series[key][k] = 0
+            end
+        end
+        for _, v in ipairs(results) do
+            local b = type(v) == "table" and v.buckets
+            if b then
+                local counted = 0
+                for k = 1, #b.sent do
+                    local t = b.start_ns - origin + (b.first + k - 1) * b.step_ns
+                    local idx = math.min(n, math.floor(t / step) + 1)
+                    for _, key in ipairs({ "sent", "received", "responses" }) do
+                        series[key][idx] = series[key][idx] + b[key][k]
+                    end
+                    -- Connections receiving data in a bucket
+                    if b.received[k] > 0 and idx > counted then
+                        series.receiving[idx] = series.receiving[idx] + 1
+                        counted = idx
+                    end
+                end
+            end
+        end
+        -- Per-second rates of the whole buckets
+        for _, key in ipairs({ "sent", "received", "responses" }) do
+            local sum, sum2, min, max, min_idx = 0, 0, math.huge, 0, series.from
+            for k = series.from, series.to do
+                local rate = series[key][k] * 1e9 / step
+                sum, sum2 = sum + rate, sum2 + rate * rate
+                if rate < min then
+                    min, min_idx = rate, k
+                end
+                max = math.max(max, rate)
+            end
+            local count = series.to - series.from + 1
+            local avg = sum / count
+            series[key.."_stats"] = { min = min, min_idx = min_idx, max = max, avg = avg,
+                stddev = math.sqrt(math.max(0, sum2 / count - avg * avg)) }
+        end
+    end
+end
+
+-- Server-wide stalls: pauses in which a share of the connections, which had received their
+-- first response and not yet their last one, all waited for their next response
+local stalls = {}
+if options.stall_gap and valid_entries > 0 then
+    local events = {}
+    for i, v in ipairs(results) do
+        if type(v) == "table" and v.first_response_ns then
+            table.insert(events, { t = v.first_response_ns, active = 1 })
+            table.insert(events, { t = v.last_byte_ns, active = -1 })
+            for _, gap in ipairs(v.gaps) do
+                table.insert(events, { t = gap.start_ns, stalled = 1, conn = i })
+                table.insert(events, { t = gap.end_ns, stalled = -1, conn = i })
+            end
+        end
+    end
+    -- At the same time, connections end their gaps before others begin them
+    table.sort(events, function(a, b)
+        if a.t ~= b.t then
+            return a.t < b.t
+        end
+        return (a.stalled or a.active) < (b.stalled or b.active)
+    end)
+    local active, stalled, waiting, pause = 0, 0, {}, nil
+    for _, e in ipairs(events) do
+        active = active + (e.active or 0)
+        stalled = stalled + (e.stalled or 0)
+        if e.conn then
+            waiting[e.conn] = e.stalled > 0 or nil
+        end
+        if active > 0 and stalled > 0 and stalled * 100 >= active * options.stall_share then
+            if not pause then
+                pause = { start_ns = e.t, stalled = 0, conns = {} }
+                for i in pairs(waiting) do
+                    pause.conns[i] = true
+                end
+            end
+            if e.conn then
+                pause.conns[e.conn] = true
+            end
+            if stalled > pause.stalled then
+                pause.stalled, pause.active = stalled, active
+            end
+        elseif pause then
+            pause.end_ns = e.t
+            if pause.end_ns - pause.start_ns >= options.stall_gap * 1e6 then
+                local n = 0
+                for _ in pairs(pause.conns) do
+                    n = n + 1
+                end
+                pause.affected = n
+                table.insert(stalls, pause)
+            end
+            pause = nil
+        end
+    end
+end
+
+-- Server concurrency and fairness: how many connections received data at once, the service
+-- time per request by Little's law, Jain's fairness index of the request rates of the
+-- connections and connections which waited far longer than the others for data
+local fairness
+if valid_entries > 0 then
+    fairness = { receiving_ns = 0, served = 0, responses = 0, rates = {}, waits = {}, max = 0 }
+    -- Receiving from the first to the last data, summed into columns of the timeline. Such a
+    -- span holds the service of every response after the first one. Connections which got
+    -- all their data in one recv() have no span and are left out.
+    local ncols = 60
+    local width = math.max(1, (last_receive_end - earliest_connect_start) / ncols)
+    local cols, full, events = {}, {}, {}
+    for k = 1, ncols + 1 do
+        cols[k], full[k] = 0, 0
+    end
+    for i, v in ipairs(results) do
+        if type(v) == "table" and v.first_byte_ns and v.last_byte_ns > v.first_byte_ns then
+            local from, to = v.first_byte_ns, v.last_byte_ns
+            fairness.receiving_ns = fairness.receiving_ns + to - from
+            fairness.served = fairness.served + math.max(1, v.responses - 1)
+            table.insert(events, { t = from, d = 1 })
+            table.insert(events, { t = to, d = -1 })
+            local a = math.max(0, (from - earliest_connect_start) / width)
+            local b = math.min(ncols, (to - earliest_connect_start) / width)
+            local ca, cb = math.floor(a) + 1, math.min(ncols, math.floor(b) + 1)
+            if ca == cb then
+                cols[ca] = cols[ca] + b - a
+            elseif ca < cb then
+                cols[ca] = cols[ca] + ca - a
+                cols[cb] = cols[cb] + b - (cb - 1)
+                full[ca + 1] = full[ca + 1] + 1
+                full[cb] = full[cb] - 1
+            end
+        end
+        if type(v) == "table" then
+            fairness.responses = fairness.responses + v.responses
+            local life = v.receive_end_ns - v.connect_start_ns
+            table.insert(fairness.rates, life > 0 and v.responses * 1e9 / life or 0)
+            if v.first_byte_ns then
+                table.insert(fairness.waits, { id = i, ns = v.first_byte_ns - v.send_start_ns })
+            end
+        end
+    end
+    local running = 0
+    for k = 1, ncols do
+        running = running + full[k]
+        cols[k] = cols[k] + running
     end
+    cols[ncols + 1] = nil
+    fairness.cols = series and series.receiving or cols
+    -- Little's law: connections in service = request rate * time in service per request
+    if series then
+        -- Connections receiving data per bucket, averaged over the buckets with any
+        local sum, busy = 0, 0
+        for _, receiving in ipairs(series.receiving) do
+            sum, busy = sum + receiving, busy + (receiving > 0 and 1 or 0)
+            fairness.max = math.max(fairness.max, receiving)
+        end
+        fairness.concurrency = busy > 0 and sum / busy or nil
+        fairness.service_ns = fairness.concurrency and fairness.responses > 0
+            and sum * series.step / fairness.responses or nil
+    else
+        -- Time in which at least one connection received
+        table.sort(events, function(a, b) return a.t < b.t or (a.t == b.t and a.d > b.d) end)
+        local receiving, busy_since, busy_ns = 0, nil, 0
+        for _, e in ipairs(events) do
+            receiving = receiving + e.d
+            fairness.max = math.max(fairness.max, receiving)
+            if receiving == 1 and e.d == 1 then
+                busy_since = e.t
+            elseif receiving == 0 and busy_since then
+                busy_ns = busy_ns + e.t - busy_since
+                busy_since = nil
+            end
+        end
+        -- Without any span, e.g. if every connection got one response, there is nothing to divide by
+        fairness.concurrency = busy_ns > 0 and fairness.receiving_ns / busy_ns or nil
+        fairness.service_ns = fairness.concurrency and fairness.receiving_ns / fairness.served or nil
+    end
+    -- Jain's index: 1 if all connections got the same request rate, 1/n if one got all
+    local sum, sum2 = 0, 0
+    for _, r in ipairs(fairness.rates) do
+        sum, sum2 = sum + r, sum2 + r * r
+    end
+    fairness.jain = sum2 > 0 and sum * sum / (#fairness.rates * sum2) or 1
+    -- Starved: waited for the first data ten times as long as the median, and at least 1 ms longer
+    table.sort(fairness.waits, function(a, b) return a.ns < b.ns end)
+    fairness.starved = 0
+    if #fairness.waits > 0 then
+        fairness.median_wait = fairness.waits[(#fairness.waits + 1) // 2].ns
+        fairness.worst = fairness.waits[#fairness.waits]
+        for _, w in ipairs(fairness.waits) do
+            if w.ns > fairness.median_wait * 10 and w.ns > fairness.median_wait + 1e6 then
+                fairness.starved = fairness.starved + 1
+            end
+        end
+    end
+    local verdict = fairness.jain >= 0.9 and "fair" or fairness.jain >= 0.7 and "somewhat unfair" or "strongly unfair"
+    fairness.diagnosis = fairness.concurrency and string.format("server processes ~%.0f connection%s concurrently",
+        fairness.concurrency, math.floor(fairness.concurrency + 0.5) == 1 and "" or "s")
+        ..(#fairness.rates > 1 and "; "..verdict or "")
+        ..(fairness.starved > 0 and "; "..fairness.starved.." starved" or "")
+end
+
+-- Sparkline of a sequence, with at most width columns averaging consecutive values
+local function sparkline(values, width)
+    local levels = " .:-=+*#%@"
+    local per = math.ceil(#values / width)
+    local cols, max = {}, 0
+    for k = 1, #values, per do
+        local sum = 0
+        for j = k, math.min(#values, k + per - 1) do
+            sum = sum + values[j]
+        end
+        table.insert(cols, sum / (math.min(#values, k + per - 1) - k + 1))
+        max = math.max(max, cols[#cols])
+    end
+    for k, c in ipairs(cols) do
+        local level = max > 0 and math.ceil(c / max * (#levels - 1)) or 0
+        cols[k] = levels:sub(level + 1, level + 1)
+    end
+    return table.concat(cols), per
+end
+
+-- Server resources over time, each row covering the samples since the previous one
+local server_rows = {}
+if server and #server.samples >= 2 then
+    local samples = server.samples
+    local step = math.max(1, math.ceil((#samples - 1) / 20))
+    local prev = samples[1]
+    for k = 1 + step, #samples + step - 1, step do
+        local s = samples[math.min(k, #samples)]
+        local dt = s.time_ns - prev.time_ns
+        if dt > 0 then
+            table.insert(server_rows, {
+                time = s.time_ns - earliest_connect_start, sample = s,
+                cpu = (s.cpu_ns - prev.cpu_ns) * 100 / dt, wait = (s.wait_ns - prev.wait_ns) * 100 / dt,
+                vcsw = (s.vcsw - prev.vcsw) * 1e9 / dt, ivcsw = (s.ivcsw - prev.ivcsw) * 1e9 / dt,
+                io = s.read_bytes and prev.read_bytes
+                    and (s.read_bytes - prev.read_bytes + s.write_bytes - prev.write_bytes) * 1e9 / dt })
+        end
+        prev = s
+    end
+end
+if #server_rows > 0 and options.show_timings then
+    print("------ Server resources ------")
+    print("Time since first connect()    CPU   Wait             RSS  Threads     FDs  Vol. cs/s  Inv. cs/s"
+        .."           Disk I/O")
+    for _, r in ipairs(server_rows) do
+        local s = r.sample
+        print(format_ns(r.time)..string.format("%13.1f%% %5.1f%% ", r.cpu, r.wait)
+            ..format_bytes(s.rss_kb * 1024)
+            ..string.format(" %8d %7s %10.0f %10.0f ", s.threads, s.fds or "-", r.vcsw, r.ivcsw)
+            ..(r.io and format_tp(r.io, 1e9) or string.format("%18s", "-")))
+    end
+    print("CPU and Wait (runnable, but waiting for a CPU) are in percent of one core.")
+    print("")
+end
+if #queue_rows > 0 and options.show_timings then
+    print("-------- Socket queues -------")
+    print("Time since first connect()           Unsent  Conns          Unacked  Conns           Unread  Conns  Constraint")
+    for _, r in ipairs(queue_rows) do
+        print(format_ns(r.time).."  "..format_bytes(r.unsent)..string.format(" %6d ", r.unsent_conns)
+            ..format_bytes(r.unacked)..string.format(" %6d ", r.unacked_conns)
+            ..format_bytes(r.inq)..string.format(" %6d  ", r.inq_conns)
+            ..(r.conns > 0 and queue_constraint(r.unsent, r.unacked, r.inq) or "-"))
+    end
+    print("Largest queues of each connection, summed: request bytes not sent yet because the server")
+    print("does not read them, request bytes not acknowledged yet and response bytes not read yet.")
+    print("")
+end
+if series and options.show_timings then
+    print("---- Throughput over time ----")
+    local rps_line, per = sparkline(series.responses, 60)
+    local rx_line = sparkline(series.received, 60)
+    local tx_line = sparkline(series.sent, 60)
+    print("Interval: "..format_ns(series.step, "%.2f")..", "..#series.responses.." intervals, "
+        ..per.." per column, from the start of the benchmark.")
+    print("Req/second         ["..rps_line.."]")
+    print("Receive throughput ["..rx_line.."]")
+    print("Send throughput    ["..tx_line.."]")
+    print("                        Minimum            Average            Maximum             Stddev")
+    for _, row in ipairs({ { "Req/second        ", "responses", function(r) return format_rps(r, 1e9).."      " end },
+            { "Receive throughput", "received", function(r) return format_tp(r, 1e9) end },
+            { "Send throughput   ", "sent", function(r) return format_tp(r, 1e9) end } }) do
+        local s, format = series[row[2].."_stats"], row[3]
+        print((string.gsub(row[1].." "..format(s.min).." "..format(s.avg).." "..format(s.max).." "..format(s.stddev), " +$", "")))
+    end
+    print("Sparklines are scaled to their largest column. The statistics cover intervals "..series.from
+        .." to "..series.to..(series.from > 1 and ", the whole ones after the first response." or "."))
+    print("")
+end
+if fairness and #fairness.rates > 1 and options.show_timings then
+    print("-------- Concurrency ---------")
+    print("Receiving ["..sparkline(fairness.cols, 60).."] "..fairness.max.." at most")
+    print("Connections receiving data over time, "..(series and "per interval of "..format_ns(series.step, "%.2f"):gsub("^ +", "")
+        or "from their first to their last data")..", scaled to the largest column.")
+    print("")
+end
+if #stalls > 0 and options.show_timings then
+    print("----------- Stalls -----------")
+    print("Time since first connect()         Duration   Stalled / active   Affected")
+    -- The longest ones, in the order they happened
+    local shown = { table.unpack(stalls) }
+    table.sort(shown, function(a, b) return a.end_ns - a.start_ns > b.end_ns - b.start_ns end)
+    for k = #shown, 21, -1 do
+        shown[k] = nil
+    end
+    table.sort(shown, function(a, b) return a.start_ns < b.start_ns end)
+    for _, s in ipairs(shown) do
+        print(format_ns(s.start_ns - earliest_connect_start).."  "..format_ns(s.end_ns - s.start_ns)
+            ..string.format("  %8d / %-8d %8d", s.stalled, s.active, s.affected))
+    end
+    if #stalls > #shown then
+        print("  ... and "..(#stalls - #shown).." shorter stalls")
+    end
+    print("Pauses in which at least "..options.stall_share.."% of the connections between their first and")
+    print("last response waited "..options.stall_gap.." ms or more for their next one, with the largest number")
+    print("of them at once and the number of connections which waited during the pause.")
+    print("")
+end
+if #server_threads > 0 and options.show_timings then
+    print("------- Server threads -------")
+    print("     PID      TID  Name                   Running         Waiting   Wait%  Conns  Connections")
+    for k, t in ipairs(server_threads) do
+        if k > 30 then
+            print("  ... and "..(#server_threads - 30).." more threads")
+            break
+        end
+        print(string.format("%8d %8d  %-15s", t.pid, t.tid, t.name)..format_ns(t.run_ns)..format_ns(t.wait_ns)
+            ..string.format(" %6.1f%% %6d  ", t.run_ns + t.wait_ns > 0 and t.wait_ns * 100 / (t.run_ns + t.wait_ns) or 0,
+                #t.conns)..format_ranges(t.conns))
+    end
+    print("Running and waiting for a CPU while sampled; connections in whose sockets a thread was seen.")
     print("")
 end
 
@@ -416,16 +2834,449 @@ if options.show_summary then
     end
     print("Total bytes sent . . . . . "..format_bytes(total_sent))
     print("Total bytes received . . . "..format_bytes(total_received))
+    print("Total responses  . . . . . "..string.format("%12d", total_responses))
+    if results.unique_responses then
+        print("Unique responses . . . . . "..string.format("%12d", results.unique_responses))
+    end
+    if next(parse_errors) then
+        print("Invalid responses:")
+        for k in pairs(parse_errors) do
+            print(" * "..k)
+        end
+    end
     print("Benchmark duration . . . . "..format_ns(benchmark_duration))
     print("Send throughput  . . . . . "..format_tp(total_sent, benchmark_duration))
     print("Receive throughput . . . . "..format_tp(total_received, benchmark_duration))
-    print("Aggregate req/second . . . "..format_rps(options.nreq * valid_entries, benchmark_duration))
+    print("Aggregate req/second . . . "..format_rps(total_requests, benchmark_duration))
+    if series then
+        local s = series.responses_stats
+        print("Req/second per interval  . "..format_rps(s.min, 1e9).." to "..format_rps(s.max, 1e9):gsub("^ +", "")
+            ..", stddev "..format_rps(s.stddev, 1e9):gsub("^ +", "")
+            .." ("..(series.to - series.from + 1).." intervals of "..format_ns(series.step, "%.0f")..")")
+        if s.avg > 0 and s.min < s.avg / 2 then
+            print(string.format("Warning: Throughput dropped to %.1f%% of its average in the interval at ", s.min * 100 / s.avg)
+                ..format_ns(math.max(0, series.origin + (s.min_idx - 1) * series.step - earliest_connect_start), "%.2f")
+                .." since the first connect(), e.g. by a pause of the server")
+        end
+    end
+    -- Request bodies, separated from request heads and responses
+    if any_target(function(t) return #t.options.bodies > 0 end) then
+        local bodies, body_sent, body_framing, body_ns, body_conns = 0, 0, 0, 0, 0
+        for _, v in ipairs(results) do
+            if type(v) == "table" and v.body_count then
+                bodies = bodies + v.body_count
+                body_sent = body_sent + v.body_sent
+                body_framing = body_framing + v.body_framing
+                body_ns = body_ns + v.body_ns
+                body_conns = body_conns + 1
+            end
+        end
+        print("Total bodies sent  . . . . "..string.format("%12d", bodies))
+        print("Total upload bytes . . . . "..format_bytes(body_sent))
+        print("Request head bytes sent  . "..format_bytes(total_sent - body_sent - body_framing))
+        if body_framing > 0 then
+            print("Chunk framing bytes sent . "..format_bytes(body_framing))
+        end
+        print("Upload throughput  . . . . "..format_tp(body_sent, benchmark_duration))
+        if body_ns > 0 then
+            print("Upload throughput/conn . . "..format_tp(body_sent / body_conns, body_ns / body_conns)
+                .." (while sending bodies)")
+        end
+    end
     print("Longest connection . . . . "..format_ns(max_duration).." (#"..max_duration_id..")")
     print("Average connection . . . . "..format_ns(avg_duration))
     print("Shortest connection  . . . "..format_ns(min_duration).." (#"..min_duration_id..")")
+    if fairness then
+        if fairness.concurrency then
+            print("Server concurrency . . . . "..string.format("%12.2f connections receiving on average, %d at most",
+                fairness.concurrency, fairness.max))
+        end
+        if fairness.service_ns then
+            print("Service time/request . . . "..format_ns(fairness.service_ns).." (by Little's law)")
+        end
+        if #fairness.rates > 1 then
+            print("Fairness (Jain's index)  . "..string.format("%12.3f", fairness.jain)
+                .." (1 if all connections got the same req/s)")
+        end
+        if fairness.worst and #fairness.waits > 1 then
+            print("Starved connections  . . . "..string.format("%12d", fairness.starved)..", longest wait for data "
+                ..format_ns(fairness.worst.ns, "%.2f").." (#"..fairness.worst.id.."), median "
+                ..format_ns(fairness.median_wait, "%.2f"))
+        end
+        if fairness.diagnosis then
+            print("Diagnosis: "..fairness.diagnosis)
+        end
+    end
+    if options.stall_gap then
+        local longest, total = 0, 0
+        for _, s in ipairs(stalls) do
+            longest = math.max(longest, s.end_ns - s.start_ns)
+            total = total + s.end_ns - s.start_ns
+        end
+        print("Server-wide stalls . . . . "..string.format("%12d", #stalls)
+            ..(#stalls > 0 and ", longest "..format_ns(longest, "%.2f")..", "..format_ns(total, "%.2f").." in total" or ""))
+        if total > benchmark_duration / 100 then
+            print(string.format("Warning: %.1f%% of the benchmark, at least %d%% of the connections waited for the server"
+                .." at once, e.g. in GC pauses or lock convoys, which the averages hide", total * 100 / benchmark_duration,
+                options.stall_share))
+        end
+        -- Connections keep only their longest gaps, so shorter stalls may be missed or cut short
+        local truncated = 0
+        for _, v in ipairs(results) do
+            if type(v) == "table" and v.gaps and v.gaps_total > #v.gaps then
+                truncated = truncated + 1
+            end
+        end
+        if truncated > 0 then
+            print(string.format("Warning: %d connections had more gaps than recorded, so stalls built from their"
+                .." shorter gaps are missing and the stalls are undercounted, use a larger gap for -stalls", truncated))
+        end
+    end
     print("Longest connect()  . . . . "..format_ns(max_connect).." (#"..max_connect_id..")")
     print("Average connect()  . . . . "..format_ns(avg_connect))
     print("Shortest connect() . . . . "..format_ns(min_connect).." (#"..min_connect_id..")")
+    -- Time to first byte and to the first complete response, from the start of sending
+    local max_ttfb, max_ttfb_id, min_ttfb, min_ttfb_id, sum_ttfb, n_ttfb = 0, nil, 0, nil, 0, 0
+    local sum_ttfr, n_ttfr = 0, 0
+    for i, v in ipairs(results) do
+        if type(v) == "table" and v.first_byte_ns then
+            local ttfb = v.first_byte_ns - v.send_start_ns
+            if not max_ttfb_id or ttfb > max_ttfb then
+                max_ttfb, max_ttfb_id = ttfb, i
+            end
+            if not min_ttfb_id or ttfb < min_ttfb then
+                min_ttfb, min_ttfb_id = ttfb, i
+            end
+            sum_ttfb, n_ttfb = sum_ttfb + ttfb, n_ttfb + 1
+        end
+        if type(v) == "table" and v.first_response_ns then
+            sum_ttfr, n_ttfr = sum_ttfr + v.first_response_ns - v.send_start_ns, n_ttfr + 1
+        end
+    end
+    if n_ttfb > 0 then
+        print("Longest TTFB . . . . . . . "..format_ns(max_ttfb).." (#"..max_ttfb_id..")")
+        print("Average TTFB . . . . . . . "..format_ns(sum_ttfb / n_ttfb))
+        print("Shortest TTFB  . . . . . . "..format_ns(min_ttfb).." (#"..min_ttfb_id..")")
+    end
+    if n_ttfr > 0 then
+        print("Average first response . . "..format_ns(sum_ttfr / n_ttfr))
+    end
+    -- Cost of the client itself, to tell when it limits the results
+    local client = results.client
+    local max_load, max_load_id, sum_load = 0, nil, 0
+    for i, v in ipairs(results) do
+        if type(v) == "table" then
+            local load = client_load(v)
+            if not max_load_id or load > max_load then
+                max_load, max_load_id = load, i
+            end
+            sum_load = sum_load + load
+        end
+    end
+    print("Client CPU time  . . . . . "..format_ns(client.cpu_ns)
+        ..string.format(" (%.2f cores)", benchmark_duration > 0 and client.cpu_ns / benchmark_duration or 0))
+    if total_requests > 0 then
+        print("Client CPU/1M requests . . "..format_ns(client.cpu_ns * 1e6 / total_requests))
+    end
+    print("Client context switches  . "..string.format("%12d voluntary, %d involuntary", client.vcsw, client.ivcsw))
+    print("Client peak RSS  . . . . . "..format_bytes(client.maxrss_kb * 1024)
+        ..(client.processes > 1 and " (largest of "..client.processes.." processes)" or ""))
+    if max_load_id then
+        print("Client load/connection . . "..string.format("%11.1f%% of a core on average, %.1f%% at most (#%d)",
+            sum_load / valid_entries, max_load, max_load_id))
+        if max_load > options.client_limit then
+            print(string.format("Warning: Connection #%d used %.1f%% of a CPU core, so the results may be bounded"
+                .." by the client rather than the server (see -client-limit)", max_load_id, max_load))
+        end
+    end
+    -- Delays removed by kernel timestamps
+    if options.timestamps then
+        local wakeups, sum_wakeup, max_wakeup, max_wakeup_id = 0, 0, 0, nil
+        local acks, sum_ack = 0, 0
+        for i, v in ipairs(results) do
+            if type(v) == "table" and v.wakeup_ns then
+                wakeups, sum_wakeup = wakeups + 1, sum_wakeup + v.wakeup_ns
+                if not max_wakeup_id or v.wakeup_ns > max_wakeup then
+                    max_wakeup, max_wakeup_id = v.wakeup_ns, i
+                end
+            end
+            if type(v) == "table" and v.request_acked_ns and v.request_sent_ns then
+                acks, sum_ack = acks + 1, sum_ack + v.request_acked_ns - v.request_sent_ns
+            end
+        end
+        if wakeups > 0 then
+            print("Receiver wake-up delay . . "..format_ns(sum_wakeup / wakeups).." on average, "
+                ..format_ns(max_wakeup):gsub("^ +", "").." at most (#"..max_wakeup_id..")")
+        end
+        if acks > 0 then
+            print("Last request byte acked  . "..format_ns(sum_ack / acks).." after it was sent, on average")
+        end
+        if wakeups < valid_entries then
+            print("Warning: The kernel reported no timestamps for "..(valid_entries - wakeups).." connections,"
+                .." their timings include the wake-up delay of the receiver")
+        end
+    end
+    -- Network path as seen by TCP_INFO of the connections
+    if options.tcp_info then
+        local sampled, rtt_sum, rtt_max, rtt_max_id, min_rtt = 0, 0, 0, nil, nil
+        local retrans, lossy, ooo, busy, rwnd, sndbuf = 0, 0, 0, 0, 0, 0
+        local last, rttvar_sum, cwnd_sum, cwnd_max, cwnd_max_id = 0, 0, 0, 0, nil
+        local rated, rate_sum, rate_min, rate_max = 0, 0, nil, 0
+        for i, v in ipairs(results) do
+            local tcp = type(v) == "table" and v.tcp
+            if tcp then
+                sampled = sampled + 1
+                rtt_sum = rtt_sum + tcp.rtt_avg_us
+                if not rtt_max_id or tcp.rtt_max_us > rtt_max then
+                    rtt_max, rtt_max_id = tcp.rtt_max_us, i
+                end
+                if tcp.min_rtt_us and (not min_rtt or tcp.min_rtt_us < min_rtt) then
+                    min_rtt = tcp.min_rtt_us
+                end
+                if tcp.retrans and (tcp.retrans > 0 or (tcp.ooo_packets or 0) > 0) then
+                    lossy = lossy + 1
+                end
+                retrans = retrans + (tcp.retrans or 0)
+                ooo = ooo + (tcp.ooo_packets or 0)
+                if not cwnd_max_id or tcp.cwnd_max > cwnd_max then
+                    cwnd_max, cwnd_max_id = tcp.cwnd_max, i
+                end
+                if tcp.cwnd then
+                    last = last + 1
+                    rttvar_sum, cwnd_sum = rttvar_sum + tcp.rttvar_us, cwnd_sum + tcp.cwnd
+                end
+                if tcp.delivery_rate then
+                    rated, rate_sum = rated + 1, rate_sum + tcp.delivery_rate
+                    rate_min = math.min(rate_min or tcp.delivery_rate, tcp.delivery_rate)
+                    rate_max = math.max(rate_max, tcp.delivery_rate)
+                end
+                if tcp.busy_us then
+                    busy, rwnd, sndbuf = busy + tcp.busy_us, rwnd + tcp.rwnd_limited_us, sndbuf + tcp.sndbuf_limited_us
+                end
+            end
+        end
+        if sampled > 0 then
+            print("TCP RTT  . . . . . . . . . "..format_ns(rtt_sum * 1000 / sampled).." on average, "
+                ..format_ns(rtt_max * 1000):gsub("^ +", "").." at most (#"..rtt_max_id..")"
+                ..(min_rtt and ", "..format_ns(min_rtt * 1000):gsub("^ +", "").." minimum" or ""))
+            if last > 0 then
+                print("TCP RTT variance . . . . . "..format_ns(rttvar_sum * 1000 / last).." on average at end")
+            end
+            print("TCP cwnd . . . . . . . . . "..string.format("%12d segments at most (#%d)", cwnd_max, cwnd_max_id)
+                ..(last > 0 and string.format(", %.1f on average at end", cwnd_sum / last) or ""))
+            if rated > 0 then
+                print("TCP delivery rate  . . . . "..format_bytes(rate_sum / rated).."/sec on average, "
+                    ..format_bytes(rate_min):gsub("^ +", "").."/sec minimum, "
+                    ..format_bytes(rate_max):gsub("^ +", "").."/sec maximum")
+            end
+            print("TCP retransmits  . . . . . "..string.format("%12d segments, %d out-of-order packets received", retrans, ooo))
+            if busy > 0 then
+                print("TCP sending limited by . . "..format_tcp_limits(busy, rwnd, sndbuf))
+            end
+            if lossy > 0 then
+                print(string.format("Warning: %d of %d connections saw retransmits or out-of-order packets, so the"
+                    .." link may be lossy and slow responses may be caused by the network", lossy, sampled))
+            end
+            if busy > 0 and rwnd * 2 > busy then
+                print("Warning: Sending requests was mostly limited by the receive window of the server,"
+                    .." which does not read them fast enough")
+            end
+        end
+    end
+    -- Constraint according to the socket queues, weighted by sampled connection time
+    if next(queue_time) then
+        local total = 0
+        for _, t in pairs(queue_time) do
+            total = total + t
+        end
+        local function share(c)
+            return (queue_time[c] or 0) * 100 / total
+        end
+        print("Socket queue constraint  . "..string.format("%11.1f%% server, %.1f%% server window, %.1f%% network,"
+            .." %.1f%% client", share("server"), share("server window"), share("network"), share("client")))
+        if (queue_time.client or 0) * 4 > total then
+            print("Warning: Responses waited for the client to read them in more than a quarter of the"
+                .." sampled time, so the results may be bounded by the client")
+        end
+    end
+    -- Accept queue of the server and overflows of listen queues
+    local listen = results.listen
+    if listen and #listen.samples > 0 then
+        local samples = listen.samples
+        local first, last = samples[1], samples[#samples]
+        local max_queue, max_queue_time, found, first_overflow = 0, nil, false, nil
+        for k, s in ipairs(samples) do
+            found = found or s.sockets > 0
+            if s.queue > max_queue then
+                max_queue, max_queue_time = s.queue, s.time_ns
+            end
+            if not first_overflow and k > 1 and (s.overflows > first.overflows or s.drops > first.drops) then
+                first_overflow = k
+            end
+        end
+        if found then
+            print("Accept queue . . . . . . . "..string.format("%12d at most", max_queue)
+                ..(max_queue_time and " ("..format_ns(max_queue_time - earliest_connect_start):gsub("^ +", "")
+                    .." after first connect())" or "")..", backlog "..listen.backlog)
+        else
+            print("Accept queue . . . . . . . "..string.format("%12s", "(unknown)").." no listening socket on port "
+                ..table.concat(listen.ports, ", ").." on this host")
+        end
+        local overflows, drops = last.overflows - first.overflows, last.drops - first.drops
+        print("Listen overflows/drops . . "..string.format("%12d overflows, %d drops", overflows, drops)
+            .." (all listening sockets of this host)")
+        if first_overflow then
+            local f = io.open("/proc/sys/net/core/somaxconn", "r")
+            local somaxconn = f and f:read("n")
+            if f then
+                f:close()
+            end
+            print(string.format("Warning: The listen queue overflowed %d times and dropped %d connection requests,"
+                .." first between %s and %s after the first connect(). This causes resets, failed and slow"
+                .." connects. Increase the backlog of listen() in the server%s%s.", overflows, drops,
+                format_ns(samples[first_overflow - 1].time_ns - earliest_connect_start):gsub("^ +", ""),
+                format_ns(samples[first_overflow].time_ns - earliest_connect_start):gsub("^ +", ""),
+                found and " (now "..listen.backlog..")" or "",
+                somaxconn and " and net.core.somaxconn (now "..somaxconn..")" or ""))
+        elseif found and listen.backlog > 0 and max_queue >= listen.backlog then
+            print("Warning: The accept queue of the server was full, further connections would have been dropped."
+                .." Increase the backlog of listen() in the server.")
+        end
+        if listen.error then
+            print("Warning: Accept queue sampling stopped early: "..listen.error)
+        end
+    end
+    -- Server resources over the whole run
+    if server then
+        local samples = server.samples
+        local first, last = samples[1], samples[#samples]
+        if #server_rows > 0 then
+            local dt = last.time_ns - first.time_ns
+            local peak_cpu, peak_threads, peak_fds, peak_rss = 0, 0, nil, 0
+            for _, r in ipairs(server_rows) do
+                peak_cpu = math.max(peak_cpu, r.cpu)
+            end
+            for _, s in ipairs(samples) do
+                peak_threads = math.max(peak_threads, s.threads)
+                peak_rss = math.max(peak_rss, s.rss_kb)
+                peak_fds = s.fds and math.max(peak_fds or 0, s.fds) or peak_fds
+            end
+            print("Server CPU . . . . . . . . "..string.format("%11.1f%% of a core on average, %.1f%% at most",
+                (last.cpu_ns - first.cpu_ns) * 100 / dt, peak_cpu))
+            print("Server run queue wait  . . "..format_ns(last.wait_ns - first.wait_ns)
+                ..string.format(" (%.1f%% of running time)", last.run_ns > first.run_ns
+                    and (last.wait_ns - first.wait_ns) * 100 / (last.run_ns - first.run_ns) or 0))
+            print("Server context switches  . "..string.format("%12d voluntary, %d involuntary",
+                last.vcsw - first.vcsw, last.ivcsw - first.ivcsw))
+            print("Server RSS . . . . . . . . "..format_bytes(last.rss_kb * 1024).." at end, "
+                ..format_bytes(peak_rss * 1024):gsub("^ +", "").." at most, "
+                ..string.format("%+.1f%%", first.rss_kb > 0 and (last.rss_kb - first.rss_kb) * 100 / first.rss_kb or 0)
+                .." during run")
+            print("Server threads/FDs . . . . "..string.format("%12d at most", peak_threads)
+                ..(peak_fds and string.format(", %d file descriptors at most", peak_fds) or ""))
+        end
+        if threading_model then
+            print("Server threading model . . "..threading_model)
+        end
+        if server_wait then
+            print("Server threads waiting . . "..string.format("%11.1f%% of their time runnable without a CPU", server_wait))
+        end
+        if server.error then
+            print("Warning: Server sampling stopped early: "..server.error)
+        end
+        if last and last.processes < #server.pids then
+            print("Warning: "..(#server.pids - last.processes).." of "..#server.pids
+                .." server processes ended during the run")
+        end
+    end
+    -- Lag behind the replay schedule
+    if any_target(function(t) return t.replay end) then
+        local lag_max, lag_max_id, lag_total, late, replayed, replay_duration = 0, nil, 0, 0, 0, 0
+        for _, t in ipairs(prepared) do
+            if t.replay then
+                replay_duration = math.max(replay_duration, t.replay_duration)
+            end
+        end
+        for i, v in ipairs(results) do
+            if type(v) == "table" and v.replay_lag_max_ns then
+                if not lag_max_id or v.replay_lag_max_ns > lag_max then
+                    lag_max, lag_max_id = v.replay_lag_max_ns, i
+                end
+                lag_total = lag_total + v.replay_lag_total_ns
+                replayed = replayed + conn_requests[i]
+                late = late + v.replay_late
+            end
+        end
+        print("Replay schedule  . . . . . "..format_ns(replay_duration))
+        print("Longest replay lag . . . . "..format_ns(lag_max).." (#"..lag_max_id..")")
+        print("Average replay lag . . . . "..format_ns(replayed > 0 and lag_total / replayed or 0))
+        print("Requests late by > 1 ms  . "..string.format("%12d %7.2f%%", late,
+            replayed > 0 and late * 100 / replayed or 0))
+    end
+    -- Results per group of connections, each over its own first connect to last close
+    if #group_names > 1 then
+        local gs = {}
+        for g = 1, #group_names do
+            gs[g] = { conns = 0, ok = 0, responses = 0, sent = 0, received = 0, duration = 0 }
+        end
+        for i, v in ipairs(results) do
+            local g = gs[conn_group[i]]
+            g.conns = g.conns + 1
+            if type(v) == "table" then
+                g.ok = g.ok + 1
+                g.responses = g.responses + v.responses
+                g.sent = g.sent + v.total_sent
+                g.received = g.received + v.total_received
+                g.duration = g.duration + (v.receive_end_ns - v.connect_start_ns)
+                g.first = math.min(g.first or v.connect_start_ns, v.connect_start_ns)
+                g.last = math.max(g.last or v.receive_end_ns, v.receive_end_ns)
+            end
+        end
+        print("Results per group:")
+        print("  Conns  Failed  Responses     Bytes sent  Bytes received   Req/second Avg. connection  Group")
+        for k, name in ipairs(group_names) do
+            local g = gs[k]
+            print(string.format("  %5d  %6d  %9d ", g.conns, g.conns - g.ok, g.responses)
+                ..format_bytes(g.sent).."  "..format_bytes(g.received).." "
+                ..(g.ok > 0 and format_rps(g.responses, g.last - g.first)..format_ns(g.duration / g.ok, "%13.2f")
+                    or string.format("%12s%16s", "-", "-"))
+                .."  "..name)
+        end
+    end
+    -- Results per mix entry, summed over all successful connections of a target
+    for target_idx, t in ipairs(prepared) do
+        local mix = t.mix
+        if mix and #mix > 1 then
+            local eps, responses = {}, 0
+            for k = 1, #mix do
+                eps[k] = { requests = 0, responses = 0, bytes = 0, status_classes = { 0, 0, 0, 0, 0 } }
+            end
+            for i, v in ipairs(results) do
+                if type(v) == "table" and v.endpoints and conn_target[i] == target_idx then
+                    for k, ep in ipairs(v.endpoints) do
+                        eps[k].requests = eps[k].requests + ep.requests
+                        eps[k].responses = eps[k].responses + ep.responses
+                        eps[k].bytes = eps[k].bytes + ep.bytes
+                        for c = 1, 5 do
+                            eps[k].status_classes[c] = eps[k].status_classes[c] + ep.status_classes[c]
+                        end
+                    end
+                    responses = responses + v.responses
+                end
+            end
+            print("Results per mix entry"..(#prepared > 1 and " of "..t.label or "")..":")
+            print("  Weight   Share  Requests Responses   1xx   2xx   3xx   4xx   5xx     Req/second   Received     Path")
+            for k, m in ipairs(mix) do
+                local ep = eps[k]
+                local sc = ep.status_classes
+                print(string.format("  %6d %6.2f%% %9d %9d %5d %5d %5d %5d %5d", m.weight,
+                        responses > 0 and ep.responses * 100 / responses or 0,
+                        ep.requests, ep.responses, sc[1], sc[2], sc[3], sc[4], sc[5])
+                    ..format_rps(ep.responses, benchmark_duration)..format_bytes(ep.bytes)
+                    .."  "..(m.method ~= "GET" and m.method.." " or "")..m.path)
+            end
+        end
+    end
 end
 
 return 0